@@ -0,0 +1,80 @@
+/*
+ * Arduino.h
+ *
+ * Just enough of the Arduino API for both ends of the I2C protocol to compile
+ * on linux/MacOS: the SynchroClock Clock library (ESP8266) and the
+ * I2CAnalogClock protocol and state machine (ATtiny85).
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define __AVR_ATtinyX5__    // the clock side uses the ATtiny85 configuration
+#ifndef F_CPU
+#define F_CPU 1000000L
+#endif
+
+typedef bool boolean;
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define CHANGE          1
+#define SDA             4
+#define SCL             5
+
+// every transfer is run to the end before the next one just like an ISR
+#define noInterrupts()
+#define interrupts()
+
+// the esp8266 keeps constant strings in flash, on unix they are just strings.
+#define PROGMEM
+#define ICACHE_RAM_ATTR
+#define F(s)            (s)
+#define FPSTR(s)        (s)
+#define PSTR(s)         (s)
+#define snprintf_P      snprintf
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+inline void     pinMode(uint8_t, uint8_t)      {}
+inline void     digitalWrite(uint8_t, uint8_t) {}
+inline int      digitalRead(uint8_t)           { return HIGH; } // the bus is never held low
+inline int      digitalPinToInterrupt(int pin) { return pin; }
+inline void     attachInterrupt(int, void (*)(), int) {}
+inline void     delay(unsigned long)           {}
+inline void     delayMicroseconds(unsigned int) {}
+inline uint32_t millis()                       { return 0; }
+inline uint32_t micros()                       { return 0; }
+
+//
+// RTC memory is never valid, the I2C counters start over every run.
+//
+#define REASON_DEEP_SLEEP_AWAKE 5
+
+struct rst_info
+{
+    uint32_t reason;
+};
+
+class EspClass
+{
+public:
+    bool      rtcUserMemoryRead(uint32_t, uint32_t*, size_t)  { return false; }
+    bool      rtcUserMemoryWrite(uint32_t, uint32_t*, size_t) { return false; }
+    rst_info* getResetInfoPtr()                               { static rst_info info = { 0 }; return &info; }
+};
+
+extern EspClass ESP;
+
+#endif /* ARDUINO_H_ */
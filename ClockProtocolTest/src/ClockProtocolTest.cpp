@@ -0,0 +1,291 @@
+//============================================================================
+// Name        : ClockProtocolTest.cpp
+// Description : Run the SynchroClock Clock class against the I2CAnalogClock
+//               protocol handlers over a simulated I2C bus that flips bits,
+//               check the framing, the ack register and that both ends
+//               agree on the CRC and the block sizes.
+//============================================================================
+
+#include "Clock.h"
+#include "Slave.h"
+#include "Wire.h"
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define CRC_CHECK_VALUE 0xf4    // CRC-8 (polynomial 0x07) of "123456789"
+#define CRC_RUNS        10000
+
+EspClass ESP;
+
+static int errors  = 0;
+static int verbose = 0;
+
+static void check(bool ok, const char* what, long expected, long actual)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s expected: %ld actual: %ld\n", what, expected, actual);
+        errors += 1;
+    }
+}
+
+//
+// the bitwise CRC-8 the table in the firmware must match
+//
+static uint8_t crc8Bits(uint8_t crc, const uint8_t* data, size_t length)
+{
+    while (length--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void testCRC()
+{
+    const uint8_t check_data[] = "123456789";
+    check(slaveCRC8(0, check_data, 9) == CRC_CHECK_VALUE, "crc check value", CRC_CHECK_VALUE, slaveCRC8(0, check_data, 9));
+
+    for (int i = 0; i < CRC_RUNS; ++i)
+    {
+        uint8_t data[CLOCK_FRAME_MAX];
+        uint8_t size = (uint8_t)(Wire.random() * sizeof(data));
+        uint8_t crc  = (uint8_t)(Wire.random() * 256);
+        for (uint8_t j = 0; j < size; ++j)
+        {
+            data[j] = (uint8_t)(Wire.random() * 256);
+        }
+        uint8_t expected = crc8Bits(crc, data, size);
+        uint8_t actual   = slaveCRC8(crc, data, size);
+        if (expected != actual)
+        {
+            check(false, "crc", expected, actual);
+            break;
+        }
+    }
+}
+
+//
+// the Clock library has its own copy of the block layouts
+//
+static void testSizes()
+{
+    check(sizeof(ClockConfig) == slaveConfigSize(), "config size", slaveConfigSize(), sizeof(ClockConfig));
+    check(CLOCK_CONFIG_V2_SIZE == slaveConfigMinSize(), "first config size", slaveConfigMinSize(), CLOCK_CONFIG_V2_SIZE);
+    check(CLOCK_CONFIG_V2_SIZE == offsetof(ClockConfig, ap_fast_duration), "version 2 config size",
+            offsetof(ClockConfig, ap_fast_duration), CLOCK_CONFIG_V2_SIZE);
+    check(CLOCK_CONFIG_V4_SIZE == offsetof(ClockConfig, sense), "version 4 config size",
+            offsetof(ClockConfig, sense), CLOCK_CONFIG_V4_SIZE);
+    check(CLOCK_STATE_SIZE == slaveStateSize(), "state size", slaveStateSize(), CLOCK_STATE_SIZE);
+    check(CLOCK_FRAME_MAX == slaveFrameMax() + 1, "frame size", slaveFrameMax() + 1, CLOCK_FRAME_MAX);
+}
+
+//
+// every field of a config block write lands in the same field of the firmware
+//
+static void testConfig()
+{
+    slaveBegin();
+    Clock clk(0);
+    clk.setFramed(true);
+    check(clk.begin() == 0 && clk.isFramed(), "framed begin", 1, clk.isFramed());
+
+    ClockConfig cc;
+    uint8_t* bytes = (uint8_t*)&cc;
+    for (size_t i = 0; i < sizeof(cc); ++i)
+    {
+        bytes[i] = (uint8_t)(i + 1);
+    }
+    check(clk.writeConfigBlock(&cc) == 0, "config write", 0, -1);
+
+    uint8_t slave[sizeof(ClockConfig)];
+    slaveGetConfig(slave);
+    check(memcmp(slave, &cc, sizeof(cc)) == 0, "config layout", 0, memcmp(slave, &cc, sizeof(cc)));
+
+    ClockConfig read;
+    memset(&read, 0, sizeof(read));
+    check(clk.readConfigBlock(&read) == 0 && memcmp(&read, &cc, sizeof(cc)) == 0, "config read", 0, -1);
+
+    uint8_t ramp;
+    check(clk.readAPRamp(&ramp) == 0 && ramp == cc.ap_ramp, "ramp", cc.ap_ramp, ramp);
+}
+
+//
+// a framed write is confirmed by the ack register and sent again if the write or the ack got corrupted
+//
+static void testAck()
+{
+    slaveBegin();
+    Clock clk(0);
+    clk.setFramed(true);
+    clk.begin();
+
+    check(clk.writeAdjustment(100) == 0 && slaveGetAdjustment() == 100, "framed write", 100, slaveGetAdjustment());
+    check(slaveAckOK() && slaveAckSeq() != 0xff, "ack", 1, slaveAckOK());
+
+    // a value bit of the write, then the sequence number of the ack reply
+    uint32_t flips = Wire.flips;
+    Wire.flip(1, 2 * 8 + 3);
+    check(clk.writeAdjustment(200) == 0 && slaveGetAdjustment() == 200, "corrupted write", 200, slaveGetAdjustment());
+    Wire.flip(3, 5);
+    check(clk.writeAdjustment(300) == 0 && slaveGetAdjustment() == 300, "corrupted ack", 300, slaveGetAdjustment());
+    check(Wire.flips - flips == 2, "flips", 2, Wire.flips - flips);
+
+    // nothing gets through, the write fails and the value is left alone
+    Wire.noise = 1.0;
+    int err = clk.writeAdjustment(400);
+    Wire.noise = 0.0;
+    check(err != 0 && slaveGetAdjustment() == 300, "bad frames", 300, slaveGetAdjustment());
+    check(!slaveAckOK(), "bad frame ack", 0, slaveAckOK());
+}
+
+//
+// once a frame is seen a write without CMD_FRAMED is dropped, it could be a read that lost the bit
+//
+static void testFramesOnly()
+{
+    slaveBegin();
+    Clock plain(0);
+    plain.begin();
+    check(plain.writeAdjustment(10) == 0 && slaveGetAdjustment() == 10, "plain write", 10, slaveGetAdjustment());
+    check(!slaveFramesOnly(), "frames only before a frame", 0, slaveFramesOnly());
+
+    Clock clk(0);
+    clk.setFramed(true);
+    clk.begin();
+    uint16_t position;
+    clk.readPosition(&position);
+    check(slaveFramesOnly(), "frames only", 1, slaveFramesOnly());
+
+    plain.writeAdjustment(20);
+    check(slaveGetAdjustment() == 10, "plain write after a frame", 10, slaveGetAdjustment());
+    check(!slaveAckOK(), "plain write ack", 0, slaveAckOK());
+
+    slaveSetPosition(1234);
+    check(plain.readPosition(&position) == 0 && position == 1234, "plain read after a frame", 1234, position);
+
+    // CMD_FRAMED is the msb of the command
+    Wire.flip(1, 0);
+    check(clk.writeAdjustment(30) == 0 && slaveGetAdjustment() == 30, "lost frame bit", 30, slaveGetAdjustment());
+}
+
+//
+// the fastest speed that passes is used, the bus flips a bit in every transfer above max_speed
+//
+static void testSpeed()
+{
+    slaveBegin();
+    Clock clk(0);
+    clk.setFramed(true);
+    clk.begin();
+    Wire.max_speed = 200000;
+    uint32_t speed = clk.negotiateSpeed();
+    Wire.max_speed = 0;
+    check(speed == 200000, "negotiated speed", 200000, speed);
+}
+
+//
+// random reads and writes on a noisy bus, a transfer can fail but never return or write a wrong value
+//
+static void testNoise(uint32_t rounds, double noise)
+{
+    slaveBegin();
+    Clock clk(0);
+    clk.setFramed(true);
+    clk.begin();
+
+    uint32_t transfers  = Wire.transfers;
+    uint32_t flips      = Wire.flips;
+    uint32_t failed     = 0;
+    uint32_t undetected = 0;
+    Wire.noise = noise;
+    for (uint32_t i = 0; i < rounds; ++i)
+    {
+        uint16_t p = (uint16_t)(Wire.random() * CLOCK_MAX);
+        uint16_t value;
+        slaveSetPosition(p);
+        if (clk.readPosition(&value))
+        {
+            failed += 1;
+        }
+        else if (value != p)
+        {
+            undetected += 1;
+        }
+
+        uint16_t before = slaveGetAdjustment();
+        uint16_t a      = (uint16_t)(Wire.random() * 1000);
+        if (clk.writeAdjustment(a))
+        {
+            failed += 1;
+            // the write may have made it and only the ack was lost
+            if (slaveGetAdjustment() != before && slaveGetAdjustment() != a)
+            {
+                undetected += 1;
+            }
+        }
+        else if (slaveGetAdjustment() != a)
+        {
+            undetected += 1;
+        }
+
+        ClockState state;
+        if (clk.readState(&state))
+        {
+            failed += 1;
+        }
+        else if (state.position != p || state.adjustment != slaveGetAdjustment() || state.id != CLOCK_ID_VALUE)
+        {
+            undetected += 1;
+        }
+    }
+    Wire.noise = 0.0;
+
+    check(undetected == 0, "undetected", 0, undetected);
+    if (verbose)
+    {
+        printf("noise: %g rounds: %u transfers: %u flips: %u failed: %u undetected: %u\n",
+                noise, rounds, Wire.transfers - transfers, Wire.flips - flips, failed, undetected);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = 20000;
+    uint64_t seed   = 1;
+    double   noise  = 0.01;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:S:e:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': rounds = strtoul(optarg, NULL, 0);    break;
+        case 'S': seed   = strtoull(optarg, NULL, 0);   break;
+        case 'e': noise  = atof(optarg);                break;
+        case 'v': verbose += 1;                         break;
+        default:
+            printf("usage: %s [-n rounds] [-S seed] [-e noise] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    dlog.setLevel(verbose > 1 ? DLOG_LEVEL_INFO : DLOG_LEVEL_NONE);
+    Wire.seed(seed);
+
+    testCRC();
+    testSizes();
+    testConfig();
+    testAck();
+    testFramesOnly();
+    testSpeed();
+    testNoise(rounds, noise);
+
+    printf("seed: %llu errors: %d\n", (unsigned long long)seed, errors);
+    return errors ? 1 : 0;
+}
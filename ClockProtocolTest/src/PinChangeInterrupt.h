@@ -0,0 +1,8 @@
+/*
+ * PinChangeInterrupt.h
+ *
+ * Not used by the protocol, I2CAnalogClock.h includes it for the ATtiny.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
@@ -0,0 +1,119 @@
+/*
+ * Slave.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "Slave.h"
+#include "I2CAnalogClock.h"
+
+EEPROMClass EEPROM;
+
+void slaveBegin()
+{
+    EEPROM.erase();
+    position      = 0;
+    adjustment    = 0;
+    status        = 0;
+    control       = 0;
+    missed        = 0;
+    step_retries  = 0;
+    memset((void*)&config, 0, sizeof(config));
+    initClock();
+    initProtocol();
+    Wire.begin(I2C_ADDRESS);
+    Wire.onReceive(&i2creceive);
+    Wire.onRequest(&i2crequest);
+}
+
+uint16_t slaveGetPosition()
+{
+    return position;
+}
+
+void slaveSetPosition(uint16_t value)
+{
+    position = value;
+}
+
+uint16_t slaveGetAdjustment()
+{
+    return adjustment;
+}
+
+void slaveSetAdjustment(uint16_t value)
+{
+    adjustment = value;
+}
+
+uint8_t slaveGetControl()
+{
+    return control;
+}
+
+void slaveGetConfig(uint8_t* data)
+{
+    memcpy(data, (const void*)&config, sizeof(Config));
+}
+
+bool slaveFramesOnly()
+{
+    return frames_only;
+}
+
+uint8_t slaveAckSeq()
+{
+    return ack_seq;
+}
+
+bool slaveAckOK()
+{
+    return ack_status == ACK_OK;
+}
+
+uint8_t slaveCRC8(uint8_t crc, const uint8_t* data, uint8_t length)
+{
+    return crc8(crc, data, length);
+}
+
+size_t slaveConfigSize()
+{
+    return sizeof(Config);
+}
+
+size_t slaveConfigMinSize()
+{
+    return CONFIG_MIN_SIZE;
+}
+
+size_t slaveStateSize()
+{
+    return STATE_SIZE;
+}
+
+size_t slaveFrameMax()
+{
+    return FRAME_MAX;
+}
+
+//
+// the backend, nothing moves.  A write of an adjustment only starts on a tick so nothing calls these.
+//
+void startTimer(uint16_t count, void (*func)())
+{
+    (void)count;
+    (void)func;
+}
+
+void startPWM(uint16_t duration, uint8_t duty, void (*func)())
+{
+    (void)duration;
+    (void)duty;
+    (void)func;
+}
+
+bool stepMoved()
+{
+    return true;
+}
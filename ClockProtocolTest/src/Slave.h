@@ -0,0 +1,36 @@
+/*
+ * Slave.h
+ *
+ * The clock end of the bus: the I2CAnalogClock protocol (I2CACProtocol.cpp)
+ * and state machine (I2CACCore.cpp) with a backend that does nothing.  The
+ * firmware and Clock.h use the same names for the registers so the tests
+ * only see the firmware through these.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef SLAVE_H_
+#define SLAVE_H_
+#include <stdint.h>
+#include <stddef.h>
+
+void     slaveBegin();          // power on with an erased EEPROM
+
+uint16_t slaveGetPosition();
+void     slaveSetPosition(uint16_t value);
+uint16_t slaveGetAdjustment();
+void     slaveSetAdjustment(uint16_t value);
+uint8_t  slaveGetControl();
+void     slaveGetConfig(uint8_t* data);  // slaveConfigSize() bytes
+bool     slaveFramesOnly();
+uint8_t  slaveAckSeq();
+bool     slaveAckOK();
+
+uint8_t  slaveCRC8(uint8_t crc, const uint8_t* data, uint8_t length);
+size_t   slaveConfigSize();
+size_t   slaveConfigMinSize();
+size_t   slaveStateSize();
+size_t   slaveFrameMax();
+
+#endif /* SLAVE_H_ */
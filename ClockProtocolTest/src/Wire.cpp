@@ -0,0 +1,176 @@
+/*
+ * Wire.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire()
+{
+    noise     = 0.0;
+    max_speed = 0;
+    transfers = 0;
+    flips     = 0;
+    _seed     = 1;
+    _speed    = 100000;
+    _address  = 0;
+    _receive  = NULL;
+    _request  = NULL;
+    _size     = 0;
+    _pos      = 0;
+    _flip_transfer = 0;
+    _flip_bit      = 0;
+}
+
+void TwoWire::seed(uint64_t seed)
+{
+    _seed = seed ? seed : 1; // xorshift needs a non-zero state
+}
+
+//
+// xorshift64* - the same sequence on every platform, like the clock simulator.
+//
+double TwoWire::random()
+{
+    _seed ^= _seed >> 12;
+    _seed ^= _seed << 25;
+    _seed ^= _seed >> 27;
+    return (double)((_seed * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+void TwoWire::begin()
+{
+}
+
+void TwoWire::setClock(uint32_t hz)
+{
+    _speed = hz;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    (void)address;
+    _size = 0;
+}
+
+//
+// the slave gets the bytes that made it over the bus
+//
+uint8_t TwoWire::endTransmission()
+{
+    corrupt();
+    _pos = 0;
+    if (_receive != NULL && _size > 0)
+    {
+        _receive(_size);
+    }
+    return 0;
+}
+
+//
+// the slave writes its reply, the bytes it does not have read as 0xff (the pull ups)
+//
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t size)
+{
+    (void)address;
+    if (size > WIRE_BUFFER_SIZE)
+    {
+        size = WIRE_BUFFER_SIZE;
+    }
+    _size = 0;
+    if (_request != NULL)
+    {
+        _request();
+    }
+    while (_size < size)
+    {
+        _buffer[_size++] = 0xff;
+    }
+    _size = size;
+    corrupt();
+    _pos  = 0;
+    return size;
+}
+
+int TwoWire::available()
+{
+    return _size - _pos;
+}
+
+void TwoWire::begin(uint8_t address)
+{
+    _address = address;
+}
+
+void TwoWire::onReceive(void (*func)(int))
+{
+    _receive = func;
+}
+
+void TwoWire::onRequest(void (*func)())
+{
+    _request = func;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+    if (_size >= WIRE_BUFFER_SIZE)
+    {
+        return 0;
+    }
+    _buffer[_size++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t size)
+{
+    size_t count = 0;
+    while (count < size && write(data[count]))
+    {
+        count += 1;
+    }
+    return count;
+}
+
+int TwoWire::read()
+{
+    return _pos < _size ? _buffer[_pos++] : -1;
+}
+
+//
+// transfer is counted from now, 1 for the next one
+//
+void TwoWire::flip(uint32_t transfer, uint32_t bit)
+{
+    _flip_transfer = transfers + transfer;
+    _flip_bit      = bit;
+}
+
+void TwoWire::corrupt()
+{
+    transfers += 1;
+    if (_size == 0)
+    {
+        return;
+    }
+
+    uint32_t bit = _size * 8;
+    if (transfers == _flip_transfer)
+    {
+        bit = _flip_bit;
+    }
+    else if ((max_speed != 0 && _speed > max_speed) || random() < noise)
+    {
+        bit = (uint32_t)(random() * _size * 8);
+    }
+
+    if (bit < _size * 8u)
+    {
+        _buffer[bit / 8] ^= 0x80 >> (bit % 8);
+        flips += 1;
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Wire.h
+ *
+ * A single I2C bus between the master (the Clock class of SynchroClock) and
+ * the slave (the I2CAnalogClock receive and request handlers).  A transfer
+ * runs the slave handler right away, bits can be flipped on the way to test
+ * the framing.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef WIRE_H_
+#define WIRE_H_
+#include "Arduino.h"
+
+#define WIRE_BUFFER_SIZE 32
+
+class TwoWire
+{
+public:
+    TwoWire();
+    void     seed(uint64_t seed);
+    double   random();
+
+    // master
+    void     begin();
+    void     setClock(uint32_t hz);
+    void     beginTransmission(uint8_t address);
+    uint8_t  endTransmission();
+    uint8_t  requestFrom(uint8_t address, uint8_t size);
+    int      available();
+
+    // slave
+    void     begin(uint8_t address);
+    void     onReceive(void (*func)(int));
+    void     onRequest(void (*func)());
+
+    // both
+    size_t   write(uint8_t data);
+    size_t   write(const uint8_t* data, size_t size);
+    int      read();
+
+    void     flip(uint32_t transfer, uint32_t bit); // flip a bit (0 is the msb of the first byte) of a later transfer
+
+    double   noise;         // probability of a flipped bit in a transfer
+    uint32_t max_speed;     // a transfer faster than this always has a flipped bit, 0 for any speed
+    uint32_t transfers;
+    uint32_t flips;
+
+private:
+    uint64_t _seed;
+    uint32_t _speed;
+    uint8_t  _address;      // of the slave
+    void   (*_receive)(int);
+    void   (*_request)();
+    uint8_t  _buffer[WIRE_BUFFER_SIZE];
+    uint8_t  _size;
+    uint8_t  _pos;
+    uint32_t _flip_transfer; // transfer number of flip(), 0 for none
+    uint32_t _flip_bit;
+
+    void     corrupt();
+};
+
+extern TwoWire Wire;
+
+#endif /* WIRE_H_ */
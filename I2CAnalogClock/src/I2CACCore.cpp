@@ -0,0 +1,540 @@
+/*
+ * I2CACCore.cpp
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ * The tick, adjust and power fail state machine.  Everything here runs on the
+ * ATtiny and on the host (I2CAnalogClockTest), the timer, PWM and ADC are
+ * the backend in I2CAnalogClock.cpp or the simulator of the test.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "I2CAnalogClock.h"
+
+volatile uint16_t     position;         // This is the position that we believe the clock is in.
+volatile uint16_t     adjustment;       // This is the adjustment to be made.
+volatile uint8_t      status;           // status register (has tick bit)
+volatile uint8_t      control;          // This is our control "register".
+volatile bool         adjust_active;    // adjustment is active.
+volatile uint16_t     adjust_steps;     // adjust pulses since the adjustment started
+volatile uint16_t     missed;           // missed steps
+volatile uint8_t      step_retries;     // extra pulses for the current step
+volatile uint8_t      ramp_limit;       // highest ramp level, lowered when a step is missed at speed
+volatile uint8_t      tune_good[2];     // good steps in a row since the duty was changed
+volatile bool         tuned[2];         // a step was missed, the duty is kept unless another is
+volatile bool         save_config;      // set if the config was updated.
+volatile bool         update_timing;    // set if the config was written, timing is updated by loop()
+volatile Config       config;           // Configuration
+volatile Timing       timing;           // Configuration in timer counts
+
+#if defined(PWRFAIL_PIN)
+volatile bool         power_failed;     // power has failed, we need to save NOW!
+volatile uint8_t      pwrfail_control;  // saved control register during power fail
+#endif
+
+//
+// set up the state at startup, the config from EEPROM (or defaults) and the position from the power fail data
+//
+void initClock()
+{
+    config.pwm_top           = PWM_TOP;
+    config.tp_duration       = DEFAULT_TP_DURATION_MS;
+    config.tp_duty           = DEFAULT_TP_DUTY;
+    config.ap_duration       = DEFAULT_AP_DURATION_MS;
+    config.ap_duty           = DEFAULT_AP_DUTY;
+    config.ap_delay          = DEFAULT_AP_DELAY_MS;
+    config.ap_start_duration = DEFAULT_AP_START_MS;
+    config.ap_fast_duration  = DEFAULT_AP_FAST_DURATION_MS;
+    config.ap_fast_delay     = DEFAULT_AP_FAST_DELAY_MS;
+    config.ap_ramp           = DEFAULT_AP_RAMP;
+    config.sense             = DEFAULT_SENSE;
+
+    loadConfig();
+    updateTiming();
+    ramp_limit      = config.ap_ramp;
+
+    adjustment      = 0;
+    adjust_active   = false;
+    save_config     = false;
+    update_timing   = false;
+
+#if defined(PWRFAIL_PIN)
+    //
+    // restore clock state if there is power fail data
+    //
+    if (!loadPowerFailData())
+    {
+        status |= STATUS_BIT_PWFBAD;
+
+        //
+        // set up defaults if power save load failed
+        //
+#endif
+#if defined(TEST_MODE) || defined(START_ENABLED)
+        control       = BIT_ENABLE;
+#else
+        control       = 0;
+#endif
+
+#ifdef SKIP_INITIAL_ADJUST
+        position      = 0;
+        adjustment    = 0;
+#else
+        //
+        // we need a single adjust at startup to insure that the clock motor
+        // is synched as a tick/tock.  This first tick will "misfire" if the motor
+        // is out of sync and after that will be in sync.
+        position      = MAX_SECONDS - 1;
+        adjustment    = 1;
+#endif
+#if defined(PWRFAIL_PIN)
+    }
+
+    power_failed  = false;
+#endif
+}
+
+//
+// ISR for 1hz interrupt
+//
+void tick()
+{
+    BENCH_BEGIN(BENCH_TICK);
+#ifdef DEBUG_I2CAC
+    ++ticks;
+#endif
+#if defined(LED_PIN)
+    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+#endif
+
+    if (isEnabled())
+    {
+        if (adjustment != 0)
+        {
+            ++adjustment;
+            startAdjust();
+        }
+        else
+        {
+            advanceClock(timing.tp_duration, timing.tp_duty);
+        }
+    }
+    else
+    {
+        if (adjustment != 0)
+        {
+            startAdjust();
+        }
+    }
+    BENCH_END(BENCH_TICK);
+}
+
+void startAdjust()
+{
+    if (!adjust_active)
+    {
+        adjust_active = true;
+        adjust_steps  = 0;
+
+        //
+        // the first adjustment uses the adjust start duration timing with tp duty
+        advanceClock(timing.ap_start_duration, timing.tp_duty);
+    }
+}
+
+void adjustClock()
+{
+    adjust_steps += 1;
+    if (adjustment == 1)
+    {
+        // last adjustment uses tick pulse settings
+        advanceClock(timing.tp_duration, timing.tp_duty);
+    }
+    else
+    {
+        advanceClock(rampValue(timing.ap_duration, timing.ap_fast_duration), timing.ap_duty);
+    }
+}
+
+//
+//  Advance the clock by one second.
+//
+void advanceClock(uint16_t duration, uint8_t duty)
+{
+    advancePosition();
+    startPWM(duration, duty, &endTick);
+}
+
+// advance the position
+void advancePosition()
+{
+    position += 1;
+    if (position >= MAX_SECONDS)
+    {
+        position = 0;
+    }
+}
+
+//
+// adjust timing between the normal (slow) and the fast value.  The speed ramps up over ap_ramp
+// pulses from the start of the adjustment and back down over the last ap_ramp pulses, it never
+// goes past ramp_limit.
+//
+uint16_t rampValue(uint16_t slow, uint16_t fast)
+{
+    if (config.ap_ramp == 0)
+    {
+        return slow;
+    }
+    return slow - ((int32_t)slow - fast) * rampLevel() / config.ap_ramp;
+}
+
+uint8_t rampLevel()
+{
+    uint16_t level = adjust_steps;
+    if (adjustment < level)
+    {
+        level = adjustment;
+    }
+    if (ramp_limit < level)
+    {
+        level = ramp_limit;
+    }
+    if (config.ap_ramp < level)
+    {
+        level = config.ap_ramp;
+    }
+    return level;
+}
+
+void endTick()
+{
+#ifdef TEST_MODE
+    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+#endif
+
+#if defined(SENSE_ADC)
+    if (!checkStep())
+    {
+        return; // the step is being tried again
+    }
+#else
+    toggleTick();
+#endif
+
+    //
+    // an adjustment written during a tick pulse is not started yet, it starts on the next tick.
+    //
+    if (adjust_active)
+    {
+        if (adjustment != 0)
+        {
+            adjustment--;
+        }
+        if (adjustment != 0)
+        {
+            startTimer(rampValue(timing.ap_delay, timing.ap_fast_delay), &adjustClock);
+        }
+        else
+        {
+            //
+            // we are done with adjustment, stop the timer
+            // and schedule the sleep.
+            //
+            adjust_active = false;
+        }
+    }
+}
+
+#if defined(SENSE_ADC)
+//
+// check the step when sensing, returns false if the pulse is being repeated.  A missed step
+// is tried again with the same polarity and a stronger start pulse.  If that fails too the rotor
+// is most likely already lined up with the polarity (a misfire) so the position is put back to
+// match the hands and the polarity is toggled for the next step.
+//
+bool checkStep()
+{
+    if (!isSensing())
+    {
+        toggleTick();
+        return true;
+    }
+
+    bool moved = stepMoved();
+    if (isTuning() && moved)
+    {
+        //
+        // a step that needed the stronger retry was too weak, one that never moved was a misfire.
+        //
+        tuneStep(step_retries == 0);
+    }
+
+    if (moved)
+    {
+        step_retries = 0;
+        toggleTick();
+        return true;
+    }
+
+    status |= STATUS_BIT_MISSED;
+    if (missed != 0xffff)
+    {
+        missed += 1;
+    }
+
+    //
+    // a step missed on the way up to (or at) full speed means the movement can't keep up, the rest of
+    // the adjustments stop at half the level that missed.  Writing the ramp or fast timing starts over.
+    //
+    if (step_retries == 0 && adjust_active && adjust_steps != 0 && adjustment != 1)
+    {
+        ramp_limit = rampLevel() / 2;
+    }
+
+    if (step_retries < SENSE_RETRIES)
+    {
+        step_retries += 1;
+        startPWM(timing.ap_start_duration, timing.retry_duty, &endTick);
+        return false;
+    }
+
+    step_retries = 0;
+    position = position == 0 ? MAX_SECONDS - 1 : position - 1;
+    toggleTick();
+    return true;
+}
+
+//
+// Adaptive pulse energy for the first try of a step.  The duty of the pulse (tp_duty, or ap_duty for
+// all but the first and last adjust pulse) is lowered by 1% after TUNE_STEPS good steps in a row till
+// a step is missed (moved only by a retry), it is then raised by TUNE_MARGIN, saved and kept unless
+// another step is missed.
+//
+void tuneStep(bool moved)
+{
+    uint8_t t = TUNE_TICK;
+    volatile uint8_t* duty = &config.tp_duty;
+    if (adjust_active && adjust_steps != 0 && adjustment != 1)
+    {
+        t    = TUNE_ADJUST;
+        duty = &config.ap_duty;
+    }
+
+    if (moved)
+    {
+        if (!tuned[t] && ++tune_good[t] >= TUNE_STEPS)
+        {
+            tune_good[t] = 0;
+            if (*duty > TUNE_MIN_DUTY)
+            {
+                *duty        -= 1;
+                update_timing = true;
+            }
+        }
+        return;
+    }
+
+    tune_good[t] = 0;
+    tuned[t]     = true;
+    *duty         = *duty > 100 - TUNE_MARGIN ? 100 : *duty + TUNE_MARGIN;
+    save_config   = true;
+    update_timing = true;
+}
+#endif
+
+#if defined(PWRFAIL_PIN)
+void powerFail()
+{
+    BENCH_BEGIN(BENCH_POWER_FAIL);
+    power_failed   = true;
+
+    //
+    // save & clear the clock enabled bit
+    //
+    pwrfail_control = control;
+    control &= ~BIT_ENABLE;
+
+    //
+    // force any adjustment to finish up, one that has not started yet would step the clock
+    // after the power fail data is saved so its dropped.
+    //
+    if (!adjust_active)
+    {
+        adjustment = 0;
+    }
+    else if (adjustment > 1)
+    {
+        adjustment = 1;
+    }
+    BENCH_END(BENCH_POWER_FAIL);
+}
+
+//
+// the power is back before the capacitor ran out
+//
+void powerRestored()
+{
+    noInterrupts();
+    power_failed = false;
+    control      = pwrfail_control;
+    interrupts();
+}
+#endif
+
+uint32_t calculateCRC32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xffffffff;
+    while (length--)
+    {
+        uint8_t c = *data++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1)
+        {
+            bool bit = crc & 0x80000000;
+            if (c & i)
+            {
+                bit = !bit;
+            }
+            crc <<= 1;
+            if (bit)
+            {
+                crc ^= 0x04c11db7;
+            }
+        }
+    }
+    return crc;
+}
+
+//
+// convert the config to the timer counts used by the ISRs.  The divisions are slow at 1MHz so this is
+// not done in an ISR after the initial load.
+//
+void updateTiming()
+{
+    Timing t;
+    t.tp_duration       = ms2PWMCount(config.tp_duration);
+    t.ap_duration       = ms2PWMCount(config.ap_duration);
+    t.ap_start_duration = ms2PWMCount(config.ap_start_duration);
+    t.ap_fast_duration  = ms2PWMCount(config.ap_fast_duration);
+    t.tp_duty           = duty2pwm(config.tp_duty);
+    t.ap_duty           = duty2pwm(config.ap_duty);
+    t.retry_duty        = duty2pwm(config.tp_duty > SENSE_RETRY_DUTY ? config.tp_duty : SENSE_RETRY_DUTY);
+    t.ap_delay          = ms2Timer(config.ap_delay);
+    t.ap_fast_delay     = ms2Timer(config.ap_fast_delay);
+
+    noInterrupts();
+    memcpy((void*)&timing, &t, sizeof(timing));
+    interrupts();
+}
+
+void clearConfig()
+{
+    for (unsigned int i = 0; i < sizeof(EEConfig); ++i)
+    {
+        EEPROM.update(CONFIG_ADDRESS+i, 0xff);
+    }
+}
+
+boolean loadConfig()
+{
+    EEConfig cfg;
+    // Read struct from EEPROM
+    unsigned int i;
+    uint8_t* p = (uint8_t*) &cfg;
+    for (i = 0; i < sizeof(cfg); ++i)
+    {
+        p[i] = EEPROM.read(CONFIG_ADDRESS+i);
+    }
+
+    //
+    // a config saved by older firmware is shorter, the fields it does not have keep their defaults.
+    //
+    for (size_t size = sizeof(cfg.data); size >= CONFIG_MIN_SIZE; --size)
+    {
+        if (calculateCRC32(cfg.data, size) == cfg.crc)
+        {
+            memcpy((void*)&config, &cfg.data, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+void saveConfig()
+{
+    EEConfig cfg;
+    memcpy(&cfg.data, (const void*)&config, sizeof(cfg.data));
+    cfg.crc = calculateCRC32(((uint8_t*) &cfg.data), sizeof(cfg.data));
+
+    unsigned int i;
+    uint8_t* p = (uint8_t*) &cfg;
+    for (i = 0; i < sizeof(cfg); ++i)
+    {
+        EEPROM.update(CONFIG_ADDRESS+i, p[i]);
+    }
+}
+
+#if defined(PWRFAIL_PIN)
+void clearPowerFailData()
+{
+    position = MAX_SECONDS;
+    savePowerFailData();
+}
+
+boolean loadPowerFailData()
+{
+    EEPowerFailData pfd;
+    // Read struct from EEPROM
+    unsigned int i;
+    uint8_t* p = (uint8_t*) &pfd;
+    for (i = 0; i < sizeof(pfd); ++i)
+    {
+        p[i] = EEPROM.read(POWER_FAIL_ADDRESS+i);
+    }
+
+    uint32_t crc = calculateCRC32(((uint8_t*) &pfd.data), sizeof(pfd.data));
+    if (crc != pfd.crc || pfd.data.position >= MAX_SECONDS || (pfd.data.control & ~(BIT_ENABLE | BIT_SENSE | BIT_TUNE)) || (pfd.data.status & ~STATUS_BIT_TICK))
+    {
+        return false;
+    }
+
+    position    = pfd.data.position;
+    control     = pfd.data.control;
+    status      = pfd.data.status;
+
+    return true;
+}
+
+void savePowerFailData()
+{
+    EEPowerFailData pfd;
+    pfd.data.position    = position;
+    pfd.data.control     = pwrfail_control;
+    pfd.data.status      = status & STATUS_BIT_TICK;
+
+    pfd.crc = calculateCRC32(((uint8_t*) &pfd.data), sizeof(pfd.data));
+
+    unsigned int i;
+    uint8_t* p = (uint8_t*) &pfd;
+    for (i = 0; i < sizeof(pfd); ++i)
+    {
+        EEPROM.update(POWER_FAIL_ADDRESS+i, p[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * I2CACProtocol.cpp
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ * The I2C register protocol: plain and CRC-8 framed reads and writes of the
+ * clock state and config.  Like I2CACCore.cpp everything here also runs on
+ * the host, ClockProtocolTest connects it to the SynchroClock Clock class
+ * through a simulated bus.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "I2CAnalogClock.h"
+#include "I2CACVersion.h"
+
+volatile uint8_t      command;          // This is which "register" to be read/written.
+volatile bool         factory_reset;    // set if factory reset is active
+uint8_t               reset_reason;     //
+volatile bool         framed;           // last command was framed
+volatile uint8_t      frame_seq;        // sequence number of the last good frame
+volatile uint8_t      ack_seq;          // sequence number of the last framed write
+volatile uint8_t      ack_status;       // ACK_OK or ACK_BAD_FRAME
+volatile bool         frames_only;      // once a frame is seen only framed writes are accepted
+uint8_t               reply[FRAME_MAX]; // reply for the next read, built when the command is received
+volatile uint8_t      reply_start;      // first byte of the reply, the sequence number is only sent if framed
+volatile uint8_t      reply_size;       // bytes in the reply, 0 for none
+
+//
+// set up the protocol state at startup, no frame seen yet
+//
+void initProtocol()
+{
+    ack_seq         = 0xff;
+    ack_status      = ACK_OK;
+    frames_only     = false;
+    reply_start     = 0;
+    reply_size      = 0;
+    factory_reset   = false;
+}
+
+//
+// CRC-8 (polynomial 0x07) used by framed transfers, crc is the CRC of any data before this part.
+// A nibble at a time with a 16 byte table, the bitwise version is too slow at 1MHz.
+//
+static const uint8_t crc8_table[16] PROGMEM =
+{
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d
+};
+
+uint8_t crc8(uint8_t crc, const uint8_t* data, uint8_t length)
+{
+    while (length--)
+    {
+        crc ^= *data++;
+        crc = (crc << 4) ^ pgm_read_byte(&crc8_table[crc >> 4]);
+        crc = (crc << 4) ^ pgm_read_byte(&crc8_table[crc >> 4]);
+    }
+    return crc;
+}
+
+// handle a received command, writes are applied and reads are left in command
+void receiveCommand(uint8_t cmd, const uint8_t* data, uint8_t n)
+{
+    //
+    // a frame is the command with CMD_FRAMED set, a sequence number, the value (if any) and
+    // the CRC-8 of everything before it.  A bad frame is ignored and noted in the ack register.
+    //
+    const uint8_t* value = data;
+    framed = (cmd & CMD_FRAMED) != 0;
+    if (framed)
+    {
+        if (n < 2 || crc8(crc8(0, &cmd, 1), data, n - 1) != data[n - 1])
+        {
+            ack_status = ACK_BAD_FRAME;
+            command    = 0xff;
+            return;
+        }
+        cmd         &= ~CMD_FRAMED;
+        frame_seq    = data[0];
+        value        = data + 1;
+        n           -= 2;
+        frames_only  = true;
+    }
+    else if (frames_only && n > 0)
+    {
+        // a frame that lost its CMD_FRAMED bit, don't let it write anything
+        ack_status = ACK_BAD_FRAME;
+        command    = 0xff;
+        return;
+    }
+    command = cmd;
+
+    // check for a write command (or a command that does not read/write just action)
+    if (n > 0)
+    {
+        switch (command)
+        {
+        case CMD_POSITION:
+            position = value[0] | value[1] << 8;
+            break;
+        case CMD_ADJUSTMENT:
+            adjustment = value[0] | value[1] << 8;
+            // adjustment will start on the next tick!
+            break;
+        case CMD_TP_DURATION:
+            config.tp_duration = value[0];
+            update_timing = true;
+            break;
+        case CMD_TP_DUTY:
+            config.tp_duty = value[0];
+            update_timing = true;
+            break;
+        case CMD_AP_DURATION:
+            config.ap_duration = value[0];
+            update_timing = true;
+            break;
+        case CMD_AP_DUTY:
+            config.ap_duty = value[0];
+            update_timing = true;
+            break;
+        case CMD_AP_DELAY:
+            config.ap_delay = value[0];
+            update_timing = true;
+            break;
+        case CMD_AP_START:
+            config.ap_start_duration = value[0];
+            update_timing = true;
+            break;
+        case CMD_PWMTOP:
+            config.pwm_top   = value[0];
+            update_timing = true;
+            break;
+        case CMD_FAST_PULSE:
+            config.ap_fast_duration = value[0];
+            ramp_limit    = config.ap_ramp;
+            update_timing = true;
+            break;
+        case CMD_FAST_DELAY:
+            config.ap_fast_delay = value[0];
+            ramp_limit    = config.ap_ramp;
+            update_timing = true;
+            break;
+        case CMD_AP_RAMP:
+            config.ap_ramp = value[0];
+            ramp_limit     = config.ap_ramp;
+            break;
+        case CMD_SENSE:
+            config.sense = value[0];
+            break;
+        case CMD_MISSED:
+            // value is ignored as its just a placeholder
+            missed  = 0;
+            status &= ~STATUS_BIT_MISSED;
+            break;
+        case CMD_CONTROL:
+            if ((value[0] & BIT_TUNE) && !isTuning())
+            {
+                // tuning is (re)started, learn the duty from where it is now
+                memset((void*)tune_good, 0, sizeof(tune_good));
+                memset((void*)tuned, 0, sizeof(tuned));
+            }
+            control = value[0];
+            break;
+        case CMD_SAVE_CONFIG:
+            // value is ignored as its just a placeholder
+            save_config = true;
+            break;
+        case CMD_RESET:
+            // value is ignored as its just a placeholder
+            factory_reset = true;
+            break;
+        case CMD_CONFIG:
+            // only a complete block is used
+            if (n == sizeof(Config))
+            {
+                memcpy((void*)&config, value, sizeof(Config));
+                ramp_limit    = config.ap_ramp;
+                update_timing = true;
+            }
+            break;
+        }
+
+        if (framed)
+        {
+            ack_seq    = frame_seq;
+            ack_status = ACK_OK;
+        }
+        command = 0xff;
+    }
+}
+
+//
+// build the reply for the command so that the request handler only has to copy it out, the master
+// is held (clock stretched) while the request handler runs.
+//
+void prepareReply()
+{
+    uint8_t  n = 1; // reply[0] is for the sequence number of a framed reply
+    uint16_t value;
+    switch (command)
+    {
+    case CMD_ID:
+        reply[n++] = ID_VALUE;
+        break;
+    case CMD_POSITION:
+        value = position;
+        reply[n++] = value & 0xff;
+        reply[n++] = value >> 8;
+        break;
+    case CMD_ADJUSTMENT:
+        value = adjustment;
+        reply[n++] = value & 0xff;
+        reply[n++] = value >> 8;
+        break;
+    case CMD_TP_DURATION:
+        reply[n++] = config.tp_duration;
+        break;
+    case CMD_TP_DUTY:
+        reply[n++] = config.tp_duty;
+        break;
+    case CMD_AP_DURATION:
+        reply[n++] = config.ap_duration;
+        break;
+    case CMD_AP_DUTY:
+        reply[n++] = config.ap_duty;
+        break;
+    case CMD_AP_DELAY:
+        reply[n++] = config.ap_delay;
+        break;
+    case CMD_AP_START:
+        reply[n++] = config.ap_start_duration;
+        break;
+    case CMD_PWMTOP:
+        reply[n++] = config.pwm_top;
+        break;
+    case CMD_FAST_PULSE:
+        reply[n++] = config.ap_fast_duration;
+        break;
+    case CMD_FAST_DELAY:
+        reply[n++] = config.ap_fast_delay;
+        break;
+    case CMD_AP_RAMP:
+        reply[n++] = config.ap_ramp;
+        break;
+    case CMD_SENSE:
+        reply[n++] = config.sense;
+        break;
+    case CMD_MISSED:
+        value = missed;
+        reply[n++] = value & 0xff;
+        reply[n++] = value >> 8;
+        break;
+    case CMD_RST_REASON:
+        reply[n++] = reset_reason;
+        break;
+    case CMD_VERSION:
+        reply[n++] = I2C_ANALOG_CLOCK_VERSION;
+        break;
+
+    case CMD_CONTROL:
+        reply[n++] = control;
+        break;
+    case CMD_STATUS:
+        reply[n++] = status;
+        break;
+    case CMD_STATE:
+        reply[n++] = ID_VALUE;
+        reply[n++] = I2C_ANALOG_CLOCK_VERSION;
+        reply[n++] = reset_reason;
+        reply[n++] = control;
+        reply[n++] = status;
+        value = position;
+        reply[n++] = value & 0xff;
+        reply[n++] = value >> 8;
+        value = adjustment;
+        reply[n++] = value & 0xff;
+        reply[n++] = value >> 8;
+        break;
+    case CMD_CONFIG:
+        memcpy(&reply[n], (const void*)&config, sizeof(Config));
+        n += sizeof(Config);
+        break;
+    case CMD_ACK:
+        reply[n++] = ack_seq;
+        reply[n++] = ack_status;
+        break;
+    }
+
+    if (framed)
+    {
+        reply[0]    = frame_seq;
+        reply[n]    = crc8(0, reply, n);
+        reply_start = 0;
+        reply_size  = n + 1;
+    }
+    else
+    {
+        reply_start = 1;
+        reply_size  = n - 1;
+    }
+}
+
+// i2c receive handler
+void i2creceive(int size)
+{
+    BENCH_BEGIN(BENCH_RECEIVE);
+    uint8_t cmd = Wire.read();
+    uint8_t data[FRAME_MAX];
+    uint8_t n   = 0;
+    while (--size > 0)
+    {
+        uint8_t b = Wire.read();
+        if (n < sizeof(data))
+        {
+            data[n++] = b;
+        }
+    }
+
+    receiveCommand(cmd, data, n);
+    prepareReply();
+    BENCH_END(BENCH_RECEIVE);
+}
+
+#if defined(BENCH_ISR)
+//
+// simavr has no USI, in the ISR benchmark the reply goes to a ring buffer like the one Wire.write()
+// fills for the USI.
+//
+#define BENCH_TX_SIZE 16
+uint8_t bench_tx[BENCH_TX_SIZE];
+uint8_t bench_tx_head;
+
+void benchWrite(const uint8_t* data, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; ++i)
+    {
+        bench_tx_head = (bench_tx_head + 1) & (BENCH_TX_SIZE - 1);
+        bench_tx[bench_tx_head] = data[i];
+    }
+}
+#endif
+
+// i2c request handler
+void i2crequest()
+{
+    BENCH_BEGIN(BENCH_REQUEST);
+#if defined(BENCH_ISR)
+    benchWrite(&reply[reply_start], reply_size);
+#else
+    Wire.write(&reply[reply_start], reply_size);
+#endif
+    reply_size = 0;
+    command    = 0xff;
+    BENCH_END(BENCH_REQUEST);
+}
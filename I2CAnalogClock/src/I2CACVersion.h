@@ -8,6 +8,6 @@
 #ifndef I2CACVERSION_H_
 #define I2CACVERSION_H_
 
-#define I2C_ANALOG_CLOCK_VERSION 1
+#define I2C_ANALOG_CLOCK_VERSION 5
 
 #endif /* I2CACVERSION_H_ */
@@ -21,146 +21,71 @@
  */
 
 #include "I2CAnalogClock.h"
-#include "I2CACVersion.h"
 #include <avr/wdt.h>
 
-volatile uint16_t     position;         // This is the position that we believe the clock is in.
-volatile uint16_t     adjustment;       // This is the adjustment to be made.
-volatile uint8_t      command;          // This is which "register" to be read/written.
-volatile uint8_t      status;           // status register (has tick bit)
-volatile uint8_t      control;          // This is our control "register".
 volatile unsigned int pwm_duration;     // PWM cycle count down.
-volatile bool         adjust_active;    // adjustment is active.
-volatile bool         save_config;      // set if the config was updated.
-volatile bool         factory_reset;    // set if factory reset is active
-volatile Config       config;           // Configuration
-uint8_t               reset_reason;     //
-
-#if defined(PWRFAIL_PIN)
-volatile bool         power_failed;     // power has failed, we need to save NOW!
-volatile uint8_t      pwrfail_control;  // saved control register during power fail
-#endif
 
 #ifdef DEBUG_I2CAC
 volatile unsigned int ticks;
 #endif
 
-// i2c receive handler
-void i2creceive(int size)
+#if defined(BENCH_ISR)
+//
+// simavr has no USI so the I2C handlers can't be reached from the bus in the ISR benchmark.  Once a
+// tick the master's wake up is replayed with interrupts off: a framed read of the position and every
+// BENCH_ADJUST_TICKS an adjustment, each followed by the request handler for its reply.  Sensing is
+// turned on first so that stepMoved() is part of the pulse end.
+//
+#define BENCH_ADJUST_TICKS 30
+#define BENCH_ADJUSTMENT   30
+
+uint16_t bench_position;
+uint8_t  bench_seq;
+uint8_t  bench_ticks;
+
+void benchFrame(uint8_t cmd, const uint8_t* value, uint8_t size)
 {
-    command = Wire.read();
-    --size;
-    // check for a write command (or a command that does not read/write just action)
-    if (size > 0)
+    uint8_t data[FRAME_MAX];
+    cmd       |= CMD_FRAMED;
+    data[0]    = bench_seq++;
+    for (uint8_t i = 0; i < size; ++i)
     {
-        switch (command)
-        {
-        case CMD_POSITION:
-            position = Wire.read() | Wire.read() << 8;
-            break;
-        case CMD_ADJUSTMENT:
-            adjustment = Wire.read() | Wire.read() << 8;
-            // adjustment will start on the next tick!
-            break;
-        case CMD_TP_DURATION:
-            config.tp_duration = Wire.read();
-            break;
-        case CMD_TP_DUTY:
-            config.tp_duty = Wire.read();
-            break;
-        case CMD_AP_DURATION:
-            config.ap_duration = Wire.read();
-            break;
-        case CMD_AP_DUTY:
-            config.ap_duty = Wire.read();
-            break;
-        case CMD_AP_DELAY:
-            config.ap_delay = Wire.read();
-            break;
-        case CMD_AP_START:
-            config.ap_start_duration = Wire.read();
-            break;
-        case CMD_PWMTOP:
-            config.pwm_top   = Wire.read();
-            break;
-        case CMD_CONTROL:
-            control = Wire.read();
-            break;
-        case CMD_SAVE_CONFIG:
-            (void)Wire.read(); // we ignore as its just a placeholder
-            save_config = true;
-            break;
-        case CMD_RESET:
-            (void)Wire.read(); // we ignore as its just a placeholder
-            factory_reset = true;
-        }
-        command = 0xff;
+        data[i + 1] = value[i];
     }
+    data[size + 1] = crc8(crc8(0, &cmd, 1), data, size + 1);
+
+    noInterrupts();
+    BENCH_BEGIN(BENCH_RECEIVE);
+    receiveCommand(cmd, data, size + 2);
+    prepareReply();
+    BENCH_END(BENCH_RECEIVE);
+    i2crequest();
+    interrupts();
 }
 
-// i2c request handler
-void i2crequest()
+void benchI2C()
 {
-    uint16_t value;
-    switch (command)
+    if (position == bench_position)
+    {
+        return;
+    }
+    bench_position = position;
+
+    if (!isSensing())
     {
-    case CMD_ID:
-        Wire.write(ID_VALUE);
-        break;
-    case CMD_POSITION:
-        value = position;
-        Wire.write(value & 0xff);
-        Wire.write(value >> 8);
-        break;
-    case CMD_ADJUSTMENT:
-        value = adjustment;
-        Wire.write(value & 0xff);
-        Wire.write(value >> 8);
-        break;
-    case CMD_TP_DURATION:
-        value = config.tp_duration;
-        Wire.write(value);
-        break;
-    case CMD_TP_DUTY:
-        value = config.tp_duty;
-        Wire.write(value);
-        break;
-    case CMD_AP_DURATION:
-        value = config.ap_duration;
-        Wire.write(value);
-        break;
-    case CMD_AP_DUTY:
-        value = config.ap_duty;
-        Wire.write(value);
-        break;
-    case CMD_AP_DELAY:
-        value = config.ap_delay;
-        Wire.write(value);
-        break;
-    case CMD_AP_START:
-        value = config.ap_start_duration;
-        Wire.write(value);
-        break;
-    case CMD_PWMTOP:
-        value = config.pwm_top;
-        Wire.write(value);
-        break;
-    case CMD_RST_REASON:
-        Wire.write(reset_reason);
-        break;
-    case CMD_VERSION:
-        Wire.write(I2C_ANALOG_CLOCK_VERSION);
-        break;
-
-    case CMD_CONTROL:
-        Wire.write(control);
-        break;
-    case CMD_STATUS:
-        Wire.write(status);
-        break;
+        uint8_t value = control | BIT_SENSE;
+        benchFrame(CMD_CONTROL, &value, sizeof(value));
+    }
+
+    benchFrame(CMD_POSITION, NULL, 0);
+    if (++bench_ticks >= BENCH_ADJUST_TICKS && adjustment == 0)
+    {
+        uint8_t value[2] = {BENCH_ADJUSTMENT & 0xff, BENCH_ADJUSTMENT >> 8};
+        bench_ticks = 0;
+        benchFrame(CMD_ADJUSTMENT, value, sizeof(value));
     }
-    command = 0xff;
 }
+#endif
 
 void reboot()
 {
@@ -200,12 +125,16 @@ ISR(TIMER1_OVF_vect)
     pwm_duration -= 1;
     if (pwm_duration == 0)
     {
+        BENCH_BEGIN(BENCH_PULSE_END);
         clearTimer();
         timer_running = false;
         if (timer_cb != NULL)
         {
-            timer_cb();
+            void (*func)() = timer_cb;
+            timer_cb = NULL;
+            func();
         }
+        BENCH_END(BENCH_PULSE_END);
     }
 }
 
@@ -219,6 +148,7 @@ ISR(TIMER1_COMPA_vect)
         return;
     }
 
+    BENCH_BEGIN(BENCH_TIMER);
 #if defined(__AVR_ATtinyX5__)
     TIMSK &= ~(1 << OCIE1A); // disable timer1 interrupts as we only want this one.
 #else
@@ -229,12 +159,12 @@ ISR(TIMER1_COMPA_vect)
     {
         timer_cb();
     }
+    BENCH_END(BENCH_TIMER);
 }
 
-void startTimer(int ms, void (*func)())
+void startTimer(uint16_t count, void (*func)())
 {
     start_time = millis();
-    uint16_t timer = ms2Timer(ms);
     // initialize timer1
     noInterrupts();
     // disable all interrupts
@@ -243,7 +173,7 @@ void startTimer(int ms, void (*func)())
     TCCR1 = 0;
     TCNT1 = 0;
 
-    OCR1A = timer;   // compare match register
+    OCR1A = count;   // compare match register
     TCCR1 |= (1 << CTC1);// CTC mode
     TCCR1 |= PRESCALE_BITS;
     TIMSK |= (1 << OCIE1A);// enable timer compare interrupt
@@ -254,7 +184,7 @@ void startTimer(int ms, void (*func)())
     TCCR1B = 0;
     TCNT1 = 0;
 
-    OCR1A = timer;   // compare match register
+    OCR1A = count;   // compare match register
     TCCR1B |= (1 << WGM12);   // CTC mode
     TCCR1B |= PRESCALE_BITS;
     TIMSK1 |= (1 << OCIE1A);  // enable timer compare interrupt
@@ -266,7 +196,7 @@ void startTimer(int ms, void (*func)())
     // enable all interrupts
 }
 
-void startPWM(unsigned int duration, unsigned int duty, void (*func)())
+void startPWM(uint16_t duration, uint8_t duty, void (*func)())
 {
     noInterrupts();
     timer_cb = func;
@@ -277,7 +207,7 @@ void startPWM(unsigned int duration, unsigned int duty, void (*func)())
 
     if (isTick())
     {
-        OCR1A = duty2pwm(duty);
+        OCR1A = duty;
         TCNT1 = 0; // needed???
 #if defined(__AVR_ATtinyX5__)
         TCCR1 = _BV(COM1A1) | _BV(PWM1A) | PWM_PRESCALE_BITS;
@@ -287,7 +217,7 @@ void startPWM(unsigned int duration, unsigned int duty, void (*func)())
     }
     else
     {
-        OCR1B = duty2pwm(duty);
+        OCR1B = duty;
         TCNT1 = 0; // needed???
 #if defined(__AVR_ATtinyX5__)
         TCCR1 = PWM_PRESCALE_BITS;
@@ -304,140 +234,37 @@ void startPWM(unsigned int duration, unsigned int duty, void (*func)())
     TIMSK1 = _BV(TOIE1);
 #endif
 
-    pwm_duration = ms2PWMCount(duration);
+    pwm_duration = duration;
     timer_running = true;
     interrupts();
 }
 
-void endTick()
-{
-#ifdef TEST_MODE
-    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
-#endif
-
-    timer_cb = NULL;
-    toggleTick();
-
-    if (adjustment != 0)
-    {
-        adjustment--;
-        if (adjustment != 0)
-        {
-            startTimer(config.ap_delay, &adjustClock);
-        }
-        else
-        {
-            //
-            // we are done with adjustment, stop the timer
-            // and schedule the sleep.
-            //
-            adjust_active = false;
-        }
-    }
-    else
-    {
-        if (adjust_active)
-        {
-            adjust_active = false;
-        }
-    }
-}
-
-// advance the position
-void advancePosition()
-{
-    position += 1;
-    if (position >= MAX_SECONDS)
-    {
-        position = 0;
-    }
-}
-
-void adjustClock()
-{
-    if (adjustment == 1)
-    {
-        // last adjustment uses tick pulse settings
-        advanceClock(config.tp_duration, config.tp_duty);
-    }
-    else
-    {
-        advanceClock(config.ap_duration, config.ap_duty);
-    }
-}
-
-//
-//  Advance the clock by one second.
-//
-void advanceClock(uint16_t duration, uint8_t duty)
-{
-    advancePosition();
-    startPWM(duration, duty, &endTick);
-}
-
-void startAdjust()
-{
-    if (!adjust_active)
-    {
-        adjust_active = true;
-
-        //
-        // the first adjustment uses the adjust start duration timing with tp duty
-        advanceClock(config.ap_start_duration, config.tp_duty);
-    }
-}
-
+#if defined(SENSE_ADC)
 //
-// ISR for 1hz interrupt
+// Sample the back-EMF of the coil right after a pulse, the rotor is still swinging into place
+// if it took the step and is (nearly) still if it did not.  Only B_PIN has an ADC so it floats
+// while A_PIN is held at the level that makes the back-EMF positive at B_PIN.
 //
-void tick()
+bool stepMoved()
 {
-#ifdef DEBUG_I2CAC
-    ++ticks;
-#endif
-#if defined(LED_PIN)
-    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
-#endif
+    bool a_pulse = isTick();
+    pinMode(B_PIN, INPUT);
+    digitalWrite(A_PIN, a_pulse ? TICK_ON : TICK_OFF);
+    delayMicroseconds(SENSE_SETTLE_US);
 
-    if (isEnabled())
-    {
-        if (adjustment != 0)
-        {
-            ++adjustment;
-            startAdjust();
-        }
-        else
-        {
-            advanceClock(config.tp_duration, config.tp_duty);
-        }
-    }
-    else
+    PRR    &= ~_BV(PRADC);
+    ADMUX   = _BV(ADLAR) | SENSE_ADC; // VCC reference, 8 bit result in ADCH
+    ADCSRA  = _BV(ADEN) | _BV(ADSC) | SENSE_ADC_PRESCALE_BITS;
+    while (ADCSRA & _BV(ADSC))
     {
-        if (adjustment != 0)
-        {
-            startAdjust();
-        }
     }
-}
-
-#if defined(PWRFAIL_PIN)
-void powerFail()
-{
-    power_failed   = true;
+    uint8_t emf = a_pulse ? 255 - ADCH : ADCH;
+    ADCSRA  = 0;
+    PRR    |= _BV(PRADC);
 
-    //
-    // save & clear the clock enabled bit
-    //
-    pwrfail_control = control;
-    control &= ~BIT_ENABLE;
-
-    //
-    // force any adjustment to finish up.
-    //
-    if (adjustment > 1)
-    {
-        adjustment = 1;
-    }
+    digitalWrite(A_PIN, TICK_OFF);
+    pinMode(B_PIN, OUTPUT);
+    return emf >= config.sense;
 }
 #endif
 
@@ -471,63 +298,19 @@ void setup()
 
 #ifndef TEST_MODE
     //
-    // We don't use ADC features so we disable them to save power
+    // The ADC is only powered up by stepMoved() so we disable it to save power
     //
-    ADCSRA &= ~(1 << ADEN); // Disable ADC as we don't use it
+    ADCSRA &= ~(1 << ADEN); // Disable ADC
     PRR |= (1 << PRADC);    // Turn off ADC clock
 #endif
 
-    config.pwm_top           = PWM_TOP;
-    config.tp_duration       = DEFAULT_TP_DURATION_MS;
-    config.tp_duty           = DEFAULT_TP_DUTY;
-    config.ap_duration       = DEFAULT_AP_DURATION_MS;
-    config.ap_duty           = DEFAULT_AP_DUTY;
-    config.ap_delay          = DEFAULT_AP_DELAY_MS;
-    config.ap_start_duration = DEFAULT_AP_START_MS;
-
-    loadConfig();
-
-    adjustment      = 0;
-    adjust_active   = false;
-    save_config     = false;
-    factory_reset   = false;
-
-#if defined(PWRFAIL_PIN)
-    //
-    // restore clock state if there is power fail data
-    //
-    if (!loadPowerFailData())
-    {
-        status |= STATUS_BIT_PWFBAD;
-
-        //
-        // set up defaults if power save load failed
-        //
-#endif
-#if defined(TEST_MODE) || defined(START_ENABLED)
-        control       = BIT_ENABLE;
-#else
-        control       = 0;
-#endif
+    initClock();
+    initProtocol();
 
-#ifdef SKIP_INITIAL_ADJUST
-        position      = 0;
-        adjustment    = 0;
-#else
-        //
-        // we need a single adjust at startup to insure that the clock motor
-        // is synched as a tick/tock.  This first tick will "misfire" if the motor
-        // is out of sync and after that will be in sync.
-        position      = MAX_SECONDS - 1;
-        adjustment    = 1;
-#endif
 #if defined(PWRFAIL_PIN)
-    }
-
     //
     // setup the power fail interrupt
     //
-    power_failed  = false;
     pinMode(PWRFAIL_PIN, INPUT);
     attachPinChangeInterrupt(digitalPinToPinChangeInterrupt(PWRFAIL_PIN), &powerFail, FALLING);
 #endif
@@ -589,6 +372,12 @@ void loop()
         factoryReset();
     }
 
+    if (update_timing)
+    {
+        update_timing = false;
+        updateTiming();
+    }
+
     if (save_config)
     {
         save_config = false;
@@ -617,13 +406,14 @@ void loop()
         //
         // we can resume!!!
         //
-        cli();
-        power_failed   = false;
-        control = pwrfail_control;
-        sei();
+        powerRestored();
     }
 #endif
 
+#if defined(BENCH_ISR)
+    benchI2C();
+#endif
+
 #ifdef DEBUG_I2CAC
     unsigned int now = ticks;
     char buffer[256];
@@ -651,116 +441,3 @@ void loop()
 #endif
 }
 
-uint32_t calculateCRC32(const uint8_t *data, size_t length)
-{
-    uint32_t crc = 0xffffffff;
-    while (length--)
-    {
-        uint8_t c = *data++;
-        for (uint32_t i = 0x80; i > 0; i >>= 1)
-        {
-            bool bit = crc & 0x80000000;
-            if (c & i)
-            {
-                bit = !bit;
-            }
-            crc <<= 1;
-            if (bit)
-            {
-                crc ^= 0x04c11db7;
-            }
-        }
-    }
-    return crc;
-}
-
-void clearConfig()
-{
-    for (unsigned int i = 0; i < sizeof(EEConfig); ++i)
-    {
-        EEPROM.update(CONFIG_ADDRESS+i, 0xff);
-    }
-}
-
-boolean loadConfig()
-{
-    EEConfig cfg;
-    // Read struct from EEPROM
-    unsigned int i;
-    uint8_t* p = (uint8_t*) &cfg;
-    for (i = 0; i < sizeof(cfg); ++i)
-    {
-        p[i] = EEPROM.read(CONFIG_ADDRESS+i);
-    }
-    uint32_t crcOfData = calculateCRC32(((uint8_t*) &cfg.data), sizeof(cfg.data));
-    if (crcOfData != cfg.crc)
-    {
-        return false;
-    }
-    memcpy((void*)&config, &cfg.data, sizeof(config));
-    return true;
-}
-
-void saveConfig()
-{
-    EEConfig cfg;
-    memcpy(&cfg.data, (const void*)&config, sizeof(cfg.data));
-    cfg.crc = calculateCRC32(((uint8_t*) &cfg.data), sizeof(cfg.data));
-
-    unsigned int i;
-    uint8_t* p = (uint8_t*) &cfg;
-    for (i = 0; i < sizeof(cfg); ++i)
-    {
-        EEPROM.update(CONFIG_ADDRESS+i, p[i]);
-    }
-}
-
-#if defined(PWRFAIL_PIN)
-void clearPowerFailData()
-{
-    position = MAX_SECONDS;
-    savePowerFailData();
-}
-
-boolean loadPowerFailData()
-{
-    EEPowerFailData pfd;
-    // Read struct from EEPROM
-    unsigned int i;
-    uint8_t* p = (uint8_t*) &pfd;
-    for (i = 0; i < sizeof(pfd); ++i)
-    {
-        p[i] = EEPROM.read(POWER_FAIL_ADDRESS+i);
-    }
-
-    uint32_t crc = calculateCRC32(((uint8_t*) &pfd.data), sizeof(pfd.data));
-    if (crc != pfd.crc || pfd.data.position >= MAX_SECONDS || (pfd.data.control & ~BIT_ENABLE) || (pfd.data.status & ~STATUS_BIT_TICK))
-    {
-        return false;
-    }
-
-    position    = pfd.data.position;
-    control     = pfd.data.control;
-    status      = pfd.data.status;
-
-    return true;
-}
-
-void savePowerFailData()
-{
-    EEPowerFailData pfd;
-    pfd.data.position    = position;
-    pfd.data.control     = pwrfail_control;
-    pfd.data.status      = status & STATUS_BIT_TICK;
-
-    pfd.crc = calculateCRC32(((uint8_t*) &pfd.data), sizeof(pfd.data));
-
-    unsigned int i;
-    uint8_t* p = (uint8_t*) &pfd;
-    for (i = 0; i < sizeof(pfd); ++i)
-    {
-        EEPROM.update(POWER_FAIL_ADDRESS+i, p[i]);
-    }
-}
-
-#endif
@@ -53,6 +53,7 @@
 #define A_PIN           1
 #define B_PIN           4
 #define PWRFAIL_PIN     5
+#define SENSE_ADC       2 // ADC2 is PB4 (B_PIN), used to sense the coil back-EMF
 #else
 #define INT_PIN         3
 #define A_PIN           9
@@ -64,6 +65,24 @@
 #define TICK_ON         HIGH
 #define TICK_OFF        LOW
 
+#if defined(BENCH_ISR)
+//
+// the ISR cycle benchmark (I2CAnalogClockBench) runs the firmware in simavr and counts the cycles from
+// the write of the handler id to GPIOR0 till it is written to GPIOR1.  Ids must match the benchmark.
+//
+#define BENCH_TICK       1
+#define BENCH_PULSE_END  2 // last PWM overflow of a pulse, runs endTick()
+#define BENCH_TIMER      3 // adjust delay timer, runs adjustClock()
+#define BENCH_RECEIVE    4
+#define BENCH_REQUEST    5
+#define BENCH_POWER_FAIL 6
+#define BENCH_BEGIN(id)  (GPIOR0 = (id))
+#define BENCH_END(id)    (GPIOR1 = (id))
+#else
+#define BENCH_BEGIN(id)
+#define BENCH_END(id)
+#endif
+
 #define MAX_SECONDS     43200
 
 
@@ -85,18 +104,37 @@
 #define CMD_RESET       0x0d
 #define CMD_RST_REASON  0x0e
 #define CMD_VERSION     0x0f
+#define CMD_STATE       0x10 // block: id, version, reset reason, control, status, position, adjustment
+#define CMD_CONFIG      0x11 // block: the Config struct
+#define CMD_ACK         0x12 // sequence number and status of the last framed write
+#define CMD_FAST_PULSE  0x13 // adjust pulse duration at full speed
+#define CMD_FAST_DELAY  0x14 // delay between adjust pulses at full speed
+#define CMD_AP_RAMP     0x15 // adjust pulses to ramp up to (and down from) full speed, 0 for a constant speed
+#define CMD_SENSE       0x16 // back-EMF threshold for a step that moved
+#define CMD_MISSED      0x17 // missed steps, a write clears it and STATUS_BIT_MISSED
+#define CMD_FRAMED      0x80 // or'ed with the command for a transfer with sequence number and CRC-8
+
+// ack register status
+#define ACK_OK          0x00
+#define ACK_BAD_FRAME   0x01
 
 // control register bits
 #define BIT_ENABLE      0x80
+#define BIT_SENSE       0x40 // check every step with the coil back-EMF
+#define BIT_TUNE        0x20 // find the lowest duty that still steps (needs BIT_SENSE)
 
 // status register bits
 #define STATUS_BIT_TICK    0x01
+#define STATUS_BIT_MISSED  0x02 // a step was missed since CMD_MISSED was last cleared
 #define STATUS_BIT_PWFBAD  0x80
 
 #define ID_VALUE        0x42
 
 #define isEnabled()     (control &  BIT_ENABLE)
 
+#define isSensing()     (control &  BIT_SENSE)
+#define isTuning()      (control &  BIT_TUNE)
+
 #define isTick()        (status &  STATUS_BIT_TICK)
 #define toggleTick()    (status ^= STATUS_BIT_TICK)
 
@@ -121,7 +159,19 @@
 #define PWM_PRESCALE_BITS (_BV(CS11))
 #endif
 
-#define ms2PWMCount(x)    (F_CPU / PWM_PRESCALE / config.pwm_top / (1000.0 / (double)(x)))
+#if defined(SENSE_ADC)
+#if F_CPU == 1000000L
+#define SENSE_ADC_PRESCALE_BITS (_BV(ADPS1) | _BV(ADPS0))  // 125khz ADC clock
+#else
+#define SENSE_ADC_PRESCALE_BITS (_BV(ADPS2) | _BV(ADPS1))  // 125khz ADC clock at 8mhz
+#endif
+#endif
+
+//
+// there is no FPU (or even a multiply) so these are only used by updateTiming().  The counts are
+// exact, the floating point versions they replaced came out one less now and then.
+//
+#define ms2PWMCount(x)    ((uint32_t)(F_CPU / PWM_PRESCALE / config.pwm_top) * (x) / 1000)
 #define duty2pwm(x)       ((x)*config.pwm_top/100)
 
 #ifdef __AVR_ATtinyX5__
@@ -135,11 +185,11 @@
 #define PRESCALE        512
 #define PRESCALE_BITS   ((1 << CS13) | (1 << CS11)) // 512 prescaler
 #endif
-#define ms2Timer(x) ((uint8_t)(F_CPU /(PRESCALE * (1/((double)x/1000)))))
+#define ms2Timer(x) ((uint8_t)((uint32_t)(F_CPU / 1000) * (x) / PRESCALE))
 #else
 #define PRESCALE        256
 #define PRESCALE_BITS   (1 << CS12) // 256 prescaler
-#define ms2Timer(x) ((uint16_t)(F_CPU /(PRESCALE * (1/((double)x/1000)))))
+#define ms2Timer(x) ((uint16_t)((uint32_t)(F_CPU / 1000) * (x) / PRESCALE))
 #endif
 
 #define DEFAULT_TP_DURATION_MS 32  // pulse duration in ms.
@@ -148,6 +198,26 @@
 #define DEFAULT_AP_DURATION_MS 17  // pulse duration during adjust
 #define DEFAULT_AP_DUTY        45  // duty cycle %.
 #define DEFAULT_AP_DELAY_MS    9   // delay between adjust pulses in ms.
+#define DEFAULT_AP_FAST_DURATION_MS 12 // pulse duration at full adjust speed
+#define DEFAULT_AP_FAST_DELAY_MS    4  // delay between adjust pulses at full speed, at least 2ms (see TIMER1_COMPA_vect)
+#define DEFAULT_AP_RAMP        16  // a slow ramp, a step missed at speed (when sensing) backs it off
+#define DEFAULT_SENSE          20  // back-EMF (in 1/255 of VCC) of a rotor that is still moving after the pulse
+#ifndef SENSE_RETRIES
+#define SENSE_RETRIES          2   // extra pulses for a missed step before giving up on it
+#endif
+#ifndef SENSE_RETRY_DUTY
+#define SENSE_RETRY_DUTY       60  // least duty cycle % of the extra pulses
+#endif
+#define SENSE_SETTLE_US        50  // let the flyback from the coil die out before sampling
+#ifndef TUNE_STEPS
+#define TUNE_STEPS             60  // good steps in a row before the duty is lowered by 1%
+#endif
+#ifndef TUNE_MARGIN
+#define TUNE_MARGIN            5   // % added to the duty after a missed step
+#endif
+#define TUNE_MIN_DUTY          10  // never tune the duty below this %
+#define TUNE_TICK              0   // tune_good/tuned index of the tick pulse (tp_duty)
+#define TUNE_ADJUST            1   // and of the adjust pulse (ap_duty)
 
 typedef struct config
 {
@@ -158,8 +228,34 @@ typedef struct config
     volatile uint8_t ap_delay;          // delay in ms between ticks during adjustment
     volatile uint8_t ap_start_duration; // duration of the first tick
     volatile uint8_t pwm_top;
+    volatile uint8_t ap_fast_duration;  // duration of an adjust pulse at full speed
+    volatile uint8_t ap_fast_delay;     // delay in ms between ticks at full speed
+    volatile uint8_t ap_ramp;           // adjust pulses to get to full speed
+    volatile uint8_t sense;             // minimum back-EMF of a step that moved
 } Config;
 
+#define CONFIG_MIN_SIZE 7 // size of the first Config, anything added later is loaded with its default
+
+//
+// the config in timer counts, the ISRs only use these.  updateTiming() converts the config when it
+// is loaded and (from loop()) after it is written or tuned.
+//
+typedef struct timing
+{
+    uint16_t tp_duration;       // PWM periods
+    uint16_t ap_duration;
+    uint16_t ap_start_duration;
+    uint16_t ap_fast_duration;
+    uint8_t  tp_duty;           // PWM compare values
+    uint8_t  ap_duty;
+    uint8_t  retry_duty;        // tp_duty but at least SENSE_RETRY_DUTY
+    uint16_t ap_delay;          // timer compare values
+    uint16_t ap_fast_delay;
+} Timing;
+
+#define STATE_SIZE      9
+#define FRAME_MAX       (sizeof(Config)+2) // largest frame, sequence number + config + CRC
+
 typedef struct ee_config
 {
     uint32_t crc;
@@ -180,22 +276,93 @@ typedef struct ee_power_fail_data
 } EEPowerFailData;
 
 #define CONFIG_ADDRESS     0
-#define POWER_FAIL_ADDRESS sizeof(EEConfig)
+#define POWER_FAIL_ADDRESS 32 // fixed so that the config can grow
+
+//
+// clock state, I2CACCore.cpp
+//
+extern volatile uint16_t position;
+extern volatile uint16_t adjustment;
+extern volatile uint8_t  status;
+extern volatile uint8_t  control;
+extern volatile bool     adjust_active;
+extern volatile uint16_t adjust_steps;
+extern volatile uint16_t missed;
+extern volatile uint8_t  step_retries;
+extern volatile uint8_t  ramp_limit;
+extern volatile uint8_t  tune_good[2];
+extern volatile bool     tuned[2];
+extern volatile bool     save_config;
+extern volatile bool     update_timing;
+extern volatile Config   config;
+extern volatile Timing   timing;
+#if defined(PWRFAIL_PIN)
+extern volatile bool     power_failed;
+extern volatile uint8_t  pwrfail_control;
+#endif
+#ifdef DEBUG_I2CAC
+extern volatile unsigned int ticks;
+#endif
 
+//
+// I2C protocol state, I2CACProtocol.cpp
+//
+extern volatile uint8_t  command;
+extern volatile bool     factory_reset;
+extern uint8_t           reset_reason;
+extern volatile bool     framed;
+extern volatile uint8_t  frame_seq;
+extern volatile uint8_t  ack_seq;
+extern volatile uint8_t  ack_status;
+extern volatile bool     frames_only;
+extern uint8_t           reply[FRAME_MAX];
+extern volatile uint8_t  reply_start;
+extern volatile uint8_t  reply_size;
+
+void initProtocol();
+void receiveCommand(uint8_t cmd, const uint8_t* data, uint8_t n);
+void prepareReply();
+void i2creceive(int size);
+void i2crequest();
+
+void initClock();
 void startAdjust();
 void adjustClock();
+uint16_t rampValue(uint16_t slow, uint16_t fast);
+uint8_t rampLevel();
 void advanceClock(uint16_t duration, uint8_t duty);
+void advancePosition();
+void endTick();
 void tick();
+#if defined(SENSE_ADC)
+bool checkStep();
+void tuneStep(bool moved);
+#endif
 
 uint32_t calculateCRC32(const uint8_t *data, size_t length);
+uint8_t crc8(uint8_t crc, const uint8_t* data, uint8_t length);
+void updateTiming();
 void clearConfig();
 boolean loadConfig();
 void saveConfig();
 
 #if defined(PWRFAIL_PIN)
+void powerFail();
+void powerRestored();
 void clearPowerFailData();
 boolean loadPowerFailData();
 void savePowerFailData();
 #endif
 
+//
+// hardware backend of the state machine, the ATtiny timer, PWM and ADC in I2CAnalogClock.cpp
+// or the simulated timeline of I2CAnalogClockTest.  The callbacks are run from the timer ISR.
+// The delay is in timer counts (ms2Timer()), the pulse in PWM periods and its duty a compare value.
+//
+void startTimer(uint16_t count, void (*func)());
+void startPWM(uint16_t duration, uint8_t duty, void (*func)());
+#if defined(SENSE_ADC)
+bool stepMoved();
+#endif
+
 #endif /* _I2CAnalogClock_H_ */
@@ -0,0 +1,241 @@
+//============================================================================
+// Name        : I2CAnalogClockBench.cpp
+// Description : Run the I2CAnalogClock firmware (pio run -e bench) in simavr
+//               with a 1hz signal and a power failure and count the cycles
+//               spent in each interrupt handler, fail if one of them is over
+//               its budget.
+//============================================================================
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_GPIOR0     0x31    // data address of GPIOR0 on the ATtiny85, BENCH_BEGIN()
+#define BENCH_GPIOR1     0x32    // and GPIOR1, BENCH_END()
+#define BENCH_INT_PIN    3       // PB3, the 1hz signal from the RTC
+#define BENCH_PWRFAIL_PIN 5      // PB5, low when the power has failed
+#define BENCH_POWER_FAIL 6       // handler id of powerFail()
+
+typedef struct handler
+{
+    const char* name;
+    uint32_t    budget;         // cycles
+    uint32_t    count;
+    uint64_t    total;
+    uint32_t    max;
+    uint64_t    start;          // cycle of the BENCH_BEGIN() in progress, 0 for none
+} Handler;
+
+//
+// the ids are the index, they must match BENCH_* in I2CAnalogClock.h.  The budgets are the worst
+// case we allow at 1MHz, the master waits 2ms after a tick before it talks to the clock.
+//
+static Handler handlers[] =
+{
+    { "none",       0 },
+    { "tick",       1000 },
+    { "pulse_end",  1000 },
+    { "timer",      1000 },
+    { "receive",    2000 },
+    { "request",    500 },
+    { "power_fail", 500 },
+};
+
+#define HANDLER_COUNT (sizeof(handlers)/sizeof(handlers[0]))
+
+static uint32_t unmatched    = 0;
+static uint64_t power_fail_s = 60;  // second the power fails, 0 for never
+static avr_irq_t* int_irq;
+static avr_irq_t* pwrfail_irq;
+
+static void benchBegin(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+    avr->data[addr] = v;
+    if (v > 0 && v < HANDLER_COUNT)
+    {
+        handlers[v].start = avr->cycle;
+    }
+}
+
+static void benchEnd(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+    avr->data[addr] = v;
+    if (v == 0 || v >= HANDLER_COUNT || handlers[v].start == 0)
+    {
+        unmatched += 1;
+        return;
+    }
+
+    Handler* h = &handlers[v];
+    uint32_t cycles = (uint32_t)(avr->cycle - h->start);
+    h->start  = 0;
+    h->count += 1;
+    h->total += cycles;
+    if (cycles > h->max)
+    {
+        h->max = cycles;
+    }
+}
+
+//
+// the 1hz signal, the clock ticks on the falling edge
+//
+static avr_cycle_count_t toggleTick(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    static uint32_t level = 1;
+    level = !level;
+    avr_raise_irq(int_irq, level);
+    return when + avr_usec_to_cycles(avr, 500000);
+}
+
+//
+// power fails for 2 seconds once
+//
+static avr_cycle_count_t powerFail(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    static bool failed = false;
+    failed = !failed;
+    avr_raise_irq(pwrfail_irq, !failed);
+    return failed ? when + avr_usec_to_cycles(avr, 2000000) : 0;
+}
+
+static bool setBudget(const char* arg)
+{
+    const char* eq = strchr(arg, '=');
+    if (eq == NULL)
+    {
+        return false;
+    }
+    for (unsigned i = 1; i < HANDLER_COUNT; ++i)
+    {
+        if (strlen(handlers[i].name) == (size_t)(eq - arg) && strncmp(handlers[i].name, arg, eq - arg) == 0)
+        {
+            handlers[i].budget = strtoul(eq + 1, NULL, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = 300;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': seconds      = strtoul(optarg, NULL, 0);  break;
+        case 'p': power_fail_s = strtoull(optarg, NULL, 0); break;
+        case 'b':
+            if (!setBudget(optarg))
+            {
+                fprintf(stderr, "bad budget '%s'\n", optarg);
+                return 2;
+            }
+            break;
+        default:
+            printf("usage: %s [-s seconds] [-p power fail second] [-b handler=cycles ...] firmware.elf\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "no firmware!\n");
+        return 2;
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware) != 0)
+    {
+        fprintf(stderr, "failed to read '%s'\n", argv[optind]);
+        return 2;
+    }
+    if (firmware.mmcu[0] == '\0')
+    {
+        strcpy(firmware.mmcu, "attiny85");
+    }
+    if (firmware.frequency == 0)
+    {
+        firmware.frequency = 1000000;
+    }
+
+    avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (avr == NULL)
+    {
+        fprintf(stderr, "unknown mcu '%s'\n", firmware.mmcu);
+        return 2;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    avr_register_io_write(avr, BENCH_GPIOR0, benchBegin, NULL);
+    avr_register_io_write(avr, BENCH_GPIOR1, benchEnd, NULL);
+
+    int_irq     = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), BENCH_INT_PIN);
+    pwrfail_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), BENCH_PWRFAIL_PIN);
+    avr_raise_irq(int_irq, 1);
+    avr_raise_irq(pwrfail_irq, 1);
+
+    avr_cycle_timer_register_usec(avr, 500000, toggleTick, NULL);
+    if (power_fail_s != 0)
+    {
+        avr_cycle_timer_register_usec(avr, (uint32_t)(power_fail_s * 1000000 + 250000), powerFail, NULL);
+    }
+
+    avr_cycle_count_t end = (avr_cycle_count_t)seconds * avr->frequency;
+    int state = cpu_Running;
+    while (avr->cycle < end && state != cpu_Done && state != cpu_Crashed)
+    {
+        state = avr_run(avr);
+    }
+
+    if (state == cpu_Crashed)
+    {
+        printf("FAILED: firmware crashed at cycle %llu\n", (unsigned long long)avr->cycle);
+        return 1;
+    }
+
+    int errors = 0;
+    printf("%-12s %8s %8s %8s %8s\n", "handler", "count", "average", "max", "budget");
+    for (unsigned i = 1; i < HANDLER_COUNT; ++i)
+    {
+        Handler* h = &handlers[i];
+        printf("%-12s %8u %8llu %8u %8u%s\n", h->name, h->count,
+                (unsigned long long)(h->count ? h->total / h->count : 0), h->max, h->budget,
+                h->max > h->budget ? " OVER BUDGET" : "");
+        if (h->max > h->budget)
+        {
+            errors += 1;
+        }
+    }
+
+    //
+    // a handler that never ran means the firmware (or the benchmark) is broken, not fast.
+    //
+    for (unsigned i = 1; i < HANDLER_COUNT; ++i)
+    {
+        if (handlers[i].budget != 0 && handlers[i].count == 0 && (i != BENCH_POWER_FAIL || power_fail_s != 0))
+        {
+            printf("FAILED: %s never ran\n", handlers[i].name);
+            errors += 1;
+        }
+    }
+    if (unmatched != 0)
+    {
+        printf("FAILED: unmatched: %u\n", unmatched);
+        errors += 1;
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Arduino.h
+ *
+ * Just enough of the Arduino API for the I2CAnalogClock state machine
+ * (I2CACCore.cpp) to compile on linux/MacOS for the ATtiny85 configuration.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define __AVR_ATtinyX5__    // same pins & options as the clock
+#ifndef F_CPU
+#define F_CPU 1000000L
+#endif
+
+typedef bool boolean;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+
+// every simulated event is atomic just like an ISR
+#define noInterrupts()
+#define interrupts()
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+inline void pinMode(uint8_t, uint8_t)      {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int  digitalRead(uint8_t)           { return LOW; }
+
+#endif /* ARDUINO_H_ */
@@ -0,0 +1,39 @@
+/*
+ * EEPROM.h
+ *
+ * EEPROM of the ATtiny85 in memory, it survives a simulated reset.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef EEPROM_H_
+#define EEPROM_H_
+#include "Arduino.h"
+
+#define EEPROM_SIZE 512
+
+class EEPROMClass
+{
+public:
+    EEPROMClass()                       { erase(); }
+    uint8_t read(int address)           { return _data[address % EEPROM_SIZE]; }
+    void    update(int address, uint8_t value)
+    {
+        if (_data[address % EEPROM_SIZE] != value)
+        {
+            _data[address % EEPROM_SIZE] = value;
+            writes += 1;
+        }
+    }
+    void    erase()                     { memset(_data, 0xff, sizeof(_data)); writes = 0; }
+
+    unsigned int writes;                // bytes written, for wear checks
+
+private:
+    uint8_t _data[EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif /* EEPROM_H_ */
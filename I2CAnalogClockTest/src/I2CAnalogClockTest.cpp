@@ -0,0 +1,257 @@
+//============================================================================
+// Name        : I2CAnalogClockTest.cpp
+// Description : Run the I2CAnalogClock tick/adjust/power fail state machine
+//               on linux/MacOS with a simulated timer, PWM, EEPROM and clock
+//               motor through randomized orderings of ticks, I2C writes and
+//               power failures.
+//============================================================================
+
+#include "Simulator.h"
+#include "I2CAnalogClock.h"
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define SETTLE_US     (3600ULL*SIM_TICK_US)  // max time for the last adjustment to finish
+#define MAX_ADJUST    600                    // largest random adjustment
+#define RAMP_MISSES   5                      // steps missed at speed till the ramp is backed off to slow (log2(ap_ramp) + 1)
+
+typedef enum
+{
+    SCENARIO_COUNT = 0, // no sensing and a perfect motor, every step is accounted for
+    SCENARIO_SENSE,     // sensing with random stalls, the position follows the hand
+    SCENARIO_TUNE,      // sensing and tuning with a motor that needs a minimum duty
+    SCENARIO_RAMP,      // sensing with a motor that can't keep up with the fast adjust timing
+    SCENARIO_COUNT_MAX
+} Scenario;
+
+static const char* const scenario_names[SCENARIO_COUNT_MAX] =
+{
+    "count", "sense", "tune", "ramp"
+};
+
+typedef struct run_result
+{
+    uint32_t adjusts;       // adjustments written
+    uint32_t outages;
+    uint32_t resets;
+    uint32_t errors;
+} RunResult;
+
+static int verbose = 0;
+
+static uint16_t distance(uint32_t from, uint32_t to)
+{
+    return (uint16_t)((to + MAX_SECONDS - from % MAX_SECONDS) % MAX_SECONDS);
+}
+
+static void fail(RunResult* result, uint64_t seed, Scenario scenario, const char* what, long expected, long actual)
+{
+    printf("FAILED: seed: %llu scenario: %s %s expected: %ld actual: %ld\n",
+            (unsigned long long)seed, scenario_names[scenario], what, expected, actual);
+    result->errors += 1;
+}
+
+//
+// one clock from power on: sync the motor, then random I2C writes and power failures at random times
+// for the given minutes, then let any adjustment finish and check that the position matches the hand.
+//
+static void runClock(uint64_t seed, Scenario scenario, uint32_t minutes, RunResult* result)
+{
+    memset(result, 0, sizeof(*result));
+    sim.begin(seed);
+
+    switch (scenario)
+    {
+    case SCENARIO_COUNT:
+        break;
+    case SCENARIO_SENSE:
+        control          = BIT_SENSE;
+        sim.motor.stall  = sim.random() * 0.2;
+        break;
+    case SCENARIO_TUNE:
+        control            = BIT_SENSE | BIT_TUNE | BIT_ENABLE;
+        sim.motor.min_duty = 15 + sim.random(25);
+        break;
+    case SCENARIO_RAMP:
+        control            = BIT_SENSE;
+        sim.motor.min_rest = (DEFAULT_AP_FAST_DELAY_MS + 1) * 1000 + sim.random((DEFAULT_AP_DELAY_MS - DEFAULT_AP_FAST_DELAY_MS - 2) * 1000);
+        break;
+    case SCENARIO_COUNT_MAX:
+        break;
+    }
+
+    //
+    // the startup adjustment lines the motor up with the tick/tock, after that the hand and position move together.
+    // (the position is advanced at the start of a pulse and the hand at its end so look between the ticks)
+    //
+    sim.run(2 * SIM_TICK_US + SIM_TICK_US / 2);
+    uint16_t hand0     = sim.motor.hand % MAX_SECONDS;
+    uint16_t position0 = position;
+    uint32_t ticks0    = sim.ticks;
+    uint32_t misfires0 = sim.motor.misfires;
+    long     steps     = 0; // adjustment steps expected
+
+    uint64_t end = sim.getMicros() + (uint64_t)minutes * 60 * SIM_TICK_US;
+    while (sim.getMicros() < end)
+    {
+        sim.run(1 + sim.random(40 * SIM_TICK_US));
+
+        double event = sim.random();
+        if (event < 0.4)
+        {
+            if (adjustment == 0 && !adjust_active)
+            {
+                uint16_t value = 1 + sim.random(MAX_ADJUST);
+                adjustment     = value;
+                steps         += value;
+                result->adjusts += 1;
+            }
+        }
+        else if (event < 0.6)
+        {
+            control ^= BIT_ENABLE;
+        }
+        else if (event < 0.7)
+        {
+            //
+            // power fail: the adjustment is cut short to the step in progress (or dropped if it has not
+            // started) and the state is saved as soon as it is done, then either the power is back or the
+            // capacitor ran out.
+            //
+            uint16_t before = adjustment;
+            sim.powerFail();
+            steps -= before - adjustment;
+            result->outages += 1;
+            uint64_t limit = sim.getMicros() + SETTLE_US;
+            while (sim.getPower() != SIM_POWER_SAVED && sim.getMicros() < limit)
+            {
+                sim.run(SIM_TICK_US / 10);
+            }
+            sim.run(sim.random(5 * SIM_TICK_US));
+            steps -= adjustment;
+            bool reset = sim.random() < 0.5;
+            sim.powerReturn(reset);
+
+            if (reset && (status & STATUS_BIT_PWFBAD))
+            {
+                fail(result, seed, scenario, "power fail data", 0, status);
+            }
+        }
+    }
+
+    //
+    // let any adjustment finish with a perfect motor and make sure the clock still steps.
+    //
+    uint64_t limit = sim.getMicros() + SETTLE_US;
+    while ((adjustment != 0 || sim.isBusy()) && sim.getMicros() < limit)
+    {
+        sim.run(SIM_TICK_US / 10);
+    }
+    sim.motor.stall = 0.0;
+    sim.run(SIM_TICK_US - sim.getMicros() % SIM_TICK_US + SIM_TICK_US / 2);
+    result->resets = sim.getResets();
+
+    if (adjustment != 0)
+    {
+        fail(result, seed, scenario, "adjustment", 0, adjustment);
+    }
+    if (sim.overlaps)
+    {
+        fail(result, seed, scenario, "overlapping pulses", 0, sim.overlaps);
+    }
+
+    uint16_t hand_moved     = distance(hand0, sim.motor.hand);
+    uint16_t position_moved = distance(position0, position);
+    if (hand_moved != position_moved)
+    {
+        fail(result, seed, scenario, "position vs. hand", hand_moved, position_moved);
+    }
+
+    if (scenario == SCENARIO_COUNT)
+    {
+        long expected = (steps + (long)(sim.ticks - ticks0)) % MAX_SECONDS;
+        if (position_moved != expected)
+        {
+            fail(result, seed, scenario, "steps", expected, position_moved);
+        }
+        if (sim.motor.misfires != misfires0)
+        {
+            fail(result, seed, scenario, "tick/tock misfires", misfires0, sim.motor.misfires);
+        }
+    }
+
+    //
+    // a step given up on can leave the next one out of step, after that every tick must move the hand.
+    //
+    control |= BIT_ENABLE;
+    sim.run(3 * SIM_TICK_US);
+    uint32_t hand = sim.motor.hand;
+    sim.run(10 * SIM_TICK_US);
+    if (sim.motor.hand - hand != 10)
+    {
+        fail(result, seed, scenario, "steps after the run", 10, sim.motor.hand - hand);
+    }
+
+    if (scenario == SCENARIO_TUNE && tuned[TUNE_TICK]
+        && (config.tp_duty < sim.motor.min_duty || config.tp_duty >= sim.motor.min_duty + TUNE_MARGIN))
+    {
+        fail(result, seed, scenario, "tp_duty", sim.motor.min_duty, config.tp_duty);
+    }
+
+    //
+    // the ramp backs off after a few missed steps, the startup adjustment misses all tries of one step.
+    //
+    if (scenario == SCENARIO_RAMP && missed > SENSE_RETRIES + 1 + RAMP_MISSES)
+    {
+        fail(result, seed, scenario, "missed", SENSE_RETRIES + 1 + RAMP_MISSES, missed);
+    }
+
+    if (verbose)
+    {
+        printf("seed: %llu scenario: %s hand: %u misfires: %u stalls: %u missed: %u adjusts: %u outages: %u resets: %u tp_duty: %u eeprom writes: %u\n",
+                (unsigned long long)seed, scenario_names[scenario], sim.motor.hand, sim.motor.misfires, sim.motor.stalls,
+                missed, result->adjusts, result->outages, result->resets, config.tp_duty, EEPROM.writes);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t runs    = 1000;
+    uint64_t seed    = 1;
+    uint32_t minutes = 60;
+    int      only    = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:S:m:s:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': runs    = strtoul(optarg, NULL, 0);       break;
+        case 'S': seed    = strtoull(optarg, NULL, 0);      break;
+        case 'm': minutes = strtoul(optarg, NULL, 0);       break;
+        case 's': only    = atoi(optarg);                   break;
+        case 'v': verbose += 1;                             break;
+        default:
+            printf("usage: %s [-n runs] [-S seed] [-m minutes] [-s scenario] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    RunResult total;
+    memset(&total, 0, sizeof(total));
+    for (uint32_t i = 0; i < runs; ++i)
+    {
+        Scenario scenario = (Scenario)(only >= 0 ? only : i % SCENARIO_COUNT_MAX);
+        RunResult result;
+        runClock(seed + i, scenario, minutes, &result);
+        total.adjusts += result.adjusts;
+        total.outages += result.outages;
+        total.resets  += result.resets;
+        total.errors  += result.errors;
+    }
+
+    printf("runs: %u adjusts: %u outages: %u resets: %u errors: %u\n",
+            runs, total.adjusts, total.outages, total.resets, total.errors);
+    return total.errors ? 1 : 0;
+}
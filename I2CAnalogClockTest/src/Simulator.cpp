@@ -0,0 +1,282 @@
+/*
+ * Simulator.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "Simulator.h"
+#include "I2CAnalogClock.h"
+
+EEPROMClass EEPROM;
+
+Simulator::Simulator()
+{
+    _seed     = 1;
+    _now      = 0;
+    _timer_at = SIM_NEVER;
+    _timer_cb = NULL;
+    _pulse    = false;
+    _power    = SIM_POWER_ON;
+    _resets   = 0;
+    overlaps  = 0;
+}
+
+//
+// start over with an erased EEPROM and the rotor in either position, just like a new clock.
+//
+void Simulator::begin(uint64_t seed)
+{
+    _seed      = seed ? seed : 1; // xorshift needs a non-zero state
+    _now       = 0;
+    _next_tick = SIM_TICK_US;
+    _power     = SIM_POWER_ON;
+    memset(&motor, 0, sizeof(motor));
+    motor.rotor = random() < 0.5;
+    _pulse_at  = 0;
+    _moved_at  = 0;
+    ticks      = 0;
+    overlaps   = 0;
+    saved_at   = 0;
+    EEPROM.erase();
+    reset();
+    _resets    = 0;
+}
+
+uint64_t Simulator::getMicros()
+{
+    return _now;
+}
+
+//
+// xorshift64* - we want the same sequence on every platform so we don't use the C++ library generators.
+//
+double Simulator::random()
+{
+    _seed ^= _seed >> 12;
+    _seed ^= _seed << 25;
+    _seed ^= _seed >> 27;
+    return (double)((_seed * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+uint32_t Simulator::random(uint32_t limit)
+{
+    return (uint32_t)(random() * limit);
+}
+
+bool Simulator::step(uint64_t until)
+{
+    uint64_t next = _timer_at < _next_tick ? _timer_at : _next_tick;
+    if (next > until)
+    {
+        _now = until;
+        return false;
+    }
+
+    _now = next;
+    if (_timer_at == next)
+    {
+        _timer_at = SIM_NEVER;
+        if (_pulse)
+        {
+            endPulse();
+        }
+        else
+        {
+            _timer_cb();
+        }
+    }
+    else
+    {
+        _next_tick += SIM_TICK_US;
+        if (isEnabled())
+        {
+            ticks += 1;
+        }
+        ::tick();
+    }
+
+    loop();
+    return true;
+}
+
+void Simulator::run(uint64_t us)
+{
+    uint64_t until = _now + us;
+    while (step(until))
+    {
+    }
+}
+
+bool Simulator::isBusy()
+{
+    return _timer_at != SIM_NEVER;
+}
+
+void Simulator::loop()
+{
+    if (update_timing)
+    {
+        update_timing = false;
+        updateTiming();
+    }
+
+    if (save_config)
+    {
+        save_config = false;
+        saveConfig();
+    }
+
+    if (_power == SIM_POWER_FAILED && !isBusy())
+    {
+        savePowerFailData();
+        _power   = SIM_POWER_SAVED;
+        saved_at = _now;
+    }
+}
+
+void Simulator::powerFail()
+{
+    if (_power == SIM_POWER_ON)
+    {
+        _power = SIM_POWER_FAILED;
+        ::powerFail();
+    }
+}
+
+//
+// the power is back, after a reset if the capacitor ran out first.
+//
+void Simulator::powerReturn(bool reset)
+{
+    if (_power != SIM_POWER_SAVED)
+    {
+        return;
+    }
+
+    _power = SIM_POWER_ON;
+    if (reset)
+    {
+        this->reset();
+    }
+    else
+    {
+        powerRestored();
+    }
+}
+
+SimPower Simulator::getPower()
+{
+    return _power;
+}
+
+uint32_t Simulator::getResets()
+{
+    return _resets;
+}
+
+//
+// the times are from the timer counts just like timer1 does it
+//
+void Simulator::startTimer(uint16_t count, void (*func)())
+{
+    if (_pulse && isBusy())
+    {
+        overlaps += 1;
+    }
+    _timer_at = _now + (uint64_t)count * PRESCALE * 1000000 / F_CPU;
+    _timer_cb = func;
+    _pulse    = false;
+}
+
+void Simulator::startPWM(uint16_t duration, uint8_t duty, void (*func)())
+{
+    if (_pulse && isBusy())
+    {
+        overlaps += 1;
+    }
+    _timer_at = _now + (uint64_t)duration * config.pwm_top * PWM_PRESCALE * 1000000 / F_CPU;
+    _timer_cb = func;
+    _pulse    = true;
+    _polarity = isTick();
+    _duty     = duty;
+    _pulse_at = _now;
+}
+
+bool Simulator::stepMoved()
+{
+    return _moved;
+}
+
+void Simulator::endPulse()
+{
+    motor.pulses += 1;
+    _moved = false;
+    if (motor.rotor == _polarity)
+    {
+        motor.misfires += 1;
+    }
+    else if (_duty < duty2pwm(motor.min_duty) || _pulse_at - _moved_at < motor.min_rest || random() < motor.stall)
+    {
+        motor.stalls += 1;
+    }
+    else
+    {
+        motor.rotor  = _polarity;
+        motor.hand  += 1;
+        _moved       = true;
+        _moved_at    = _now;
+    }
+    _timer_cb();
+}
+
+//
+// a reset clears the RAM and runs setup(), only the EEPROM is kept.
+//
+void Simulator::reset()
+{
+    _timer_at       = SIM_NEVER;
+    _timer_cb       = NULL;
+    _pulse          = false;
+    _moved          = false;
+
+    position        = 0;
+    adjustment      = 0;
+    status          = 0;
+    control         = 0;
+    adjust_active   = false;
+    adjust_steps    = 0;
+    missed          = 0;
+    step_retries    = 0;
+    save_config     = false;
+    update_timing   = false;
+    power_failed    = false;
+    pwrfail_control = 0;
+    memset((void*)tune_good, 0, sizeof(tune_good));
+    memset((void*)tuned, 0, sizeof(tuned));
+    memset((void*)&config, 0, sizeof(config));
+    memset((void*)&timing, 0, sizeof(timing));
+
+    initClock();
+    _resets += 1;
+}
+
+Simulator sim;
+
+//
+// the backend used by I2CACCore.cpp
+//
+void startTimer(uint16_t count, void (*func)())
+{
+    sim.startTimer(count, func);
+}
+
+void startPWM(uint16_t duration, uint8_t duty, void (*func)())
+{
+    sim.startPWM(duration, duty, func);
+}
+
+bool stepMoved()
+{
+    return sim.stepMoved();
+}
@@ -0,0 +1,98 @@
+/*
+ * Simulator.h
+ *
+ * Virtual time simulation of the ATtiny timer/PWM/ADC backend and the Lavet
+ * motor of the clock so that the state machine in I2CACCore.cpp can be run
+ * through any ordering of 1hz ticks, pulses, I2C writes and power failures.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+#include "Arduino.h"
+
+#define SIM_TICK_US      1000000    // the 1hz signal from the RTC
+#define SIM_NEVER        UINT64_MAX
+
+typedef enum
+{
+    SIM_POWER_ON = 0,
+    SIM_POWER_FAILED,   // waiting for the running pulse/timer to finish
+    SIM_POWER_SAVED     // power fail data saved, waiting for the power (or the reset)
+} SimPower;
+
+//
+// The Lavet motor: the rotor turns half a turn (one step of the second hand) to line up with
+// the field of a pulse unless it already is lined up (a misfire), the pulse is too weak or it comes
+// before the rotor has settled from the last step (a stall).
+//
+typedef struct sim_motor
+{
+    bool     rotor;         // polarity of the last pulse the rotor lined up with
+    uint32_t hand;          // steps the hand has taken
+    uint8_t  min_duty;      // a pulse with less duty stalls
+    uint32_t min_rest;      // a pulse that starts sooner (us) after the end of the last step stalls
+    double   stall;         // probability of a random stall
+    uint32_t pulses;
+    uint32_t misfires;      // pulses that found the rotor already lined up
+    uint32_t stalls;
+} SimMotor;
+
+class Simulator
+{
+public:
+    Simulator();
+    void     begin(uint64_t seed);
+
+    uint64_t getMicros();
+    double   random();
+    uint32_t random(uint32_t limit);
+
+    // run the next event (tick, timer or pulse end) at or before until, false if there is none
+    bool     step(uint64_t until);
+    void     run(uint64_t us);
+    bool     isBusy();
+
+    // the clock's loop(): saves the config and the power fail data
+    void     loop();
+
+    // power
+    void     powerFail();
+    void     powerReturn(bool reset);
+    SimPower getPower();
+    uint32_t getResets();
+
+    SimMotor motor;
+    uint32_t ticks;         // ticks while the clock was enabled
+    uint32_t overlaps;      // a timer or pulse was started while a pulse was running
+    uint64_t saved_at;      // time the power fail data was saved
+
+    // backend
+    void     startTimer(uint16_t count, void (*func)());
+    void     startPWM(uint16_t duration, uint8_t duty, void (*func)());
+    bool     stepMoved();
+
+private:
+    uint64_t _seed;
+    uint64_t _now;
+    uint64_t _next_tick;
+    uint64_t _timer_at;     // the one timer1 is either a delay or a pulse
+    void   (*_timer_cb)();
+    bool     _pulse;        // timer1 is running a pulse
+    bool     _polarity;     // of the running pulse
+    uint8_t  _duty;         // compare value
+    bool     _moved;        // the last pulse moved the rotor
+    uint64_t _pulse_at;     // start of the running pulse
+    uint64_t _moved_at;     // end of the last pulse that moved the rotor
+    SimPower _power;
+    uint32_t _resets;
+
+    void     endPulse();
+    void     reset();
+};
+
+extern Simulator sim;
+
+#endif /* SIMULATOR_H_ */
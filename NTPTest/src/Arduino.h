@@ -8,11 +8,20 @@
 #ifndef ARDUINO_H_
 #define ARDUINO_H_
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "Types.h"
 #include "IPAddress.h"
 #include "UnixWiFi.h"
 #include "String.h"
 
+// the esp8266 keeps constant strings in flash, on unix they are just strings.
+#define PROGMEM
+#define F(s)            (s)
+#define FPSTR(s)        (s)
+
 #define yield()
 #define millis() Timer::getMillis()
+#define micros() Timer::getMicros()
 #endif /* ARDUINO_H_ */
@@ -7,42 +7,69 @@
 
 #include "Logger.h"
 #include <stdio.h>
-#include<stdarg.h>
+#include <stdarg.h>
 
-Logger::Logger()
+#define DLOG_LINE(level, name)                  \
+    if (_level < level)                         \
+    {                                           \
+        return;                                 \
+    }                                           \
+    va_list argp;                               \
+    va_start(argp, fmt);                        \
+    printf("%s %s", name, tag);                 \
+    vprintf(fmt, argp);                         \
+    printf("\n");                               \
+    va_end(argp)
+
+DLog::DLog()
 {
+    _level = DLOG_LEVEL_INFO;
 }
 
-void Logger::begin(long int baud)
+DLog& DLog::getLog()
 {
+    static DLog log;
+    return log;
 }
 
-void Logger::end()
+void DLog::setLevel(DLogLevel level)
 {
+    _level = level;
 }
 
-void Logger::setNetworkLogger(const char* host, unsigned short port)
+DLogLevel DLog::getLevel()
 {
+    return _level;
 }
 
-void Logger::println(const char* message)
+void DLog::error(const char* tag, const char* fmt, ...)
 {
-    printf("%s\n", message);
+    DLOG_LINE(DLOG_LEVEL_ERROR, "E");
 }
 
-void Logger::printf(const char* fmt, ...)
+void DLog::warning(const char* tag, const char* fmt, ...)
 {
-    va_list argp;
-    va_start(argp, fmt);
+    DLOG_LINE(DLOG_LEVEL_WARNING, "W");
+}
 
-    vprintf(fmt, argp);
-    va_end(argp);
+void DLog::info(const char* tag, const char* fmt, ...)
+{
+    DLOG_LINE(DLOG_LEVEL_INFO, "I");
 }
 
-void Logger::flush()
+void DLog::debug(const char* tag, const char* fmt, ...)
 {
-    fflush(stdout);
+    DLOG_LINE(DLOG_LEVEL_DEBUG, "D");
+}
+
+void DLog::trace(const char* tag, const char* fmt, ...)
+{
+    DLOG_LINE(DLOG_LEVEL_TRACE, "T");
 }
 
+void DLog::flush()
+{
+    fflush(stdout);
+}
 
-Logger logger;
+DLog& dlog = DLog::getLog();
@@ -23,32 +23,36 @@
 #ifndef LOGGER_H_
 #define LOGGER_H_
 
-class Logger {
+//
+// Just enough of the DLog interface for the SynchroClock libraries to build and log to stdout.
+//
+typedef enum
+{
+    DLOG_LEVEL_NONE = 0,
+    DLOG_LEVEL_ERROR,
+    DLOG_LEVEL_WARNING,
+    DLOG_LEVEL_INFO,
+    DLOG_LEVEL_DEBUG,
+    DLOG_LEVEL_TRACE
+} DLogLevel;
+
+class DLog
+{
 public:
-    Logger();
-    void begin(long int baud = 115200L);
-    void end();
-    void setNetworkLogger(const char* host, unsigned short port);
-    void println(const char*message);
-    void printf(const char*message, ...);
+    DLog();
+    static DLog& getLog();
+    void setLevel(DLogLevel level);
+    DLogLevel getLevel();
+    void error(const char* tag, const char* fmt, ...);
+    void warning(const char* tag, const char* fmt, ...);
+    void info(const char* tag, const char* fmt, ...);
+    void debug(const char* tag, const char* fmt, ...);
+    void trace(const char* tag, const char* fmt, ...);
     void flush();
+private:
+    DLogLevel _level;
 };
 
-extern Logger logger;
-
-#define DEBUG
-#ifdef DEBUG
-#define dbprintf(...)   logger.printf(__VA_ARGS__)
-#define dbprint64(l,v)  logger.printf("%s %08x:%08x (%Lf)\n", l, (uint32_t)(v>>32), (uint32_t)(v & 0xffffffff), ((long double)v / 4294967296.))
-#define dbprint64s(l,v) logger.printf("%s %08x:%08x (%Lf)\n", l,  (int32_t)(v>>32), (uint32_t)(v & 0xffffffff), ((long double)v / 4294967296.))
-#define dbprintln(x)    logger.println(x)
-#define dbflush()       logger.flush()
-#else
-#define dbprintf(...)
-#define dbprint64(l,v)
-#define dbprint64s(l,v)
-#define dbprintln(x)
-#define dbflush()
-#endif
+extern DLog& dlog;
 
 #endif /* LOGGER_H_ */
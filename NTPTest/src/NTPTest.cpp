@@ -1,20 +1,27 @@
 //============================================================================
 // Name        : NTPTest.cpp
-// Author      : 
+// Author      :
 // Version     :
 // Copyright   : Your copyright notice
-// Description : Hello World in C++, Ansi-style
+// Description : Run the SynchroClock NTP class on linux/MacOS, either against
+//               a real server in (accelerated) real time or in a virtual time
+//               simulation with a modeled server, network and RTC drift.
 //============================================================================
 
-#include "NTP.h"
+#include "NTPTest.h"
+#include "Simulator.h"
+#include "Sweep.h"
+#include "Logger.h"
 
 #include <sys/time.h>
 #include <unistd.h>
 #include <math.h>
+#include <stdio.h>
 
 #define SPEEDUP_FACTOR 100
-#define MAX_SLEEP      (3600 / SPEEDUP_FACTOR)
+#define MAX_SLEEP      3600     // same as MAX_SLEEP_DURATION in SynchroClock
 #define PERSIST_FILE   "/tmp/ntp_persist.data"
+#define SIM_SERVER     "pool.ntp.sim"
 
 uint32_t start_time   = 0;
 uint32_t last_time    = 0;
@@ -23,6 +30,8 @@ double fake_drift_ppm = 1.0*SPEEDUP_FACTOR;
 uint32_t sleep_left   = 0;
 
 NTPPersist persist;
+NTPPersist saved_persist;   // the EEPROM copy of persist in a simulation
+uint32_t   persist_saves;   // and the number of times it was written
 
 void loadPersist()
 {
@@ -43,6 +52,14 @@ void loadPersist()
 
 void savePersist()
 {
+    if (sim.isActive())
+    {
+        // simulations always start from scratch, keep the copy that is reloaded on each wake
+        memcpy(&saved_persist, &persist, sizeof(persist));
+        persist_saves += 1;
+        return;
+    }
+
     printf("savePersist()\n");
     FILE *fp = fopen(PERSIST_FILE, "w");
     if (fp == NULL)
@@ -78,8 +95,25 @@ void adjustOffsetByDrift()
     last_time =  (uint32_t)tp.tv_sec;
 }
 
-int getTime(uint32_t *result)
+int setAging(int8_t aging)
 {
+    sim.setAging(aging);
+    return 0;
+}
+
+int getTime(uint32_t *result, uint32_t *edge)
+{
+    if (sim.isActive())
+    {
+        int err = sim.waitForEdge(result);
+        if (edge != NULL)
+        {
+            *edge = Timer::getMicros();
+        }
+        sim.advance(SIM_EDGE_LATENCY); // like the delay and RTC read in SynchroClock getTime()
+        return err;
+    }
+
     struct timeval tp;
     gettimeofday(&tp, NULL);
 
@@ -95,17 +129,18 @@ int getTime(uint32_t *result)
         usleep(1000000-tp.tv_usec);
     }
     *result = tp.tv_sec+1;
+    if (edge != NULL)
+    {
+        *edge = Timer::getMicros();
+    }
     return 0;
 }
 
-int main(int argc, char**argv)
+//
+// real time test against a real NTP server, time is sped up by SPEEDUP_FACTOR
+//
+int run(const char* server)
 {
-    const char *server = "192.168.0.31";
-    printf("argc: %d\n", argc);
-    if (argc > 1)
-    {
-        server = argv[1];
-    }
     NTPRunTime runtime;
     memset(&persist, 0, sizeof(persist));
     memset(&runtime, 0, sizeof(runtime));
@@ -134,10 +169,10 @@ int main(int argc, char**argv)
             }
             sleep_left = test.getPollInterval();
         }
-        int interval = MAX_SLEEP;
-        if (sleep_left > MAX_SLEEP)
+        int interval = MAX_SLEEP / SPEEDUP_FACTOR;
+        if (sleep_left > MAX_SLEEP / SPEEDUP_FACTOR)
         {
-            sleep_left -= MAX_SLEEP;
+            sleep_left -= MAX_SLEEP / SPEEDUP_FACTOR;
         }
         else
         {
@@ -150,5 +185,396 @@ int main(int argc, char**argv)
     }
 
     printf("Done!\n");
-	return 0;
+    return 0;
+}
+
+//
+// Virtual time simulation, each loop is one wake from deep sleep just like setup() in SynchroClock.
+// The RTC error is sampled on each wake before any adjustment is applied.
+//
+void simulate(double days, double threshold, const NTPTuning* tuning, bool trim, SimResult* result)
+{
+    NTPRunTime runtime;
+    memset(&persist, 0, sizeof(persist));
+    memset(&saved_persist, 0, sizeof(saved_persist));
+    memset(&runtime, 0, sizeof(runtime));
+    memset(result, 0, sizeof(SimResult));
+    persist_saves = 0;
+    result->converged = -1.0;
+    result->drift_converged = -1.0;
+
+    NTP ntp(&runtime, &persist, &savePersist);
+    if (tuning != NULL)
+    {
+        ntp.setTuning(tuning);
+    }
+    ntp.begin();
+
+    double   sum        = 0.0;
+    double   last_bad   = 0.0;
+    double   last_drift = 0.0;
+    uint32_t sleep_left = 0;
+
+    while (sim.getDays() < days)
+    {
+        // SynchroClock loads its config (with persist) from the EEPROM on every wake
+        memcpy(&persist, &saved_persist, sizeof(persist));
+        if (sim.powerLost())
+        {
+            // RTC memory is lost, like a cold start of SynchroClock
+            memset(&runtime, 0, sizeof(runtime));
+            sleep_left = 0;
+            result->outages += 1;
+        }
+        sim.oscillatorStopped();
+        if (sim.getOSF())
+        {
+            // the RTC is wrong, poll now like SynchroClock
+            ntp.rtcStopped();
+            sleep_left = 0;
+        }
+
+        double error = sim.getRTCError();
+        result->wakes += 1;
+        sum += error * error;
+        if (fabs(error) > result->max)
+        {
+            result->max = fabs(error);
+        }
+        if (fabs(error) > threshold)
+        {
+            last_bad = sim.getDays();
+        }
+        if (fabs(ntp.getTemperatureDrift((float)sim.getTemperature()) - sim.getDrift()) > SIM_DRIFT_TOLERANCE)
+        {
+            last_drift = sim.getDays();
+        }
+        dlog.info("NTPTest", "::simulate: day: %0.3f drift: %0.3f error: %0.6f", sim.getDays(), sim.getDrift(), error);
+
+        double offset = 0.0;
+        ntp.addTemperature((uint32_t)sim.getRTCTime(), (float)sim.getTemperature());
+        if (ntp.getOffsetUsingDrift(&offset, &getTime) == 0)
+        {
+            sim.adjustRTC(offset);
+            result->drifts += 1;
+        }
+
+        if (sleep_left == 0)
+        {
+            ntp.begin();
+            result->polls += 1;
+            if (ntp.getOffset(SIM_SERVER, &offset, &getTime) == 0)
+            {
+                sim.adjustRTC(offset);
+                sim.clearOSF();
+                if (trim)
+                {
+                    int8_t aging = sim.getAging();
+                    ntp.applyFrequencyTrim(&aging, &setAging);
+                }
+            }
+            else
+            {
+                result->skipped += 1;
+            }
+            sleep_left = ntp.getPollInterval();
+        }
+
+        uint32_t interval = MAX_SLEEP;
+        if (sleep_left > MAX_SLEEP)
+        {
+            sleep_left -= MAX_SLEEP;
+        }
+        else
+        {
+            interval   = sleep_left;
+            sleep_left = 0;
+        }
+        sim.advance(interval);
+    }
+
+    result->days       = sim.getDays();
+    result->saves      = persist_saves;
+    result->rms        = sqrt(sum / result->wakes);
+    result->drift      = ntp.getTemperatureDrift((float)sim.getTemperature());
+    result->true_drift = sim.getDrift();
+    result->aging      = sim.getAging();
+    if (fabs(sim.getRTCError()) <= threshold)
+    {
+        result->converged = last_bad;
+    }
+    if (fabs(result->drift - result->true_drift) <= SIM_DRIFT_TOLERANCE)
+    {
+        result->drift_converged = last_drift;
+    }
+}
+
+//
+// parse a drift profile: "day:ppm[,day:ppm...]"
+//
+int parseProfile(const char* profile)
+{
+    const char* p = profile;
+    while (*p)
+    {
+        double day;
+        double ppm;
+        int    n;
+        if (sscanf(p, "%lf:%lf%n", &day, &ppm, &n) != 2 || sim.addDriftPoint(day, ppm))
+        {
+            return -1;
+        }
+        p += n;
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+    return 0;
+}
+
+void usage(const char* name)
+{
+    printf("usage: %s [server]                 real time test against server\n", name);
+    printf("       %s -s [options]             virtual time simulation\n", name);
+    printf("  -d days         days to simulate (default 365)\n");
+    printf("  -I ms           initial RTC error (default 0)\n");
+    printf("  -p ppm          constant RTC drift (default 2.0, positive is slow)\n");
+    printf("  -P day:ppm,...  drift profile, linear between points\n");
+    printf("  -D ms           one way network delay (default 10)\n");
+    printf("  -J ms           network jitter (default 5)\n");
+    printf("  -j dist         jitter distribution: uniform, normal or exp (default exp)\n");
+    printf("  -L percent      packet loss (default 0)\n");
+    printf("  -S seed         random seed (default 1)\n");
+    printf("  -n servers      servers in the pool (default 1)\n");
+    printf("  -f count        falsetickers in the pool (default 0)\n");
+    printf("  -F ms           falseticker offset, multiplied for each one (default 100)\n");
+    printf("  -m peers        servers polled at once, more than 1 enables clock selection (default 1)\n");
+    printf("  -K              use the Kalman filter discipline\n");
+    printf("  -T celsius      amplitude of a daily temperature cycle around 15C (default 0)\n");
+    printf("  -C coefficient  temperature drift in ppm per C squared away from 25C (default 0.034)\n");
+    printf("  -a              trim the RTC aging offset to remove the drift\n");
+    printf("  -O days         power loss every days, the RTC keeps time on its battery (default never)\n");
+    printf("  -X day          power loss on day that also stops the RTC oscillator (default never)\n");
+    printf("  -Y day          the RTC oscillator alone stops for an hour on day (default never)\n");
+    printf("  -t ms           error threshold for convergence (default 50)\n");
+    printf("  -R ms           fail if the RMS error is larger\n");
+    printf("  -c days         fail if the RTC error took longer to converge\n");
+    printf("  -E ppm          fail if the computed drift is off by more\n");
+    printf("  -v              verbose, repeat for more\n");
+    printf("       %s -x name=v1,v2,... [-x ...] [options]  parameter sweep\n", name);
+    printf("  -x name=values  NTP tuning values to sweep: samples, adjustments, threshold, min, max,\n");
+    printf("                  sample_interval, unreach_last, unreach, requests, peers, discipline,\n");
+    printf("                  kalman_noise\n");
+    printf("  -N count        deployments per parameter set (default 100)\n");
+    printf("  -w workers      worker processes (default one per core)\n");
+    printf("  -r ppm          deployment drift is random in +/- ppm (default 10)\n");
+    printf("  -A ppm          amplitude of a yearly drift variation (default 0)\n");
+    printf("  -i ms           deployment initial RTC error is random in +/- ms (default 2000)\n");
+}
+
+int main(int argc, char**argv)
+{
+    bool      simulation = false;
+    double    days       = 365.0;
+    double    initial    = 0.0;
+    double    ppm        = 2.0;
+    double    delay      = 10.0;
+    double    jitter     = 5.0;
+    SimJitter dist       = SIM_JITTER_EXPONENTIAL;
+    double    loss       = 0.0;
+    uint64_t  seed       = 1;
+    double    threshold  = 50.0;
+    double    max_rms    = 0.0;
+    double    max_converge = 0.0;
+    double    max_drift  = 0.0;
+    int       verbose    = 0;
+    const char* profile  = NULL;
+    int       servers    = 1;
+    int       falsetickers = 0;
+    double    false_offset = 100.0;
+    int       peers      = 0;
+    bool      kalman     = false;
+    double    swing      = 0.0;
+    double    coefficient = 0.034;
+    bool      trim       = false;
+    double    power_loss = 0.0;
+    double    rtc_stop   = 0.0;
+    double    osc_stop   = 0.0;
+    bool      sweeping   = false;
+    SweepConfig config;
+    sweepInit(&config);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "sd:I:p:P:D:J:j:L:S:n:f:F:m:KT:C:aO:X:Y:t:R:c:E:vx:N:w:r:A:i:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': simulation = true;                            break;
+        case 'd': days       = atof(optarg);                    break;
+        case 'I': initial    = atof(optarg);                    break;
+        case 'p': ppm        = atof(optarg);                    break;
+        case 'P': profile    = optarg;                          break;
+        case 'D': delay      = atof(optarg);                    break;
+        case 'J': jitter     = atof(optarg);                    break;
+        case 'L': loss       = atof(optarg);                    break;
+        case 'S': seed       = strtoull(optarg, NULL, 0);       break;
+        case 'n': servers    = atoi(optarg);                    break;
+        case 'f': falsetickers = atoi(optarg);                  break;
+        case 'F': false_offset = atof(optarg);                  break;
+        case 'm': peers      = atoi(optarg);                    break;
+        case 'K': kalman     = true;                            break;
+        case 'T': swing      = atof(optarg);                    break;
+        case 'C': coefficient = atof(optarg);                   break;
+        case 'a': trim       = true;                            break;
+        case 'O': power_loss = atof(optarg);                    break;
+        case 'X': rtc_stop   = atof(optarg);                    break;
+        case 'Y': osc_stop   = atof(optarg);                    break;
+        case 't': threshold  = atof(optarg);                    break;
+        case 'R': max_rms    = atof(optarg);                    break;
+        case 'c': max_converge = atof(optarg);                  break;
+        case 'E': max_drift  = atof(optarg);                    break;
+        case 'v': verbose   += 1;                               break;
+        case 'N': config.deployments = atoi(optarg); sweeping = true; break;
+        case 'w': config.workers     = atoi(optarg);            break;
+        case 'r': config.ppm_range   = atof(optarg);            break;
+        case 'A': config.amplitude   = atof(optarg);            break;
+        case 'i': config.initial     = atof(optarg) / 1000.0;   break;
+        case 'x':
+            if (sweepAddParam(&config, optarg))
+            {
+                return 2;
+            }
+            sweeping = true;
+            break;
+        case 'j':
+            if (!strcmp(optarg, "uniform"))     dist = SIM_JITTER_UNIFORM;
+            else if (!strcmp(optarg, "normal")) dist = SIM_JITTER_NORMAL;
+            else if (!strcmp(optarg, "exp"))    dist = SIM_JITTER_EXPONENTIAL;
+            else
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!simulation && !sweeping)
+    {
+        const char *server = "192.168.0.31";
+        if (optind < argc)
+        {
+            server = argv[optind];
+        }
+        return run(server);
+    }
+
+    static const DLogLevel levels[] = { DLOG_LEVEL_NONE, DLOG_LEVEL_WARNING, DLOG_LEVEL_INFO, DLOG_LEVEL_DEBUG };
+    dlog.setLevel(levels[verbose < 3 ? verbose : 3]);
+
+    if (sweeping)
+    {
+        if (config.deployments < 1)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        config.days      = days;
+        config.threshold = threshold / 1000.0;
+        config.seed      = seed;
+        config.delay     = delay / 1000.0;
+        config.jitter    = jitter / 1000.0;
+        config.dist      = dist;
+        config.loss      = loss / 100.0;
+        config.servers      = servers;
+        config.falsetickers = falsetickers;
+        config.false_offset = false_offset / 1000.0;
+        config.trim         = trim;
+        if (peers > 0)
+        {
+            char spec[SWEEP_NAME_LENGTH];
+            snprintf(spec, sizeof(spec), "peers=%d", peers);
+            if (sweepAddParam(&config, spec))
+            {
+                return 2;
+            }
+        }
+        if (kalman && sweepAddParam(&config, "discipline=1"))
+        {
+            return 2;
+        }
+        return sweep(&config) ? 1 : 0;
+    }
+
+    sim.begin(seed);
+    sim.setNetwork(delay / 1000.0, jitter / 1000.0, dist, loss / 100.0);
+    if (sim.setServers(servers, falsetickers, false_offset / 1000.0))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (profile != NULL)
+    {
+        if (parseProfile(profile))
+        {
+            printf("invalid drift profile: '%s'\n", profile);
+            return 2;
+        }
+    }
+    else
+    {
+        sim.addDriftPoint(0.0, ppm);
+    }
+    if (swing > 0.0)
+    {
+        sim.setTemperature(swing, coefficient);
+    }
+    sim.setPowerLoss(power_loss, rtc_stop);
+    sim.setOscillatorStop(osc_stop);
+    sim.adjustRTC(initial / 1000.0);
+
+    NTPTuning tuning;
+    NTP::getDefaultTuning(&tuning);
+    if (peers > 0)
+    {
+        tuning.peer_count = peers;
+    }
+    if (kalman)
+    {
+        tuning.discipline = NTP_DISCIPLINE_KALMAN;
+    }
+
+    SimResult result;
+    simulate(days, threshold / 1000.0, &tuning, trim, &result);
+
+    printf("days: %0.1f wakes: %u outages: %u polls: %u skipped: %u drifts: %u saves: %u rms: %0.3fms max: %0.3fms converged: %0.2f days drift: %0.3fppm (true: %0.3fppm) drift converged: %0.2f days aging: %d\n",
+            result.days, result.wakes, result.outages, result.polls, result.skipped, result.drifts, result.saves, result.rms * 1000.0, result.max * 1000.0,
+            result.converged, result.drift, result.true_drift, result.drift_converged, result.aging);
+
+    int rc = 0;
+    if (result.converged < 0.0)
+    {
+        printf("FAILED: RTC error did not converge below %0.1fms\n", threshold);
+        rc = 1;
+    }
+    if (max_converge > 0.0 && result.converged > max_converge)
+    {
+        printf("FAILED: converged after %0.2f days > %0.2f days\n", result.converged, max_converge);
+        rc = 1;
+    }
+    if (max_rms > 0.0 && result.rms * 1000.0 > max_rms)
+    {
+        printf("FAILED: RMS error %0.3fms > %0.3fms\n", result.rms * 1000.0, max_rms);
+        rc = 1;
+    }
+    if (max_drift > 0.0 && fabs(result.drift - result.true_drift) > max_drift)
+    {
+        printf("FAILED: drift error %0.3fppm > %0.3fppm\n", fabs(result.drift - result.true_drift), max_drift);
+        rc = 1;
+    }
+    return rc;
 }
@@ -0,0 +1,41 @@
+/*
+ * NTPTest.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef NTPTEST_H_
+#define NTPTEST_H_
+#include "NTP.h"
+
+#define SIM_DRIFT_TOLERANCE 0.5     // ppm the computed drift must stay within to have converged
+
+//
+// Results of a simulation run
+//
+typedef struct sim_result
+{
+    double   days;          // simulated days
+    uint32_t wakes;         // number of times we woke up
+    uint32_t outages;       // number of times the power was lost
+    uint32_t polls;         // number of NTP polls (radio on)
+    uint32_t skipped;       // polls that did not adjust the RTC (failed, filtered or below threshold)
+    uint32_t drifts;        // wakes that adjusted the RTC for drift
+    uint32_t saves;         // times the persisted data was saved (an EEPROM commit in SynchroClock)
+    double   rms;           // RMS of the RTC error sampled at each wake (seconds)
+    double   max;           // max absolute RTC error (seconds)
+    double   converged;     // days till the RTC error stays below the threshold, -1 if never
+    double   drift_converged; // days till the computed drift stays within SIM_DRIFT_TOLERANCE, -1 if never
+    double   drift;         // final computed drift (ppm)
+    double   true_drift;    // final drift from the profile (ppm)
+    int      aging;         // final RTC aging offset
+} SimResult;
+
+//
+// Run one simulated deployment, sim must already be set up.  tuning may be NULL for the defaults.
+// With trim the RTC aging offset is trimmed after each poll like USE_AGING_TRIM in SynchroClock.
+//
+void simulate(double days, double threshold, const NTPTuning* tuning, bool trim, SimResult* result);
+
+#endif /* NTPTEST_H_ */
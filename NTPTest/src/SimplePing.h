@@ -0,0 +1,22 @@
+/*
+ * SimplePing.h
+ *
+ *  Created on: Jul 7, 2017
+ *      Author: chris.l
+ */
+
+#ifndef _SIMPLE_PING_H_
+#define _SIMPLE_PING_H_
+#include "Arduino.h"
+
+//
+// There is no ARP cache to warm up here so this does nothing.
+//
+class SimplePing
+{
+public:
+    SimplePing() {}
+    void ping(IPAddress address) { (void)address; }
+};
+
+#endif /* _SIMPLE_PING_H_ */
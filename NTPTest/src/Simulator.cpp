@@ -0,0 +1,458 @@
+/*
+ * Simulator.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "Simulator.h"
+#include "NTP.h"
+#include "NTPPrivate.h"
+#include "Logger.h"
+#include <math.h>
+
+static const char TAG[] = "Simulator";
+
+Simulator::Simulator()
+{
+    _active    = false;
+    _seed      = 1;
+    _now       = 0;
+    _rtc_error = 0.0;
+    _ndrift    = 0;
+    _delay     = 0.010;
+    _jitter    = 0.005;
+    _dist      = SIM_JITTER_EXPONENTIAL;
+    _loss      = 0.0;
+    _nreplies  = 0;
+    _swing       = 0.0;
+    _coefficient = 0.0;
+    _aging       = 0;
+    _power_interval = 0.0;
+    _power_next  = 0.0;
+    _stop_day    = 0.0;
+    _osc_day     = 0.0;
+    _osf         = false;
+    setServers(1, 0, 0.0);
+}
+
+void Simulator::begin(uint64_t seed)
+{
+    _active    = true;
+    _seed      = seed ? seed : 1; // xorshift needs a non-zero state
+    _now       = 0;
+    _rtc_error = 0.0;
+    _ndrift    = 0;
+    _nreplies  = 0;
+    _next_server = 0;
+    _aging     = 0;
+    _power_interval = 0.0;
+    _power_next = 0.0;
+    _stop_day  = 0.0;
+    _osc_day   = 0.0;
+    _osf       = false;
+}
+
+bool Simulator::isActive()
+{
+    return _active;
+}
+
+uint64_t Simulator::getMicros()
+{
+    return _now;
+}
+
+uint32_t Simulator::getMillis()
+{
+    return (uint32_t)(_now / 1000);
+}
+
+double Simulator::getTrueTime()
+{
+    return (double)SIM_START_TIME + (double)_now / 1000000.0;
+}
+
+double Simulator::getRTCTime()
+{
+    return getTrueTime() + _rtc_error;
+}
+
+double Simulator::getRTCError()
+{
+    return _rtc_error;
+}
+
+double Simulator::getDays()
+{
+    return (double)_now / 1000000.0 / 86400.0;
+}
+
+//
+// advance true time, the RTC drifts by the profile drift (in steps so that a changing profile is followed)
+//
+void Simulator::advance(double seconds)
+{
+    while (seconds > 0.0)
+    {
+        double step = seconds > SIM_DRIFT_STEP ? SIM_DRIFT_STEP : seconds;
+        double ppm  = getDrift();
+        uint64_t us = (uint64_t)ceil(step * 1000000.0);
+        _now       += us;
+        _rtc_error -= ppm * ((double)us / 1000000.0) / 1000000.0;
+        seconds    -= step;
+    }
+}
+
+//
+// advance to the next second boundary of the RTC, just like waiting for the falling edge of the 1hz signal.
+//
+int Simulator::waitForEdge(uint32_t* rtc_seconds)
+{
+    double   rtc  = getRTCTime();
+    uint32_t next = (uint32_t)floor(rtc) + 1;
+    advance((double)next - rtc);
+    *rtc_seconds = next;
+    return 0;
+}
+
+void Simulator::adjustRTC(double offset)
+{
+    dlog.debug(TAG, "::adjustRTC: offset: %0.6f error: %0.6f", offset, _rtc_error);
+    _rtc_error += offset;
+}
+
+int Simulator::addDriftPoint(double day, double ppm)
+{
+    if (_ndrift >= SIM_DRIFT_POINTS || (_ndrift > 0 && day <= _drift[_ndrift-1].day))
+    {
+        dlog.error(TAG, "::addDriftPoint: invalid point day: %f ppm: %f", day, ppm);
+        return -1;
+    }
+    _drift[_ndrift].day = day;
+    _drift[_ndrift].ppm = ppm;
+    _ndrift += 1;
+    return 0;
+}
+
+//
+// drift at the current time, linear between profile points and constant before the first and after the last.
+// A crystal runs slower away from its turnover temperature so the temperature drift is always positive.
+//
+double Simulator::getDrift()
+{
+    double ppm = 0.0;
+    double day = getDays();
+    if (_ndrift == 0)
+    {
+        ppm = 0.0;
+    }
+    else if (day <= _drift[0].day)
+    {
+        ppm = _drift[0].ppm;
+    }
+    else
+    {
+        ppm = _drift[_ndrift-1].ppm;
+        for (int i = 1; i < _ndrift; ++i)
+        {
+            if (day < _drift[i].day)
+            {
+                double f = (day - _drift[i-1].day) / (_drift[i].day - _drift[i-1].day);
+                ppm = _drift[i-1].ppm + f * (_drift[i].ppm - _drift[i-1].ppm);
+                break;
+            }
+        }
+    }
+
+    double t = SIM_TEMP_MEAN + _swing * sin(2.0 * M_PI * day) - SIM_TEMP_TURNOVER;
+    return ppm + _coefficient * t * t + _aging * SIM_AGING_PPM;
+}
+
+void Simulator::setTemperature(double swing, double coefficient)
+{
+    _swing       = swing;
+    _coefficient = coefficient;
+}
+
+int8_t Simulator::getAging()
+{
+    return _aging;
+}
+
+void Simulator::setAging(int8_t aging)
+{
+    dlog.debug(TAG, "::setAging: %d", aging);
+    _aging = aging;
+}
+
+//
+// temperature now with the resolution of the DS3231, the daily cycle is a sine wave.
+//
+double Simulator::getTemperature()
+{
+    double t = SIM_TEMP_MEAN + _swing * sin(2.0 * M_PI * getDays());
+    return floor(t / SIM_TEMP_LSB) * SIM_TEMP_LSB;
+}
+
+void Simulator::setPowerLoss(double interval, double stop_day)
+{
+    _power_interval = interval;
+    _power_next     = interval;
+    _stop_day       = stop_day;
+}
+
+//
+// true if the power was lost since the last wake, the outage has already passed.  The RTC keeps
+// time on its battery unless this is the outage that stops the oscillator.
+//
+bool Simulator::powerLost()
+{
+    double day  = getDays();
+    bool   stop = _stop_day > 0.0 && day >= _stop_day;
+    if (!stop && (_power_interval <= 0.0 || day < _power_next))
+    {
+        return false;
+    }
+
+    if (stop)
+    {
+        dlog.info(TAG, "::powerLost: RTC oscillator stopped! day: %f", day);
+        _stop_day   = 0.0;
+        _osf        = true;
+        _rtc_error -= SIM_OUTAGE;
+    }
+    else
+    {
+        dlog.info(TAG, "::powerLost: day: %f", day);
+        _power_next += _power_interval;
+    }
+    advance(SIM_OUTAGE);
+    return true;
+}
+
+void Simulator::setOscillatorStop(double day)
+{
+    _osc_day = day;
+}
+
+//
+// true if the RTC oscillator stopped for SIM_OUTAGE since the last wake while the ESP kept its power,
+// the RTC is behind by the outage.
+//
+bool Simulator::oscillatorStopped()
+{
+    if (_osc_day <= 0.0 || getDays() < _osc_day)
+    {
+        return false;
+    }
+
+    dlog.info(TAG, "::oscillatorStopped: day: %f", getDays());
+    _osc_day    = 0.0;
+    _osf        = true;
+    _rtc_error -= SIM_OUTAGE;
+    return true;
+}
+
+bool Simulator::getOSF()
+{
+    return _osf;
+}
+
+void Simulator::clearOSF()
+{
+    _osf = false;
+}
+
+void Simulator::setNetwork(double delay, double jitter, SimJitter dist, double loss)
+{
+    _delay  = delay;
+    _jitter = jitter;
+    _dist   = dist;
+    _loss   = loss;
+}
+
+//
+// Setup the pool with count servers, the first falsetickers of them are off from true time by
+// offset, 2*offset, ... so that they don't agree with each other.
+//
+int Simulator::setServers(int count, int falsetickers, double offset)
+{
+    if (count < 1 || count > SIM_MAX_SERVERS || falsetickers < 0 || falsetickers > count)
+    {
+        dlog.error(TAG, "::setServers: invalid count: %d falsetickers: %d", count, falsetickers);
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        _servers[i].ip     = SIM_SERVER_ADDRESS + ((uint32_t)i << 24);
+        _servers[i].offset = i < falsetickers ? offset * (i + 1) : 0.0;
+    }
+    _nservers    = count;
+    _next_server = 0;
+    return 0;
+}
+
+//
+// rotate through the pool like a round robin DNS.
+//
+uint32_t Simulator::getServerAddress()
+{
+    uint32_t ip = _servers[_next_server].ip;
+    _next_server = (_next_server + 1) % _nservers;
+    return ip;
+}
+
+//
+// The server has the true time (plus its offset).  The reply is queued to "arrive" after a random
+// delay in each direction.
+//
+int Simulator::send(uint32_t ip, const void* buffer, size_t size)
+{
+    if (size != sizeof(NTPPacket))
+    {
+        dlog.error(TAG, "::send: bad request size: %u", (unsigned int)size);
+        return -1;
+    }
+
+    const SimServer* server = NULL;
+    for (int i = 0; i < _nservers; ++i)
+    {
+        if (_servers[i].ip == ip)
+        {
+            server = &_servers[i];
+            break;
+        }
+    }
+
+    if (server == NULL)
+    {
+        dlog.debug(TAG, "::send: no server at 0x%08x", ip);
+        return size;
+    }
+
+    if (random() < _loss)
+    {
+        dlog.debug(TAG, "::send: request lost!");
+        return size;
+    }
+
+    if (_nreplies >= SIM_MAX_REPLIES)
+    {
+        // drop the oldest
+        memmove(&_replies[0], &_replies[1], sizeof(SimReply) * (SIM_MAX_REPLIES-1));
+        _nreplies -= 1;
+    }
+
+    const NTPPacket* request = (const NTPPacket*)buffer;
+    NTPPacket reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.flags     = setLI(LI_NONE) | setVERS(NTP_VERSION) | setMODE(MODE_SERVER);
+    reply.stratum   = 2;
+    reply.poll      = request->poll;
+    reply.precision = -20;
+    reply.orig_time = request->xmit_time; // already in network byte order
+
+    double recv_time = getTrueTime() + sampleDelay();
+    double xmit_time = recv_time + 0.00005;
+    toNTPTime(recv_time + server->offset - 60.0, (uint8_t*)&reply.ref_time);
+    toNTPTime(recv_time + server->offset, (uint8_t*)&reply.recv_time);
+    toNTPTime(xmit_time + server->offset, (uint8_t*)&reply.xmit_time);
+
+    double arrival = xmit_time + sampleDelay();
+    _replies[_nreplies].arrival = (uint64_t)((arrival - (double)SIM_START_TIME) * 1000000.0);
+    _replies[_nreplies].ip      = ip;
+    memcpy(_replies[_nreplies].data, &reply, sizeof(reply));
+
+    if (random() < _loss)
+    {
+        dlog.debug(TAG, "::send: reply lost!");
+        return size;
+    }
+
+    _nreplies += 1;
+    return size;
+}
+
+//
+// wait for the next reply to arrive or the timeout to expire.
+//
+int Simulator::recv(void* buffer, size_t size, uint32_t* ip, unsigned int timeout_ms)
+{
+    uint64_t deadline = _now + (uint64_t)timeout_ms * 1000;
+    int next = -1;
+    for (int i = 0; i < _nreplies; ++i)
+    {
+        if (next < 0 || _replies[i].arrival < _replies[next].arrival)
+        {
+            next = i;
+        }
+    }
+
+    if (next < 0 || _replies[next].arrival > deadline)
+    {
+        advance((double)(deadline - _now) / 1000000.0);
+        dlog.debug(TAG, "::recv: timeout!");
+        return 0;
+    }
+
+    if (_replies[next].arrival > _now)
+    {
+        advance((double)(_replies[next].arrival - _now) / 1000000.0);
+    }
+
+    size_t n = size < sizeof(_replies[next].data) ? size : sizeof(_replies[next].data);
+    memcpy(buffer, _replies[next].data, n);
+    if (ip != NULL)
+    {
+        *ip = _replies[next].ip;
+    }
+    memmove(&_replies[next], &_replies[next+1], sizeof(SimReply) * (_nreplies - next - 1));
+    _nreplies -= 1;
+    return n;
+}
+
+//
+// xorshift64* - we want the same sequence on every platform so we don't use the C++ library generators.
+//
+double Simulator::random()
+{
+    _seed ^= _seed >> 12;
+    _seed ^= _seed << 25;
+    _seed ^= _seed >> 27;
+    return (double)((_seed * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+double Simulator::sampleDelay()
+{
+    double jitter = 0.0;
+    switch (_dist)
+    {
+    case SIM_JITTER_UNIFORM:
+        jitter = _jitter * random();
+        break;
+    case SIM_JITTER_NORMAL:
+        // half normal (Box-Muller), delays can't be negative.
+        jitter = fabs(_jitter * sqrt(-2.0 * log(1.0 - random())) * cos(2.0 * M_PI * random()));
+        break;
+    case SIM_JITTER_EXPONENTIAL:
+        jitter = -_jitter * log(1.0 - random());
+        break;
+    }
+    return _delay + jitter;
+}
+
+//
+// convert unix time in seconds to an NTP timestamp in network byte order
+//
+void Simulator::toNTPTime(double t, uint8_t* p)
+{
+    NTPTime ntp;
+    double seconds = floor(t);
+    ntp.seconds  = htonl(toNTP((uint32_t)seconds));
+    ntp.fraction = htonl((uint32_t)((t - seconds) * 4294967296.0));
+    memcpy(p, &ntp, sizeof(ntp));
+}
+
+Simulator sim;
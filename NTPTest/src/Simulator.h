@@ -0,0 +1,143 @@
+/*
+ * Simulator.h
+ *
+ * Virtual time simulation of the RTC, the network and an NTP server so that
+ * the NTP class can be run through months of polls in a few seconds with
+ * repeatable results.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+#include "Arduino.h"
+
+#define SIM_START_TIME      1577836800  // Jan 1 2020 00:00:00 UTC, start of simulated time
+#define SIM_DRIFT_POINTS    32          // max points in a scripted drift profile
+#define SIM_MAX_REPLIES     16          // max replies "in flight"
+#define SIM_DRIFT_STEP      60.0        // max seconds to advance at a time when applying drift
+#define SIM_SERVER_ADDRESS  0x0100000a  // 10.0.0.1 in network byte order, servers are 10.0.0.1, 10.0.0.2, ...
+#define SIM_MAX_SERVERS     8           // max servers in the simulated pool
+#define SIM_EDGE_LATENCY    0.003       // seconds getTime() takes after the second edge
+#define SIM_TEMP_MEAN       15.0        // mean temperature (celsius) of the daily temperature cycle
+#define SIM_TEMP_TURNOVER   25.0        // temperature (celsius) the crystal has no temperature drift
+#define SIM_TEMP_LSB        0.25        // resolution of the DS3231 temperature
+#define SIM_AGING_PPM       0.11        // drift per aging offset LSB, not quite what NTP expects
+#define SIM_OUTAGE          3600.0      // seconds the power is out
+
+typedef enum
+{
+    SIM_JITTER_UNIFORM = 0,
+    SIM_JITTER_NORMAL,
+    SIM_JITTER_EXPONENTIAL
+} SimJitter;
+
+//
+// One point of the scripted drift profile, drift is interpolated between points.
+// ppm uses the same sign as NTP drift: positive means the RTC runs slow.
+//
+typedef struct sim_drift_point
+{
+    double day;
+    double ppm;
+} SimDriftPoint;
+
+//
+// A server in the simulated pool, a falseticker has a non zero offset from true time.
+//
+typedef struct sim_server
+{
+    uint32_t ip;
+    double   offset;    // server time - true time in seconds
+} SimServer;
+
+typedef struct sim_reply
+{
+    uint64_t arrival;   // true time in microseconds the reply arrives
+    uint32_t ip;        // server that sent the reply
+    uint8_t  data[48];  // reply packet in network byte order
+} SimReply;
+
+class Simulator
+{
+public:
+    Simulator();
+    void     begin(uint64_t seed);
+    bool     isActive();
+
+    // time
+    uint64_t getMicros();
+    uint32_t getMillis();
+    double   getTrueTime();
+    double   getRTCTime();
+    double   getRTCError();
+    double   getDays();
+    void     advance(double seconds);
+    int      waitForEdge(uint32_t* rtc_seconds);
+    void     adjustRTC(double offset);
+
+    // drift profile
+    int      addDriftPoint(double day, double ppm);
+    double   getDrift();
+
+    // temperature, the drift profile is at the turnover temperature
+    void     setTemperature(double swing, double coefficient);
+    double   getTemperature();
+
+    // RTC aging offset, positive values slow the oscillator
+    int8_t   getAging();
+    void     setAging(int8_t aging);
+
+    // power loss, the ESP loses its RTC memory every interval days and the RTC oscillator
+    // also stops (setting OSF) at stop_day
+    void     setPowerLoss(double interval, double stop_day);
+    bool     powerLost();
+    // the RTC oscillator alone stops (setting OSF) at day, the ESP keeps its RTC memory
+    void     setOscillatorStop(double day);
+    bool     oscillatorStopped();
+    bool     getOSF();
+    void     clearOSF();
+
+    // network & NTP server
+    void     setNetwork(double delay, double jitter, SimJitter dist, double loss);
+    int      setServers(int count, int falsetickers, double offset);
+    uint32_t getServerAddress();
+    int      send(uint32_t ip, const void* buffer, size_t size);
+    int      recv(void* buffer, size_t size, uint32_t* ip, unsigned int timeout_ms);
+
+    // uniform random number in [0, 1) from the seeded generator
+    double   random();
+
+private:
+    bool          _active;
+    uint64_t      _seed;
+    uint64_t      _now;         // true time in microseconds since SIM_START_TIME
+    double        _rtc_error;   // RTC time - true time in seconds
+    SimDriftPoint _drift[SIM_DRIFT_POINTS];
+    int           _ndrift;
+    double        _swing;       // amplitude (celsius) of the daily temperature cycle
+    double        _coefficient; // ppm per celsius squared away from the turnover temperature
+    int8_t        _aging;       // RTC aging offset
+    double        _power_interval; // days between power loss, 0 for none
+    double        _power_next;  // day of the next power loss
+    double        _stop_day;    // day the RTC oscillator stops, 0 for never
+    double        _osc_day;     // day the RTC oscillator stops without a power loss, 0 for never
+    bool          _osf;         // RTC oscillator stop flag
+    double        _delay;       // one way base network delay in seconds
+    double        _jitter;      // jitter scale in seconds
+    SimJitter     _dist;
+    double        _loss;        // probability of losing a request or reply
+    SimServer     _servers[SIM_MAX_SERVERS];
+    int           _nservers;
+    int           _next_server; // next address handed out by getServerAddress()
+    SimReply      _replies[SIM_MAX_REPLIES];
+    int           _nreplies;
+
+    double sampleDelay();
+    void   toNTPTime(double t, uint8_t* p);
+};
+
+extern Simulator sim;
+
+#endif /* SIMULATOR_H_ */
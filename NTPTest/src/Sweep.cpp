@@ -0,0 +1,302 @@
+/*
+ * Sweep.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "Sweep.h"
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static const char* const param_names[] =
+{
+    "samples",          // NTPTuning::sample_count
+    "adjustments",      // NTPTuning::adjustment_count
+    "threshold",        // NTPTuning::offset_threshold (seconds)
+    "min",              // NTPTuning::min_interval
+    "max",              // NTPTuning::max_interval
+    "sample_interval",  // NTPTuning::sample_interval
+    "unreach_last",     // NTPTuning::unreach_last_interval
+    "unreach",          // NTPTuning::unreach_interval
+    "requests",         // NTPTuning::request_count
+    "peers",            // NTPTuning::peer_count
+    "discipline",       // NTPTuning::discipline (0 least squares, 1 Kalman)
+    "kalman_noise",     // NTPTuning::kalman_noise (ppm per sqrt(day))
+};
+
+static int findParam(const char* name)
+{
+    for (unsigned int i = 0; i < sizeof(param_names)/sizeof(param_names[0]); ++i)
+    {
+        if (!strcmp(name, param_names[i]))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void applyParam(NTPTuning* tuning, const char* name, double value)
+{
+    switch (findParam(name))
+    {
+    case 0: tuning->sample_count          = (int)value;          break;
+    case 1: tuning->adjustment_count      = (int)value;          break;
+    case 2: tuning->offset_threshold      = value;               break;
+    case 3: tuning->min_interval          = (uint32_t)value;     break;
+    case 4: tuning->max_interval          = (uint32_t)value;     break;
+    case 5: tuning->sample_interval       = (uint32_t)value;     break;
+    case 6: tuning->unreach_last_interval = (uint32_t)value;     break;
+    case 7: tuning->unreach_interval      = (uint32_t)value;     break;
+    case 8: tuning->request_count         = (unsigned int)value; break;
+    case 9: tuning->peer_count            = (int)value;          break;
+    case 10: tuning->discipline           = (int)value;          break;
+    case 11: tuning->kalman_noise         = value;               break;
+    }
+}
+
+void sweepInit(SweepConfig* config)
+{
+    memset(config, 0, sizeof(SweepConfig));
+    config->days        = 365.0;
+    config->threshold   = 0.050;
+    config->deployments = 100;
+    config->seed        = 1;
+    config->ppm_range   = 10.0;
+    config->initial     = 2.0;
+    config->delay       = 0.010;
+    config->jitter      = 0.005;
+    config->dist        = SIM_JITTER_EXPONENTIAL;
+    config->servers     = 1;
+}
+
+int sweepAddParam(SweepConfig* config, const char* spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (eq == NULL || eq - spec >= SWEEP_NAME_LENGTH || config->nparams >= SWEEP_MAX_PARAMS)
+    {
+        fprintf(stderr, "sweepAddParam: invalid parameter: '%s'\n", spec);
+        return -1;
+    }
+
+    SweepParam* param = &config->params[config->nparams];
+    memset(param, 0, sizeof(SweepParam));
+    memcpy(param->name, spec, eq - spec);
+    if (findParam(param->name) < 0)
+    {
+        fprintf(stderr, "sweepAddParam: unknown parameter: '%s'\n", param->name);
+        return -1;
+    }
+
+    const char* p = eq + 1;
+    while (*p)
+    {
+        char* end;
+        double value = strtod(p, &end);
+        if (end == p || param->nvalues >= SWEEP_MAX_VALUES)
+        {
+            fprintf(stderr, "sweepAddParam: invalid values: '%s'\n", spec);
+            return -1;
+        }
+        param->values[param->nvalues++] = value;
+        p = end;
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+
+    if (param->nvalues == 0)
+    {
+        fprintf(stderr, "sweepAddParam: no values: '%s'\n", spec);
+        return -1;
+    }
+
+    config->nparams += 1;
+    return 0;
+}
+
+//
+// parameter set 'set' is an index into the grid with the first parameter varying fastest.
+//
+static void getTuning(const SweepConfig* config, int set, NTPTuning* tuning)
+{
+    NTP::getDefaultTuning(tuning);
+    for (int i = 0; i < config->nparams; ++i)
+    {
+        const SweepParam* param = &config->params[i];
+        applyParam(tuning, param->name, param->values[set % param->nvalues]);
+        set /= param->nvalues;
+    }
+}
+
+//
+// Each deployment gets its own drift, yearly variation and initial RTC error (the RTC is set
+// by hand) drawn from its seed.  The same deployments are used for every parameter set so
+// the sets can be compared directly.
+//
+static void setupDeployment(const SweepConfig* config, int deployment)
+{
+    sim.begin(config->seed + deployment);
+    sim.setNetwork(config->delay, config->jitter, config->dist, config->loss);
+    sim.setServers(config->servers, config->falsetickers, config->false_offset);
+
+    double base  = (sim.random() * 2.0 - 1.0) * config->ppm_range;
+    double phase = sim.random();
+    sim.adjustRTC((sim.random() * 2.0 - 1.0) * config->initial);
+    if (config->amplitude == 0.0)
+    {
+        sim.addDriftPoint(0.0, base);
+        return;
+    }
+
+    double step = config->days / (SIM_DRIFT_POINTS - 1);
+    for (int i = 0; i < SIM_DRIFT_POINTS; ++i)
+    {
+        double day = step * i;
+        sim.addDriftPoint(day, base + config->amplitude * sin(2.0 * M_PI * (day / 365.0 + phase)));
+    }
+}
+
+static void runJobs(const SweepConfig* config, int worker, int workers, int jobs, SimResult* results)
+{
+    for (int job = worker; job < jobs; job += workers)
+    {
+        NTPTuning tuning;
+        getTuning(config, job / config->deployments, &tuning);
+        setupDeployment(config, job % config->deployments);
+        simulate(config->days, config->threshold, &tuning, config->trim, &results[job]);
+    }
+}
+
+static void printResults(const SweepConfig* config, int sets, const SimResult* results)
+{
+    for (int i = 0; i < config->nparams; ++i)
+    {
+        printf("%-16s", config->params[i].name);
+    }
+    printf("%10s %10s %10s %12s %12s %8s %10s %10s\n",
+            "rms_ms", "worst_ms", "max_ms", "polls/day", "converge_d", "failed", "drift_err", "drift_d");
+
+    for (int set = 0; set < sets; ++set)
+    {
+        const SimResult* r = &results[set * config->deployments];
+        double rms       = 0.0;
+        double worst     = 0.0;
+        double max       = 0.0;
+        double polls     = 0.0;
+        double converge  = 0.0;
+        double drift_err = 0.0;
+        double drift_d   = 0.0;
+        int    converged = 0;
+        int    drifted   = 0;
+        for (int i = 0; i < config->deployments; ++i)
+        {
+            rms       += r[i].rms;
+            worst      = r[i].rms > worst ? r[i].rms : worst;
+            max        = r[i].max > max ? r[i].max : max;
+            polls     += r[i].polls / r[i].days;
+            drift_err += fabs(r[i].drift - r[i].true_drift);
+            if (r[i].converged >= 0.0)
+            {
+                converge  += r[i].converged;
+                converged += 1;
+            }
+            if (r[i].drift_converged >= 0.0)
+            {
+                drift_d += r[i].drift_converged;
+                drifted += 1;
+            }
+        }
+
+        int index = set;
+        for (int i = 0; i < config->nparams; ++i)
+        {
+            const SweepParam* param = &config->params[i];
+            printf("%-16g", param->values[index % param->nvalues]);
+            index /= param->nvalues;
+        }
+        printf("%10.3f %10.3f %10.3f %12.2f %12.2f %8d %10.3f %10.2f\n",
+                rms / config->deployments * 1000.0,
+                worst * 1000.0,
+                max * 1000.0,
+                polls / config->deployments,
+                converged ? converge / converged : -1.0,
+                config->deployments - converged,
+                drift_err / config->deployments,
+                drifted ? drift_d / drifted : -1.0);
+    }
+}
+
+int sweep(const SweepConfig* config)
+{
+    int sets = 1;
+    for (int i = 0; i < config->nparams; ++i)
+    {
+        sets *= config->params[i].nvalues;
+    }
+    int jobs    = sets * config->deployments;
+    int workers = config->workers > 0 ? config->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > jobs)
+    {
+        workers = jobs;
+    }
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    printf("sweep: %d parameter sets x %d deployments, %0.0f days each, %d workers\n",
+            sets, config->deployments, config->days, workers);
+    fflush(stdout);
+
+    // results are written directly by the workers
+    size_t size = sizeof(SimResult) * jobs;
+    SimResult* results = (SimResult*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        fprintf(stderr, "sweep: mmap of %u bytes failed!\n", (unsigned int)size);
+        return -1;
+    }
+
+    int failed = 0;
+    for (int worker = 0; worker < workers; ++worker)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            runJobs(config, worker, workers, jobs, results);
+            _exit(0);
+        }
+        if (pid < 0)
+        {
+            fprintf(stderr, "sweep: fork failed!\n");
+            failed = 1;
+            break;
+        }
+    }
+
+    int status;
+    while (wait(&status) > 0)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            failed = 1;
+        }
+    }
+
+    if (failed)
+    {
+        fprintf(stderr, "sweep: a worker failed!\n");
+        munmap(results, size);
+        return -1;
+    }
+
+    printResults(config, sets, results);
+    munmap(results, size);
+    return 0;
+}
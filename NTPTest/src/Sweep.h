@@ -0,0 +1,55 @@
+/*
+ * Sweep.h
+ *
+ * Run the simulation over a grid of NTP tuning values, each set of values is run against
+ * the same randomly drawn deployments (drift, seasonal variation) using all cores.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef SWEEP_H_
+#define SWEEP_H_
+#include "NTPTest.h"
+#include "Simulator.h"
+
+#define SWEEP_MAX_PARAMS    12  // one for each NTPTuning field
+#define SWEEP_MAX_VALUES    16  // max values per parameter
+#define SWEEP_NAME_LENGTH   24  // max length+1 of a parameter name
+
+typedef struct sweep_param
+{
+    char        name[SWEEP_NAME_LENGTH];
+    double      values[SWEEP_MAX_VALUES];
+    int         nvalues;
+} SweepParam;
+
+typedef struct sweep_config
+{
+    double      days;           // days to simulate each deployment
+    double      threshold;      // convergence threshold (seconds)
+    int         deployments;    // deployments per parameter set
+    int         workers;        // worker processes, 0 for one per core
+    uint64_t    seed;           // seed of the first deployment
+    double      ppm_range;      // deployment drift is uniform in +/- ppm_range
+    double      amplitude;      // amplitude (ppm) of a yearly drift variation
+    double      initial;        // deployment initial RTC error (seconds) is uniform in +/- initial
+    double      delay;          // network settings (seconds), see Simulator::setNetwork()
+    double      jitter;
+    SimJitter   dist;
+    double      loss;
+    int         servers;        // servers in the pool, see Simulator::setServers()
+    int         falsetickers;
+    double      false_offset;
+    bool        trim;           // trim the RTC aging offset, see simulate()
+    SweepParam  params[SWEEP_MAX_PARAMS];
+    int         nparams;
+} SweepConfig;
+
+void sweepInit(SweepConfig* config);
+// parse "name=value[,value...]", returns 0 on success
+int  sweepAddParam(SweepConfig* config, const char* spec);
+// run the sweep and print the results, returns 0 on success
+int  sweep(const SweepConfig* config);
+
+#endif /* SWEEP_H_ */
@@ -8,6 +8,7 @@
 #include "Timer.h"
 #include <sys/time.h>
 #include "Logger.h"
+#include "Simulator.h"
 
 uint32_t Timer::_epoch = 0;
 
@@ -18,18 +19,40 @@ Timer::Timer()
 
 uint32_t Timer::getMillis()
 {
+    if (sim.isActive())
+    {
+        return sim.getMillis();
+    }
+
     struct timeval tp;
     gettimeofday(&tp, NULL);
     if (_epoch == 0)
     {
         _epoch = tp.tv_sec;
     }
-    //dbprintf("getMillis() %u:%u\n", tp.tv_sec, tp.tv_usec);
 
     uint32_t ms = (tp.tv_sec-_epoch) * 1000 + tp.tv_usec / 1000;
     return ms;
 }
 
+uint32_t Timer::getMicros()
+{
+    if (sim.isActive())
+    {
+        return (uint32_t)sim.getMicros();
+    }
+
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    if (_epoch == 0)
+    {
+        _epoch = tp.tv_sec;
+    }
+
+    uint32_t us = (tp.tv_sec-_epoch) * 1000000 + tp.tv_usec;
+    return us;
+}
+
 void Timer::start() {
     _start = getMillis();
 }
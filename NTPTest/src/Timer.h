@@ -15,6 +15,7 @@ public:
     Timer();
 
     static uint32_t getMillis();
+    static uint32_t getMicros();
     void            start();
     uint32_t        stop();
 
@@ -8,15 +8,7 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
-
-
-//typedef char int8_t;
-typedef unsigned char uint8_t;
-typedef short int16_t;
-typedef unsigned short uint16_t;
-typedef int int32_t;
-typedef unsigned int uint32_t;
-//typedef long int64_t;
-//typedef unsigned long uint64_t;
+#include <stdint.h>
+#include <stddef.h>
 
 #endif /* TYPES_H_ */
@@ -8,15 +8,20 @@
 #include "UDPWrapper.h"
 
 #include "Logger.h"
+#include "Simulator.h"
 #include <unistd.h>
 #include <poll.h>
 #include <stdio.h>
 #include <errno.h>
 
+static const char TAG[] = "UDPWrapper";
+
 UDPWrapper::UDPWrapper()
 {
     _sockfd       = -1;
     _local_port   = -1;
+    _connected    = false;
+    _address      = 0;
 }
 
 UDPWrapper::~UDPWrapper()
@@ -36,15 +41,23 @@ int UDPWrapper::open(IPAddress address, uint16_t port)
 
     if (_local_port == -1)
     {
-       dbprintln("UDP::open: begin() not called!");
+       dlog.error(TAG, "::open: begin() not called!");
        return -1;
     }
 
+    _address = address;
+    if (sim.isActive())
+    {
+        return 0;
+    }
+
+    close(); // NTP opens for every request
+
     _sockfd = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP ); // Create a UDP socket.
 
     if ( _sockfd < 0 )
     {
-        dbprintln("socket() failed!");
+        dlog.error(TAG, "::open: socket() failed!");
         return -1;
     }
 
@@ -64,26 +77,37 @@ int UDPWrapper::open(IPAddress address, uint16_t port)
 
     if ( connect( _sockfd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr) ) < 0 )
     {
-        dbprintf("connect() failed: %s\n", strerror(errno));
+        dlog.error(TAG, "::open: connect() failed: %s", strerror(errno));
         return -1;
     }
 
+    _connected = true;
     return 0;
 }
 
 int UDPWrapper::send(void* buffer, size_t size)
 {
+    if (sim.isActive())
+    {
+        return sim.send(_address, buffer, size);
+    }
+
     int n = ::write( _sockfd, ( char* ) buffer, size );
 
     if ( n < 0 )
     {
-        dbprintf("write failed!  expected %d got %d\n", size, n);
+        dlog.error(TAG, "::send: write failed!  expected %u got %d", (unsigned int)size, n);
     }
     return n;
 }
 
 int UDPWrapper::recv(void* buffer, size_t size, unsigned int timeout_ms)
 {
+    if (sim.isActive())
+    {
+        return sim.recv(buffer, size, NULL, timeout_ms);
+    }
+
     struct pollfd fd;
     int n;
 
@@ -93,7 +117,7 @@ int UDPWrapper::recv(void* buffer, size_t size, unsigned int timeout_ms)
 
     if (n == 0)
     {
-        dbprintln("UDP::recv timeout!");
+        dlog.error(TAG, "::recv: timeout!");
         return n;
     }
 
@@ -101,11 +125,88 @@ int UDPWrapper::recv(void* buffer, size_t size, unsigned int timeout_ms)
     return n;
 }
 
+//
+// a connected socket only talks to one address so sendTo() uses its own unconnected socket.
+//
+int UDPWrapper::sendTo(IPAddress address, uint16_t port, void* buffer, size_t size)
+{
+    if (sim.isActive())
+    {
+        return sim.send(address, buffer, size);
+    }
+
+    if (_sockfd == -1 || _connected)
+    {
+        close();
+        _sockfd = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+        if ( _sockfd < 0 )
+        {
+            dlog.error(TAG, "::sendTo: socket() failed!");
+            return -1;
+        }
+    }
+
+    struct sockaddr_in addr;
+    bzero( ( char* ) &addr, sizeof( addr ) );
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = address;
+    addr.sin_port        = htons(port);
+
+    int n = ::sendto( _sockfd, buffer, size, 0, ( struct sockaddr * ) &addr, sizeof( addr ) );
+    if ( n < 0 )
+    {
+        dlog.error(TAG, "::sendTo: sendto() failed: %s", strerror(errno));
+    }
+    return n;
+}
+
+int UDPWrapper::recvFrom(void* buffer, size_t size, IPAddress* address, unsigned int timeout_ms)
+{
+    if (sim.isActive())
+    {
+        uint32_t ip = 0;
+        int n = sim.recv(buffer, size, &ip, timeout_ms);
+        if (address != NULL)
+        {
+            *address = ip;
+        }
+        return n;
+    }
+
+    if (_sockfd == -1)
+    {
+        return -1;
+    }
+
+    struct pollfd fd;
+    int n;
+
+    fd.fd = _sockfd;
+    fd.events = POLLIN;
+    n = ::poll(&fd, 1, timeout_ms);
+
+    if (n == 0)
+    {
+        return n;
+    }
+
+    struct sockaddr_in from;
+    socklen_t len = sizeof(from);
+    n = ::recvfrom(_sockfd, buffer, size, 0, ( struct sockaddr * ) &from, &len);
+    if (n >= 0 && address != NULL)
+    {
+        *address = from.sin_addr.s_addr;
+    }
+    return n;
+}
+
 int UDPWrapper::close()
 {
     if (_sockfd != -1)
     {
         ::close(_sockfd);
+        _sockfd = -1;
+        _connected = false;
     }
     return 0;
 }
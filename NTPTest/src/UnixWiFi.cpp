@@ -8,6 +8,7 @@
 #include "UnixWiFi.h"
 #include <netinet/in.h>
 #include <netdb.h>
+#include "Simulator.h"
 
 UnixWiFi::UnixWiFi()
 {
@@ -17,6 +18,12 @@ UnixWiFi::UnixWiFi()
 
 int UnixWiFi::hostByName(const char* aHostname, IPAddress& aResult)
 {
+    if (sim.isActive())
+    {
+        aResult = sim.getServerAddress();
+        return 1;
+    }
+
     struct hostent *server;      // Server data structure.
     server = gethostbyname( aHostname ); // Convert URL to IP.
     if (server == NULL)
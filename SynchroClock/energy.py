@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+#
+# Compute energy per day from the "ENERGY" lines logged by a USE_ENERGY_TRACE
+# build (pio run -e energy).  Capture the serial or syslog output of a clock
+# for a day or more and run:
+#
+#   ./energy.py serial.log [other.log ...]
+#
+# Each log is one column so firmware versions can be compared.  Currents are
+# averages in mA, override them to match your measurements:
+#
+#   ./energy.py --on wifi=85 --off 18 --sleep-ua 25 serial.log
+#
+# Only the ESP8266 is modeled, add the rest of the board (ATtiny, DS3231,
+# regulator, clock movement) with --base-ua.
+#
+
+import argparse
+import re
+import sys
+
+PHASES = ["boot", "init", "drift", "wifi", "ota", "ntp", "clock", "sleep"]
+
+# average mA while awake with the radio on (RF_DEFAULT/RF_NO_CAL) per phase
+RADIO_ON_MA = {
+    "boot":  70.0,
+    "init":  70.0,
+    "drift": 70.0,
+    "wifi":  80.0,
+    "ota":   75.0,
+    "ntp":   75.0,
+    "clock": 70.0,
+    "sleep": 70.0,
+}
+
+RADIO_OFF_MA = 15.0   # awake with the radio off (RF_DISABLED)
+SLEEP_UA     = 20.0   # ESP8266 deep sleep
+
+ENERGY_RE = re.compile(r"ENERGY\s+(.*)$")
+
+
+def parse_log(path):
+    wakes = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = ENERGY_RE.search(line)
+            if not m:
+                continue
+            fields = dict(kv.split("=", 1) for kv in m.group(1).split() if "=" in kv)
+            try:
+                wake = {
+                    "radio": fields["rf"] == "on",
+                    "ms":    {p: int(fields.get(p, 0)) for p in PHASES},
+                    "next":  int(fields["next"]),
+                }
+            except (KeyError, ValueError):
+                print("%s: skipping bad line: %s" % (path, line.strip()), file=sys.stderr)
+                continue
+            wakes.append(wake)
+    return wakes
+
+
+def compute(wakes, on_ma, off_ma, sleep_ua, base_ua):
+    """returns seconds covered and a dict of mAs per phase (plus 'deep sleep' and 'base')"""
+    mas = {p: 0.0 for p in PHASES}
+    awake_s = 0.0
+    sleep_s = 0.0
+    for w in wakes:
+        for p in PHASES:
+            s = w["ms"][p] / 1000.0
+            awake_s += s
+            mas[p] += s * (on_ma[p] if w["radio"] else off_ma)
+        sleep_s += w["next"]
+    seconds = awake_s + sleep_s
+    mas["deep sleep"] = sleep_s * sleep_ua / 1000.0
+    mas["base"]       = seconds * base_ua / 1000.0
+    return seconds, awake_s, mas
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compute mAh/day from SynchroClock ENERGY log lines")
+    parser.add_argument("logs", nargs="+", help="log files captured from an energy build")
+    parser.add_argument("--on", action="append", default=[], metavar="PHASE=MA",
+                        help="average mA for a phase with the radio on")
+    parser.add_argument("--off", type=float, default=RADIO_OFF_MA, metavar="MA",
+                        help="average mA awake with the radio off (default %(default)s)")
+    parser.add_argument("--sleep-ua", type=float, default=SLEEP_UA,
+                        help="deep sleep uA (default %(default)s)")
+    parser.add_argument("--base-ua", type=float, default=0.0,
+                        help="constant uA for the rest of the board (default %(default)s)")
+    args = parser.parse_args()
+
+    on_ma = dict(RADIO_ON_MA)
+    for spec in args.on:
+        phase, _, value = spec.partition("=")
+        if phase not in on_ma:
+            parser.error("unknown phase '%s', one of: %s" % (phase, ", ".join(PHASES)))
+        on_ma[phase] = float(value)
+
+    results = []
+    for path in args.logs:
+        wakes = parse_log(path)
+        if not wakes:
+            print("%s: no ENERGY lines found!" % path, file=sys.stderr)
+            return 1
+        seconds, awake_s, mas = compute(wakes, on_ma, args.off, args.sleep_ua, args.base_ua)
+        days = seconds / 86400.0
+        results.append({
+            "name":    path,
+            "days":    days,
+            "wakes":   len(wakes) / days,
+            "radio":   sum(1 for w in wakes if w["radio"]) / days,
+            "awake":   awake_s / days,
+            "phases":  {k: v / 3600.0 / days for k, v in mas.items()},
+        })
+
+    width = max(12, max(len(r["name"]) for r in results) + 2)
+    def row(label, values, fmt):
+        print("%-14s" % label + "".join(("%" + str(width) + fmt) % v for v in values))
+
+    row("", [r["name"] for r in results], "s")
+    row("days", [r["days"] for r in results], ".2f")
+    row("wakes/day", [r["wakes"] for r in results], ".1f")
+    row("radio on/day", [r["radio"] for r in results], ".1f")
+    row("awake s/day", [r["awake"] for r in results], ".1f")
+    for key in PHASES + ["deep sleep", "base"]:
+        row(key + " mAh", [r["phases"][key] for r in results], ".3f")
+    row("total mAh/day", [sum(r["phases"].values()) for r in results], ".3f")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -35,17 +35,23 @@
 #include "Clock.h"
 #include "DS3231.h"
 #include "WireUtils.h"
+#include "I2CStats.h"
 #include "TimeUtils.h"
 #include "ConfigParam.h"
 #include "Logger.h"
 #include "DLogPrintWriter.h"
 #include "DLogSyslogWriter.h"
 #include "SynchroClockPins.h"
+#if defined(USE_ENERGY_TRACE)
+#include "EnergyTrace.h"
+#endif
 #include <memory>
 #include <vector>
 
 #define USE_DRIFT                     // apply drift
+#define USE_AGING_TRIM                // trim the RTC oscillator with its aging offset to remove the drift
 #define USE_NTP_POLL_ESTIMATE         // use ntp estimated drift for sleep duration calculation
+#define USE_CLOCK_FRAMES              // use CRC checked transfers with the clock controller (if its firmware has them)
 #define USE_STOP_THE_CLOCK            // if defined then stop the clock for small negative adjustments
 #define STOP_THE_CLOCK_MAX     60     // maximum difference where we will use stop the clock
 #define STOP_THE_CLOCK_EXTRA   2      // extra seconds to leave the clock stopped
@@ -57,8 +63,18 @@
 #define DEFAULT_SLEEP_DURATION 28800  // default is 8hrs when we are not using the poll estimate
 
 #define CLOCK_STRETCH_LIMIT    100000 // i2c clock stretch timeout in microseconds
+#define I2C_SPEED_UNIT         10000  // i2c speeds are kept in deep sleep data in 10kHz units
+#if defined(USE_CLOCK_FRAMES)
+#define CLOCK_RETRIES          1      // corrupted frames are already retried by Clock
+#define RECOVERY_SLEEP_DURATION 60    // seconds to sleep before starting over when the clock or RTC does not answer
+#else
+#define CLOCK_RETRIES          3      // blind retries of clock reads
+#endif
 #define MAX_SLEEP_DURATION     3600   // we do multiple sleep of this to handle bigger sleeps
+#define WAKE_POLL_SLACK        60     // poll NTP up to this many seconds early instead of another wake
 #define CONNECTION_TIMEOUT     30     // wifi connection timeout - we will deep sleep and try again later
+#define FAST_CONNECT_TIMEOUT   5000   // milliseconds to wait for a connect using the cached BSSID/channel/IP
+#define FAST_CONNECT_MAX_AGE   43200  // max seconds to reuse a DHCP address without renewing (half a typical 24h lease)
 #define CONFIG_DELAY           1000   // how long to hold the button for config mode - light comes on after this time.
 #define FACTORY_RESET_DELAY    10000  // how long to hold the button for factory reset after LED is ON - 10 seconds (10,000 milliseconds)
 
@@ -151,11 +167,32 @@ typedef struct ee_config
     uint8_t data[sizeof(Config)];
 } EEConfig;
 
+#define CONFIG_MIN_SIZE offsetof(Config, ntp_persist) // a config saved by older firmware has at least this much
+
+//
+// last connection details so that we can reconnect without a scan or DHCP
+//
+typedef struct wifi_cache
+{
+    uint8_t  bssid[6];                  // access point
+    uint8_t  channel;
+    uint8_t  valid;                     // true if the rest is valid
+    uint32_t ip;                        // addresses from DHCP
+    uint32_t gateway;
+    uint32_t netmask;
+    uint32_t dns;
+    uint32_t lease_time;                // RTC time we got the address from DHCP
+} WiFiCache;
+
 typedef struct deep_sleep_data
 {
     uint32_t sleep_delay_left;          // number seconds still to sleep
     NTPRunTime ntp_runtime;             // NTP runtime data
     bool run_update;                    // do update if true
+    uint8_t clock_speed;                // negotiated clock i2c speed in I2C_SPEED_UNIT, 0 if not negotiated
+    uint8_t rtc_speed;                  // negotiated RTC i2c speed in I2C_SPEED_UNIT, 0 if not negotiated
+    uint32_t next_poll;                 // RTC time the next NTP poll is due, 0 if unknown
+    WiFiCache wifi;                     // used for fast reconnect
 } DeepSleepData;
 
 typedef struct rtc_deep_sleep_data
@@ -164,8 +201,22 @@ typedef struct rtc_deep_sleep_data
     uint8_t data[sizeof(DeepSleepData)];
 } RTCDeepSleepData;
 
+static_assert(sizeof(RTCDeepSleepData) <= 512, "deep sleep data is larger than the 512 bytes of RTC user memory!");
+
+#if defined(USE_ENERGY_TRACE)
+#define ENERGY_TRACE_RTC_OFFSET ((sizeof(RTCDeepSleepData)+3)/4) // in 4 byte blocks, just after the deep sleep data
+#define ENERGY_MARK(phase)      energy.mark(phase)
+static_assert(ENERGY_TRACE_RTC_OFFSET*4 + sizeof(EnergyTraceData) <= 512, "no RTC user memory left for the energy trace!");
+#define I2C_STATS_RTC_OFFSET    (ENERGY_TRACE_RTC_OFFSET + (sizeof(EnergyTraceData)+3)/4) // after the energy trace
+#else
+#define ENERGY_MARK(phase)
+#define I2C_STATS_RTC_OFFSET    ((sizeof(RTCDeepSleepData)+3)/4) // just after the deep sleep data
+#endif
+static_assert(I2C_STATS_RTC_OFFSET*4 + sizeof(I2CStatsData) <= 512, "no RTC user memory left for the i2c stats!");
+
 typedef std::shared_ptr<ConfigParam> ConfigParamPtr;
 
+void logI2CStats();
 boolean parseBoolean(const char* value);
 uint8_t parseDuty(const char* value);
 int getValidOffset(String name);
@@ -183,17 +234,34 @@ void handleAPDuration();
 void handleAPDuty();
 void handleAPCount();
 void handleAPDelay();
+void handleAPFastDuration();
+void handleAPFastDelay();
+void handleAPRamp();
+void handleSense();
+void handleTune();
 void handleEnable();
 void handleRTC();
 void handleNTP();
 void handleSave();
+bool fastConnectWiFi();
+void saveWiFiCache();
 void sleepFor(uint32_t sleep_duration);
+#if defined(USE_CLOCK_FRAMES)
+void recoverySleep();
+#endif
+void sleepUntilPoll();
+bool wakeNeedsNetwork(bool dsd_valid, bool radio_off);
+int getRTCTime(uint32_t* now);
 int getEdgeSyncedTime(DS3231DateTime& dt, unsigned int retries);
 int setRTCfromOffset(double offset_ms, bool sync);
-int getTime(uint32_t *result);
+int getTime(uint32_t *result, uint32_t *edge);
 int setRTCfromDrift();
 int setRTCfromNTP(const char* server, bool sync, double* result_offset, IPAddress* result_address);
+int setRTCAging(int8_t aging);
+int trimRTCfromDrift();
 int setCLKfromRTC();
+uint32_t calculateCRC32(const uint8_t *data, size_t length);
+uint32_t updateCRC32(uint32_t crc, const uint8_t *data, size_t length);
 void saveConfig();
 boolean loadConfig();
 void eraseConfig();
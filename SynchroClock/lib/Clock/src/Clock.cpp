@@ -22,21 +22,44 @@
 
 #include "Clock.h"
 #include "WireUtils.h"
+#include "I2CStats.h"
 
 static PROGMEM const char TAG[] = "Clock";
 
+int               Clock::_edge_pin = -1;
+volatile uint32_t Clock::_edge_count;
+volatile uint32_t Clock::_edge_time[CLOCK_EDGE_COUNT];
+volatile uint8_t  Clock::_edge_level[CLOCK_EDGE_COUNT];
+
 Clock::Clock(int _pin)
 {
-    pin = _pin;
+    pin      = _pin;
+    _version = 0;
+    _framed  = false;
+    _seq     = 0;
+    _speed   = CLOCK_SPEED_MIN;
 }
 
 int Clock::begin()
 {
-	if (isClockPresent())
+    if (_edge_pin != pin)
+    {
+        _edge_pin = pin;
+        attachInterrupt(digitalPinToInterrupt(pin), edgeISR, CHANGE);
+    }
+
+	if (!isClockPresent())
 	{
-		return 0;
+		return -1;
+	}
+
+	// framed transfers need the firmware version
+	uint8_t version;
+	if (_framed && _version == 0 && readVersion(&version))
+	{
+		return -1;
 	}
-	return -1;
+	return 0;
 }
 
 int Clock::begin(unsigned int retries)
@@ -188,6 +211,56 @@ int Clock::writePWMTop(uint8_t value)
     return write(CMD_PWMTOP, value);
 }
 
+int Clock::readFastPulse(uint8_t* value)
+{
+    return read(CMD_FAST_PULSE, value);
+}
+
+int Clock::writeFastPulse(uint8_t value)
+{
+    return write(CMD_FAST_PULSE, value);
+}
+
+int Clock::readFastDelay(uint8_t* value)
+{
+    return read(CMD_FAST_DELAY, value);
+}
+
+int Clock::writeFastDelay(uint8_t value)
+{
+    return write(CMD_FAST_DELAY, value);
+}
+
+int Clock::readAPRamp(uint8_t* value)
+{
+    return read(CMD_AP_RAMP, value);
+}
+
+int Clock::writeAPRamp(uint8_t value)
+{
+    return write(CMD_AP_RAMP, value);
+}
+
+int Clock::readSense(uint8_t* value)
+{
+    return read(CMD_SENSE, value);
+}
+
+int Clock::writeSense(uint8_t value)
+{
+    return write(CMD_SENSE, value);
+}
+
+int Clock::readMissed(uint16_t* value)
+{
+    return read(CMD_MISSED, value);
+}
+
+int Clock::clearMissed()
+{
+    return write(CMD_MISSED, (uint8_t)0);
+}
+
 int Clock::readStatus(uint8_t* value)
 {
     return read(CMD_STATUS, value);
@@ -235,7 +308,12 @@ int Clock::readResetReason(uint8_t* value, unsigned int retries)
 
 int Clock::readVersion(uint8_t* value)
 {
-    return read(CMD_VERSION, value);
+    int err = read(CMD_VERSION, value);
+    if (err == 0)
+    {
+        _version = *value;
+    }
+    return err;
 }
 
 int Clock::readVersion(uint8_t* value, unsigned int retries)
@@ -253,6 +331,142 @@ int Clock::readVersion(uint8_t* value, unsigned int retries)
     return -1;
 }
 
+/**
+ * @brief read the whole clock state, one transaction with version 2 firmware.
+ *
+ * Older firmware does not answer CMD_STATE (the ID does not match) so the registers are
+ * read one at a time.
+ */
+int Clock::readState(ClockState* state)
+{
+    if (_version == 0 || _version >= CLOCK_BLOCK_VERSION)
+    {
+        uint8_t block[CLOCK_STATE_SIZE];
+        if (readBlock(CMD_STATE, block, sizeof(block)))
+        {
+            return -1;
+        }
+
+        if (block[0] == CLOCK_ID_VALUE)
+        {
+            state->id           = block[0];
+            state->version      = block[1];
+            state->reset_reason = block[2];
+            state->control      = block[3];
+            state->status       = block[4];
+            state->position     = block[5] | block[6] << 8;
+            state->adjustment   = block[7] | block[8] << 8;
+            _version            = state->version;
+            if (state->position >= CLOCK_MAX)
+            {
+                dlog.error(FPSTR(TAG), F("::readState: INVALID POSITION RETURNED: %u"), state->position);
+                return -1;
+            }
+            return 0;
+        }
+
+        dlog.info(FPSTR(TAG), F("::readState: no block support, reading registers"));
+        _version = 1;
+    }
+
+    if (read(CMD_ID, &state->id)
+     || readVersion(&state->version)
+     || readResetReason(&state->reset_reason)
+     || read(CMD_CONTROL, &state->control)
+     || readStatus(&state->status)
+     || readPosition(&state->position)
+     || readAdjustment(&state->adjustment))
+    {
+        return -1;
+    }
+
+    if (state->id != CLOCK_ID_VALUE)
+    {
+        dlog.error(FPSTR(TAG), F("::readState: bad id: 0x%02x"), state->id);
+        return -1;
+    }
+    return 0;
+}
+
+int Clock::readState(ClockState* state, unsigned int retries)
+{
+    while(retries-- > 0)
+    {
+        if (readState(state) == 0)
+        {
+            return 0;
+        }
+
+        dlog.warning(FPSTR(TAG), F("::readState: failed, %d retries left"), retries);
+        WireUtils.clearBus();
+    }
+    return -1;
+}
+
+/**
+ * @brief read the pulse config, the fields older firmware does not have are 0 (no speed ramp, no sensing).
+ */
+int Clock::readConfigBlock(ClockConfig* value)
+{
+    memset(value, 0, sizeof(ClockConfig));
+    if (hasBlocks())
+    {
+        return readBlock(CMD_CONFIG, (uint8_t*)value, configSize());
+    }
+
+    if (readTPDuration(&value->tp_duration)
+     || readTPDuty(&value->tp_duty)
+     || readAPDuration(&value->ap_duration)
+     || readAPDuty(&value->ap_duty)
+     || readAPDelay(&value->ap_delay)
+     || readAPStartDuration(&value->ap_start_duration)
+     || readPWMTop(&value->pwm_top))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int Clock::writeConfigBlock(const ClockConfig* value)
+{
+    if (hasBlocks())
+    {
+        return writeBlock(CMD_CONFIG, (const uint8_t*)value, configSize());
+    }
+
+    if (writeTPDuration(value->tp_duration)
+     || writeTPDuty(value->tp_duty)
+     || writeAPDuration(value->ap_duration)
+     || writeAPDuty(value->ap_duty)
+     || writeAPDelay(value->ap_delay)
+     || writeAPStartDuration(value->ap_start_duration)
+     || writePWMTop(value->pwm_top))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// the firmware only takes a complete config block
+size_t Clock::configSize()
+{
+    if (_version < CLOCK_RAMP_VERSION)
+    {
+        return CLOCK_CONFIG_V2_SIZE;
+    }
+    return _version < CLOCK_SENSE_VERSION ? CLOCK_CONFIG_V4_SIZE : sizeof(ClockConfig);
+}
+
+bool Clock::hasBlocks()
+{
+    uint8_t version;
+    if (_version == 0 && readVersion(&version))
+    {
+        return false;
+    }
+    return _version >= CLOCK_BLOCK_VERSION;
+}
+
 bool Clock::getEnable()
 {
     return getCommandBit(BIT_ENABLE);
@@ -263,6 +477,26 @@ void Clock::setEnable(bool enable)
     setCommandBit(enable, BIT_ENABLE);
 }
 
+bool Clock::getSensing()
+{
+    return getCommandBit(BIT_SENSE);
+}
+
+void Clock::setSensing(bool sensing)
+{
+    setCommandBit(sensing, BIT_SENSE);
+}
+
+bool Clock::getTuning()
+{
+    return getCommandBit(BIT_TUNE);
+}
+
+void Clock::setTuning(bool tuning)
+{
+    setCommandBit(tuning, BIT_TUNE);
+}
+
 int Clock::saveConfig()
 {
     return write(CMD_SAVE_CONFIG, (uint8_t)0);
@@ -270,40 +504,21 @@ int Clock::saveConfig()
 
 bool Clock::getCommandBit(uint8_t bit)
 {
-    Wire.beginTransmission((uint8_t) I2C_ADDRESS);
-    Wire.write(CMD_CONTROL);
-    int err = Wire.endTransmission(true);
-    if (err != 0)
+    uint8_t value;
+    if (read(CMD_CONTROL, &value))
     {
-        dlog.error(FPSTR(TAG), F("::getCommandBit endTransmission returned: %d"), err);
+        dlog.error(FPSTR(TAG), F("::getCommandBit: failed to read control!"));
+        return false;
     }
-
-    int size = Wire.requestFrom((uint8_t) I2C_ADDRESS, (uint8_t) 1);
-    if (size != 1)
-    {
-        dlog.error(FPSTR(TAG), F("::getCommandBit requestFrom did not return 1, size:%u"), size);
-    }
-    uint8_t value = Wire.read();
     return ((value & bit) == bit);
 }
 
 int Clock::setCommandBit(bool onoff, uint8_t bit)
 {
-    Wire.beginTransmission(I2C_ADDRESS);
-    Wire.write(CMD_CONTROL);
-    int err = Wire.endTransmission();
-    if (err != 0)
+    uint8_t value;
+    if (read(CMD_CONTROL, &value))
     {
-        dlog.error(FPSTR(TAG), F("::setCommandBit endTransmission returned: %d"), err);
-        return -1;
-    }
-
-    size_t count = Wire.requestFrom((uint8_t) I2C_ADDRESS, (uint8_t) 1);
-    uint8_t value = Wire.read();
-
-    if (count != 1)
-    {
-        dlog.error(FPSTR(TAG), F("::setCommandBit: Wire.requestFrom failed!"));
+        dlog.error(FPSTR(TAG), F("::setCommandBit: failed to read control!"));
         return -1;
     }
 
@@ -316,138 +531,333 @@ int Clock::setCommandBit(bool onoff, uint8_t bit)
         value &= ~bit;
     }
 
-
-    Wire.beginTransmission(I2C_ADDRESS);
-    count = 0;
-    count += Wire.write(CMD_CONTROL);
-    count += Wire.write(value);
-    if (count != 2)
-    {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::setCommandBit: Wire.write command & value failed!"));
-        return -1;
-    }
-    err = Wire.endTransmission();
-    if (err)
+    if (write(CMD_CONTROL, value))
     {
-        dlog.error(FPSTR(TAG), F("::setCommandBit: Wire.endTransmission() returned: %d"), err);
+        dlog.error(FPSTR(TAG), F("::setCommandBit: failed to write control!"));
         return -1;
     }
 
     return 0;
 }
 
-int Clock::read(uint8_t command, uint8_t *value)
+void Clock::setFramed(bool framed)
 {
-    Wire.beginTransmission(I2C_ADDRESS);
-    if (Wire.write(command) != 1)
+    _framed = framed;
+}
+
+bool Clock::isFramed()
+{
+    return _framed && _version >= CLOCK_FRAME_VERSION;
+}
+
+/**
+ * @brief find the fastest i2c speed the clock keeps up with, halving from CLOCK_SPEED_MAX.
+ *
+ * @return the speed now in use, CLOCK_SPEED_MIN if no faster speed passed.
+ */
+uint32_t Clock::negotiateSpeed()
+{
+    for (uint32_t speed = CLOCK_SPEED_MAX; speed > CLOCK_SPEED_MIN; speed /= 2)
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::read: Wire.write(command) failed!"));
-        return -1;
+        _speed = speed;
+        if (probeSpeed())
+        {
+            dlog.info(FPSTR(TAG), F("::negotiateSpeed: using %lu"), speed);
+            return speed;
+        }
+
+        dlog.warning(FPSTR(TAG), F("::negotiateSpeed: %lu failed"), speed);
+        WireUtils.clearBus();
     }
-    int err = Wire.endTransmission();
-    if (err)
+
+    _speed = CLOCK_SPEED_MIN;
+    dlog.info(FPSTR(TAG), F("::negotiateSpeed: using %lu"), _speed);
+    return _speed;
+}
+
+//
+// every read must pass, a failed or corrupted transfer drops _speed (see slowDown()) so that fails the probe too.
+//
+bool Clock::probeSpeed()
+{
+    uint32_t speed   = _speed;
+    bool     blocks  = hasBlocks();
+    uint8_t  command = blocks ? CMD_STATE : CMD_ID;
+    size_t   size    = blocks ? CLOCK_STATE_SIZE : 1;
+    for (int i = 0; i < CLOCK_SPEED_PROBES; ++i)
     {
-        dlog.error(FPSTR(TAG), F("::read: Wire.endTransmission() returned: %d"), err);
-        return -1;
+        uint8_t block[CLOCK_STATE_SIZE];
+        if (readBlock(command, block, size) || _speed != speed || block[0] != CLOCK_ID_VALUE)
+        {
+            return false;
+        }
     }
-    size_t count;
-    count = Wire.requestFrom(I2C_ADDRESS, 1);
-    *value = Wire.read();
-    if (count != 1)
+    return true;
+}
+
+void Clock::setSpeed(uint32_t hz)
+{
+    _speed = hz < CLOCK_SPEED_MIN ? CLOCK_SPEED_MIN : hz;
+}
+
+uint32_t Clock::getSpeed()
+{
+    return _speed;
+}
+
+//
+// a negotiated speed that worked can still fail (noise, temperature...) so fall back to the slowest for the rest of this wake.
+//
+void Clock::slowDown()
+{
+    if (_speed > CLOCK_SPEED_MIN)
     {
-        dlog.error(FPSTR(TAG), F("::read: Wire.requestFrom() returns %u, expected 1"), count);
-        return -1;
+        dlog.warning(FPSTR(TAG), F("::slowDown: i2c error at %lu, using %lu"), _speed, (uint32_t)CLOCK_SPEED_MIN);
+        _speed = CLOCK_SPEED_MIN;
     }
-    return 0;
+}
+
+int Clock::read(uint8_t command, uint8_t *value)
+{
+    return readBlock(command, value, 1);
 }
 
 int Clock::write(uint8_t command, uint8_t value)
 {
-    Wire.beginTransmission(I2C_ADDRESS);
-    if (Wire.write(command) != 1)
+    return writeBlock(command, &value, 1);
+}
+
+int Clock::read(uint8_t command, uint16_t *value)
+{
+    uint8_t data[2];
+    int err = readBlock(command, data, sizeof(data));
+    *value = data[0] | data[1] << 8;
+    return err;
+}
+
+int Clock::write(uint8_t command, uint16_t value)
+{
+    uint8_t data[2] = { (uint8_t)(value & 0xff), (uint8_t)(value >> 8) };
+    return writeBlock(command, data, sizeof(data));
+}
+
+int Clock::readBlock(uint8_t command, uint8_t* data, size_t size)
+{
+    if (isFramed())
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::write: Wire.write(command=%d) failed!"), command);
-        return -1;
+        return readFrame(command, data, size);
     }
-    size_t count;
-    count = Wire.write(value);
-    if (count != 1)
+
+    if (transmit(&command, 1))
     {
-        dlog.error(FPSTR(TAG), F("::write: Wire.write() returns %u, expected 1"), count);
         return -1;
     }
-    int err = Wire.endTransmission();
-    if (err)
+    return request(data, size);
+}
+
+int Clock::writeBlock(uint8_t command, const uint8_t* data, size_t size)
+{
+    if (isFramed())
     {
-        dlog.error(FPSTR(TAG), F("::read: Wire.endTransmission() returned: %d"), err);
-        return -1;
+        return writeFrame(command, data, size);
     }
-    return 0;
+
+    uint8_t buffer[CLOCK_FRAME_MAX];
+    buffer[0] = command;
+    memcpy(&buffer[1], data, size);
+    return transmit(buffer, size + 1);
 }
 
-int Clock::read(uint8_t command, uint16_t *value)
+/**
+ * @brief read with a framed request, the reply has the request sequence number and a CRC-8.
+ *
+ * Only a corrupted reply (or request, the clock does not answer those) is retried, any other
+ * error is returned to the caller.
+ */
+int Clock::readFrame(uint8_t command, uint8_t* data, size_t size)
+{
+    uint8_t frame[CLOCK_FRAME_MAX];
+    for (int attempt = 1; attempt <= CLOCK_FRAME_RETRIES; ++attempt)
+    {
+        uint8_t seq = nextSequence();
+        frame[0] = command | CMD_FRAMED;
+        frame[1] = seq;
+        frame[2] = crc8(0, frame, 2);
+        if (transmit(frame, 3))
+        {
+            return -1;
+        }
+
+        if (request(frame, size + 2))
+        {
+            return -1;
+        }
+
+        if (frame[0] == seq && crc8(0, frame, size + 1) == frame[size + 1])
+        {
+            memcpy(data, &frame[1], size);
+            return 0;
+        }
+        dlog.warning(FPSTR(TAG), F("::readFrame: bad frame for command 0x%02x (attempt %d)"), command, attempt);
+        I2CStats.retry(I2C_DEVICE_CLOCK);
+        slowDown();
+    }
+
+    dlog.error(FPSTR(TAG), F("::readFrame: command 0x%02x failed!"), command);
+    return -1;
+}
+
+/**
+ * @brief write a frame and confirm it with the ack register.
+ */
+int Clock::writeFrame(uint8_t command, const uint8_t* data, size_t size)
 {
+    uint8_t frame[CLOCK_FRAME_MAX];
+    for (int attempt = 1; attempt <= CLOCK_FRAME_RETRIES; ++attempt)
+    {
+        uint8_t seq = nextSequence();
+        frame[0] = command | CMD_FRAMED;
+        frame[1] = seq;
+        memcpy(&frame[2], data, size);
+        frame[size + 2] = crc8(0, frame, size + 2);
+        if (transmit(frame, size + 3))
+        {
+            return -1;
+        }
+
+        uint8_t ack[2];
+        if (readFrame(CMD_ACK, ack, sizeof(ack)))
+        {
+            return -1;
+        }
+        if (ack[0] == seq && ack[1] == CLOCK_ACK_OK)
+        {
+            return 0;
+        }
+        dlog.warning(FPSTR(TAG), F("::writeFrame: command 0x%02x not acknowledged (attempt %d)"), command, attempt);
+        I2CStats.retry(I2C_DEVICE_CLOCK);
+        slowDown();
+    }
+
+    dlog.error(FPSTR(TAG), F("::writeFrame: command 0x%02x failed!"), command);
+    return -1;
+}
+
+int Clock::transmit(const uint8_t* data, size_t size)
+{
+    uint32_t start = micros();
+    WireUtils.setSpeed(_speed);
     Wire.beginTransmission(I2C_ADDRESS);
-    if (Wire.write(command) != 1)
+    size_t count = Wire.write(data, size);
+    if (count != size)
     {
         Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::read: Wire.write(I2C_ADDRESS) failed!"));
+        I2CStats.record(I2C_DEVICE_CLOCK, start, false);
+        dlog.error(FPSTR(TAG), F("::transmit: Wire.write() returns %u, expected %u"), count, size);
         return -1;
     }
     int err = Wire.endTransmission();
+    I2CStats.record(I2C_DEVICE_CLOCK, start, err == 0);
     if (err)
     {
-        dlog.error(FPSTR(TAG), F("::read: Wire.endTransmission() returned: %d"), err);
-        return -1;
-    }
-    size_t count;
-    count = Wire.requestFrom(I2C_ADDRESS, 2);
-    *value = (Wire.read() & 0xff) | (Wire.read() & 0xff) << 8;
-    if (count != 2)
-    {
-        dlog.error(FPSTR(TAG), F("::read: Wire.requestFrom() returns %u, expected 2"), count);
+        dlog.error(FPSTR(TAG), F("::transmit: Wire.endTransmission() returned: %d"), err);
+        slowDown();
         return -1;
     }
     return 0;
 }
 
-int Clock::write(uint8_t command, uint16_t value)
+int Clock::request(uint8_t* data, size_t size)
 {
-    Wire.beginTransmission(I2C_ADDRESS);
-    if (Wire.write(command) != 1)
+    uint32_t start = micros();
+    size_t count = Wire.requestFrom((uint8_t)I2C_ADDRESS, (uint8_t)size);
+    for (size_t i = 0; i < size; ++i)
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::write: Wire.write(command=%d) failed!"), command);
-        return -1;
+        data[i] = Wire.read();
     }
-    size_t count = 0;
-    count += Wire.write(value & 0xff);
-    count += Wire.write(value >> 8);
-    if (count != 2)
+    I2CStats.record(I2C_DEVICE_CLOCK, start, count == size);
+    if (count != size)
     {
-        dlog.error(FPSTR(TAG), F("::write: Wire.write() returns %u, expected 2"), count);
-        return -1;
-    }
-    int err = Wire.endTransmission();
-    if (err)
-    {
-        dlog.error(FPSTR(TAG), F("::read: Wire.endTransmission() returned: %d"), err);
+        dlog.error(FPSTR(TAG), F("::request: Wire.requestFrom() returns %u, expected %u"), count, size);
+        slowDown();
         return -1;
     }
     return 0;
 }
 
-void Clock::waitForEdge(int edge)
+// 0xff is never used, it is what we read when the clock does not answer.
+uint8_t Clock::nextSequence()
+{
+    _seq = (_seq + 1) % 0xff;
+    return _seq;
+}
+
+//
+// CRC-8 (polynomial 0x07), crc is the CRC of any data before this part
+//
+uint8_t Clock::crc8(uint8_t crc, const uint8_t* data, size_t length)
 {
-    while (digitalRead(pin) == edge)
+    while (length--)
     {
-        delay(1);
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; ++i)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
     }
-    while (digitalRead(pin) != edge)
+    return crc;
+}
+
+//
+// record the time and level of every edge of the 1hz signal.
+//
+void ICACHE_RAM_ATTR Clock::edgeISR()
+{
+    uint32_t now = micros();
+    uint32_t i   = _edge_count & (CLOCK_EDGE_COUNT-1);
+    _edge_time[i]  = now;
+    _edge_level[i] = digitalRead(_edge_pin);
+    _edge_count    = _edge_count + 1;
+}
+
+/**
+ * @brief wait for the next edge of the 1hz signal, the edge time is captured by the interrupt handler.
+ *
+ * @param micros_result set to micros() at the edge if not NULL
+ * @return 0 on success, -1 on timeout
+*/
+int Clock::waitForEdge(int edge, uint32_t* micros_result, unsigned int timeout_ms)
+{
+    if (_edge_pin != pin)
     {
-        delay(1);
+        dlog.error(FPSTR(TAG), F("::waitForEdge: begin() not called!"));
+        return -1;
     }
+
+    uint32_t count = _edge_count; // only edges after we were called
+    uint32_t start = millis();
+    do
+    {
+        while (count != _edge_count)
+        {
+            if (_edge_count - count > CLOCK_EDGE_COUNT)
+            {
+                count = _edge_count - CLOCK_EDGE_COUNT; // overwritten
+            }
+            uint32_t i = count & (CLOCK_EDGE_COUNT-1);
+            count += 1;
+            if (_edge_level[i] == edge)
+            {
+                if (micros_result != NULL)
+                {
+                    *micros_result = _edge_time[i];
+                }
+                return 0;
+            }
+        }
+        delay(1); // lets the CPU idle till the next interrupt
+    } while (millis() - start < timeout_ms);
+
+    dlog.error(FPSTR(TAG), F("::waitForEdge: timeout waiting for %s edge!"), edge == CLOCK_EDGE_RISING ? "rising" : "falling");
+    return -1;
 }
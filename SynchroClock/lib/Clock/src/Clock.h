@@ -46,12 +46,27 @@
 #define CMD_RESET       0x0d // factory reset
 #define CMD_RST_REASON  0x0e // last reset reason
 #define CMD_VERSION     0x0f // Clock firmware version
+#define CMD_STATE       0x10 // block read of the clock state (version 2)
+#define CMD_CONFIG      0x11 // block read/write of the pulse config (version 2)
+#define CMD_ACK         0x12 // sequence number and status of the last framed write (version 3)
+#define CMD_FAST_PULSE  0x13 // adjust pulse duration at full speed (version 4)
+#define CMD_FAST_DELAY  0x14 // delay between adjust pulses at full speed (version 4)
+#define CMD_AP_RAMP     0x15 // adjust pulses to ramp up to full speed, 0 for a constant speed (version 4)
+#define CMD_SENSE       0x16 // back-EMF threshold for a step that moved (version 5)
+#define CMD_MISSED      0x17 // missed steps, a write clears it and STATUS_BIT_MISSED (version 5)
+#define CMD_FRAMED      0x80 // or'ed with the command for a transfer with sequence number and CRC-8
+
+// ack register status
+#define CLOCK_ACK_OK    0x00
 
 // control register bits
 #define BIT_ENABLE      0x80
+#define BIT_SENSE       0x40 // check every step with the coil back-EMF (version 5)
+#define BIT_TUNE        0x20 // lower the pulse duty till steps are missed, then back off (version 5, needs BIT_SENSE)
 
 // status register bits
 #define STATUS_BIT_TICK    0x01
+#define STATUS_BIT_MISSED  0x02
 #define STATUS_BIT_PWFBAD  0x80
 
 
@@ -59,10 +74,64 @@
 
 #define CLOCK_EDGE_RISING  1
 #define CLOCK_EDGE_FALLING 0
+#define CLOCK_EDGE_COUNT   4     // edges kept by the interrupt handler, must be a power of 2
+#define CLOCK_EDGE_TIMEOUT 2500  // default ms to wait for an edge, the 1hz signal has one of each per second
+
+#define CLOCK_BLOCK_VERSION 2 // first firmware version with CMD_STATE & CMD_CONFIG
+#define CLOCK_FRAME_VERSION 3 // first firmware version with framed transfers
+#define CLOCK_RAMP_VERSION  4 // first firmware version with the adjust speed ramp
+#define CLOCK_SENSE_VERSION 5 // first firmware version with missed step sensing
+#ifndef CLOCK_FRAME_RETRIES
+#define CLOCK_FRAME_RETRIES 3 // attempts when a frame is corrupted
+#endif
+
+#ifndef CLOCK_SPEED_MAX
+#define CLOCK_SPEED_MAX    400000 // fastest i2c speed tried by negotiateSpeed()
+#endif
+#define CLOCK_SPEED_MIN    100000 // i2c speed till one is negotiated and after an error
+#define CLOCK_SPEED_PROBES 8      // state reads that must all pass at a speed
 
 #define CLOCK_ERROR     0xffff
 #define CLOCK_MAX       43200
 
+//
+// everything read at startup, in CMD_STATE order
+//
+typedef struct clock_state
+{
+    uint8_t  id;
+    uint8_t  version;
+    uint8_t  reset_reason;
+    uint8_t  control;
+    uint8_t  status;
+    uint16_t position;
+    uint16_t adjustment;
+} ClockState;
+
+#define CLOCK_STATE_SIZE 9
+
+//
+// pulse timing, same layout as the Config struct of the clock firmware
+//
+typedef struct clock_config
+{
+    uint8_t  tp_duration;
+    uint8_t  tp_duty;
+    uint8_t  ap_duration;
+    uint8_t  ap_duty;
+    uint8_t  ap_delay;
+    uint8_t  ap_start_duration;
+    uint8_t  pwm_top;
+    uint8_t  ap_fast_duration;  // version 4
+    uint8_t  ap_fast_delay;
+    uint8_t  ap_ramp;
+    uint8_t  sense;             // version 5
+} ClockConfig;
+
+#define CLOCK_CONFIG_V2_SIZE 7                      // ClockConfig before version 4
+#define CLOCK_CONFIG_V4_SIZE 10                     // ClockConfig before version 5
+#define CLOCK_FRAME_MAX  (sizeof(ClockConfig)+3)    // command, sequence number, data (config is the largest) and CRC
+
 class Clock
 {
 public:
@@ -89,6 +158,16 @@ public:
     int writeAPStartDuration(uint8_t value);
     int readPWMTop(uint8_t* value);
     int writePWMTop(uint8_t value);
+    int readFastPulse(uint8_t* value);
+    int writeFastPulse(uint8_t value);
+    int readFastDelay(uint8_t* value);
+    int writeFastDelay(uint8_t value);
+    int readAPRamp(uint8_t* value);
+    int writeAPRamp(uint8_t value);
+    int readSense(uint8_t* value);
+    int writeSense(uint8_t value);
+    int readMissed(uint16_t* value);
+    int clearMissed();
     int readStatus(uint8_t* value);
     int readStatus(uint8_t* value, unsigned int retries);
     int factoryReset();
@@ -96,19 +175,53 @@ public:
     int readResetReason(uint8_t* value, unsigned int retries);
     int readVersion(uint8_t* value);
     int readVersion(uint8_t* value, unsigned int retries);
+    int readState(ClockState* state);
+    int readState(ClockState* state, unsigned int retries);
+    int readConfigBlock(ClockConfig* value);
+    int writeConfigBlock(const ClockConfig* value);
 
     bool getEnable();
     void setEnable(bool enable);
+    bool getSensing();
+    void setSensing(bool sensing);
+    bool getTuning();
+    void setTuning(bool tuning);
     int saveConfig();
+    void setFramed(bool framed);    // use framed transfers if the firmware supports them
+    bool isFramed();
+    uint32_t negotiateSpeed();      // find the fastest i2c speed the clock keeps up with
+    void setSpeed(uint32_t hz);     // use a previously negotiated speed
+    uint32_t getSpeed();
     bool getCommandBit(uint8_t);
     int setCommandBit(bool value, uint8_t bit);
-    void waitForEdge(int edge);
+    int waitForEdge(int edge, uint32_t* micros_result = NULL, unsigned int timeout_ms = CLOCK_EDGE_TIMEOUT);
 private:
     int pin;
+    uint8_t _version;                                        // firmware version, 0 till read
+    bool    _framed;                                         // framed transfers requested
+    uint8_t _seq;                                            // last frame sequence number
+    uint32_t _speed;                                         // i2c speed for our transactions
+    static int               _edge_pin;
+    static volatile uint32_t _edge_count;                    // total edges seen
+    static volatile uint32_t _edge_time[CLOCK_EDGE_COUNT];   // micros() of the edge
+    static volatile uint8_t  _edge_level[CLOCK_EDGE_COUNT];  // pin level after the edge
+    static void edgeISR();
     int read(uint8_t  command, uint16_t *value);
     int write(uint8_t command, uint16_t  value);
     int read(uint8_t  command, uint8_t *value);
     int write(uint8_t command, uint8_t  value);
+    int readBlock(uint8_t command, uint8_t* data, size_t size);
+    int writeBlock(uint8_t command, const uint8_t* data, size_t size);
+    bool hasBlocks();
+    size_t configSize();
+    bool probeSpeed();
+    void slowDown();
+    int readFrame(uint8_t command, uint8_t* data, size_t size);
+    int writeFrame(uint8_t command, const uint8_t* data, size_t size);
+    int transmit(const uint8_t* data, size_t size);
+    int request(uint8_t* data, size_t size);
+    uint8_t nextSequence();
+    static uint8_t crc8(uint8_t crc, const uint8_t* data, size_t length);
 };
 
 #endif /* CLOCK_H_ */
@@ -21,11 +21,14 @@
  */
 
 #include "DS3231.h"
+#include "I2CStats.h"
 
 static PROGMEM const char TAG[] = "DS3231";
 
 DS3231::DS3231()
 {
+    memset(&_snapshot, 0, sizeof(_snapshot));
+    _speed = DS3231_SPEED_MIN;
 }
 
 int DS3231::begin()
@@ -40,19 +43,15 @@ int DS3231::begin()
         return -1;
     }
 
-    dlog.info(FPSTR(TAG),F("::begin: small delay"));
-    delay(100);
-
-    dlog.info(FPSTR(TAG),F("::begin: reading HOUR register to insure 24hr format"));
-    // set the clock to 24hr format
-    uint8_t hr;
-    if (read(DS3231_HOUR_REG, &hr))
+    dlog.info(FPSTR(TAG),F("::begin: reading registers to insure 24hr format"));
+    if (readSnapshot())
     {
-        dlog.error(FPSTR(TAG), F("::begin(): read(DS3231_HOUR_REG) failed!"));
+        dlog.error(FPSTR(TAG), F("::begin(): readSnapshot() failed!"));
         return -1;
     }
 
      // switch to 24hr mode if its not already
+    uint8_t hr = _snapshot.regs[DS3231_HOUR_REG];
     if (hr & _BV(DS3231_AMPM))
     {
         dlog.info(FPSTR(TAG),F("::begin: writing HOUR register to set 24hr format"));
@@ -70,6 +69,103 @@ int DS3231::begin()
     return 0;
 }
 
+/*
+ * read registers 0x00 - 0x12 (time, alarms, control, status, aging and temperature) with
+ * one request.
+ */
+int DS3231::readSnapshot()
+{
+    uint8_t count = setupRead(DS3231_SEC_REG, DS3231_REG_COUNT);
+    if (count != DS3231_REG_COUNT)
+    {
+        dlog.error(FPSTR(TAG), F("::readSnapshot: setupRead failed! count:%u != %u"), count, DS3231_REG_COUNT);
+        Wire.clearWriteError();
+        Wire.flush();
+        _snapshot.valid = false;
+        slowDown();
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < DS3231_REG_COUNT; ++i)
+    {
+        _snapshot.regs[i] = Wire.read();
+    }
+    _snapshot.millis = millis();
+    _snapshot.valid  = true;
+
+    dlog.trace(FPSTR(TAG), F("::readSnapshot: control: 0x%02x status: 0x%02x"),
+            _snapshot.regs[DS3231_CONTROL_REG], _snapshot.regs[DS3231_STATUS_REG]);
+    return 0;
+}
+
+/*
+ * read a new snapshot if there is none or it is too old.
+ */
+int DS3231::refreshSnapshot()
+{
+    if (_snapshot.valid && (millis() - _snapshot.millis) < DS3231_SNAPSHOT_MAX_AGE)
+    {
+        return 0;
+    }
+    return readSnapshot();
+}
+
+/*
+ * try DS3231_SPEED_MAX, the snapshots read at that speed must have the same alarm, control and aging
+ * registers (they don't change by themselves) as one read at DS3231_SPEED_MIN.
+ */
+uint32_t DS3231::negotiateSpeed()
+{
+    _speed = DS3231_SPEED_MIN;
+    if (readSnapshot())
+    {
+        return _speed;
+    }
+
+    uint8_t regs[DS3231_REG_COUNT];
+    memcpy(regs, _snapshot.regs, sizeof(regs));
+
+    _speed = DS3231_SPEED_MAX;
+    for (int i = 0; i < DS3231_SPEED_PROBES; ++i)
+    {
+        if (readSnapshot()
+         || memcmp(&regs[DS3231_A1S_REG], &_snapshot.regs[DS3231_A1S_REG], DS3231_STATUS_REG - DS3231_A1S_REG)
+         || regs[DS3231_AGING_REG] != _snapshot.regs[DS3231_AGING_REG])
+        {
+            dlog.warning(FPSTR(TAG), F("::negotiateSpeed: %lu failed"), (uint32_t)DS3231_SPEED_MAX);
+            _speed = DS3231_SPEED_MIN;
+            WireUtils.clearBus();
+            readSnapshot();
+            return _speed;
+        }
+    }
+
+    dlog.info(FPSTR(TAG), F("::negotiateSpeed: using %lu"), _speed);
+    return _speed;
+}
+
+void DS3231::setSpeed(uint32_t hz)
+{
+    _speed = hz < DS3231_SPEED_MIN ? DS3231_SPEED_MIN : hz;
+}
+
+uint32_t DS3231::getSpeed()
+{
+    return _speed;
+}
+
+//
+// fall back to the slowest speed for the rest of this wake after an error.
+//
+void DS3231::slowDown()
+{
+    if (_speed > DS3231_SPEED_MIN)
+    {
+        dlog.warning(FPSTR(TAG), F("::slowDown: i2c error at %lu, using %lu"), _speed, (uint32_t)DS3231_SPEED_MIN);
+        _speed = DS3231_SPEED_MIN;
+    }
+}
+
 uint8_t DS3231::fromBCD(uint8_t val)
 {
 	return val - 6 * (val >> 4);
@@ -82,44 +178,56 @@ uint8_t DS3231::toBCD(uint8_t val)
 
 int DS3231::readTime(DS3231DateTime& dt)
 {
+    if (readSnapshot())
+    {
+        return -1;
+    }
+    return decodeTime(dt);
+}
+
+/*
+ * the time from the snapshot plus the seconds since it was read (rounded), this is only exact if
+ * both were just after the start of a second.
+ */
+int DS3231::getTime(DS3231DateTime& dt)
+{
+    if (refreshSnapshot() || decodeTime(dt))
+    {
+        return -1;
+    }
+
+    uint32_t seconds = (millis() - _snapshot.millis + 500) / 1000;
+    if (seconds > 0)
+    {
+        dt.setUnixTime(dt.getUnixTime() + seconds);
+    }
+    return 0;
+}
+
+int DS3231::decodeTime(DS3231DateTime& dt)
+{
+    const uint8_t* regs = _snapshot.regs;
+    uint8_t month = regs[DS3231_MONTH_REG];
 
-	uint8_t count = setupRead(DS3231_SEC_REG, 7);
-	if (count != 7)
-	{
-		dlog.error(FPSTR(TAG), F("::readTime: setupRead failed! count:%u != 7"), count);
-		Wire.clearWriteError();
-		Wire.flush();
-		return -1;
-	}
-
-	uint8_t seconds = Wire.read();
-	uint8_t minutes = Wire.read();
-	uint8_t hours   = Wire.read();
-	uint8_t day     = Wire.read();
-	uint8_t date    = Wire.read();
-	uint8_t month   = Wire.read();
-	uint8_t year    = Wire.read();
-
-	dlog.trace(FPSTR(TAG), F("::readTime  raw month: 0x%02x"), month);
-
-    dt.seconds  = fromBCD(seconds);
-    dt.minutes  = fromBCD(minutes);
-    dt.hours    = fromBCD(hours & DS3231_24HR_MASK);
-    dt.day      = fromBCD(day);
-    dt.date     = fromBCD(date);
+	dlog.trace(FPSTR(TAG), F("::decodeTime  raw month: 0x%02x"), month);
+
+    dt.seconds  = fromBCD(regs[DS3231_SEC_REG]);
+    dt.minutes  = fromBCD(regs[DS3231_MIN_REG]);
+    dt.hours    = fromBCD(regs[DS3231_HOUR_REG] & DS3231_24HR_MASK);
+    dt.day      = fromBCD(regs[DS3231_WDAY_REG]);
+    dt.date     = fromBCD(regs[DS3231_MDAY_REG]);
     dt.month    = fromBCD(month & DS3231_MONTH_MASK);
-    dt.year     = fromBCD(year);
+    dt.year     = fromBCD(regs[DS3231_YEAR_REG]);
     dt.century  = month&DS3231_CENTURY? 1 : 0;
 
     if (!dt.isValid())
     {
-        dlog.error(FPSTR(TAG), F("::readTime: result not valid!!!"));
-        Wire.clearWriteError();
-        Wire.flush();
+        dlog.error(FPSTR(TAG), F("::decodeTime: result not valid!!!"));
+        _snapshot.valid = false;
         return -1;
     }
 
-    dlog.debug(FPSTR(TAG), F("::readTime %04u-%02u-%02u %02u:%02u:%02u day:%u century:%u"),
+    dlog.debug(FPSTR(TAG), F("::decodeTime %04u-%02u-%02u %02u:%02u:%02u day:%u century:%u"),
              dt.year,
              dt.month,
              dt.date,
@@ -143,91 +251,190 @@ int DS3231::writeTime(DS3231DateTime &dt)
              dt.day,
              dt.century);
 
-    Wire.beginTransmission(DS3231_ADDRESS);
-    if (Wire.write(DS3231_SEC_REG) != 1)
+    uint8_t data[8];
+    data[0] = DS3231_SEC_REG;
+    data[1] = toBCD(dt.seconds);
+    data[2] = toBCD(dt.minutes);
+    data[3] = toBCD(dt.hours);
+    data[4] = toBCD(dt.day);
+    data[5] = toBCD(dt.date);
+    data[6] = toBCD(dt.month) | (dt.century ? _BV(DS3231_CENTURY) : 0);
+    data[7] = toBCD(dt.year);
+    if (transmit(data, sizeof(data)))
+    {
+        dlog.error(FPSTR(TAG), F("::writeTime: transmit() failed!"));
+        _snapshot.valid = false;
+        return -1;
+    }
+
+    // the second starts with the write
+    _snapshot.regs[DS3231_SEC_REG]   = toBCD(dt.seconds);
+    _snapshot.regs[DS3231_MIN_REG]   = toBCD(dt.minutes);
+    _snapshot.regs[DS3231_HOUR_REG]  = toBCD(dt.hours);
+    _snapshot.regs[DS3231_WDAY_REG]  = toBCD(dt.day);
+    _snapshot.regs[DS3231_MDAY_REG]  = toBCD(dt.date);
+    _snapshot.regs[DS3231_MONTH_REG] = toBCD(dt.month) | (dt.century ? _BV(DS3231_CENTURY) : 0);
+    _snapshot.regs[DS3231_YEAR_REG]  = toBCD(dt.year);
+    _snapshot.millis                 = millis();
+    return(0);
+}
+
+int DS3231::readTemperature(float* celsius)
+{
+    if (refreshSnapshot())
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::writeTime: Wire.write(reg=DS3231_SEC_REG) failed!"));
         return -1;
     }
 
-    int count;
-    count  = Wire.write(toBCD(dt.seconds));
-    count += Wire.write(toBCD(dt.minutes));
-    count += Wire.write(toBCD(dt.hours));
-    count += Wire.write(toBCD(dt.day));
-    count += Wire.write(toBCD(dt.date));
-    count += Wire.write(toBCD(dt.month) | (dt.century ? _BV(DS3231_CENTURY) : 0));
-    count += Wire.write(toBCD(dt.year));
-    if (count != 7)
+    int8_t  upper = (int8_t)_snapshot.regs[DS3231_TEMP_UP_REG];  // whole degrees, two's complement
+    uint8_t lower = _snapshot.regs[DS3231_TEMP_LOW_REG];         // quarter degrees in the top 2 bits
+
+    *celsius = upper + (lower >> 6) * 0.25;
+    dlog.debug(FPSTR(TAG), F("::readTemperature: %0.2f C"), *celsius);
+    return 0;
+}
+
+int DS3231::readAging(int8_t* value)
+{
+    if (refreshSnapshot())
     {
-        dlog.error(FPSTR(TAG), F("::writeTime: Wire.write() all fields, expected 7 got %u"), count);
         return -1;
     }
-    int err = Wire.endTransmission();
-    if (err)
+    *value = (int8_t)_snapshot.regs[DS3231_AGING_REG];
+    return 0;
+}
+
+int DS3231::getOSF(bool* osf)
+{
+    if (refreshSnapshot())
     {
-        dlog.error(FPSTR(TAG), F("::writeTime: Wire.endTransmission() returned: %d"), err);
         return -1;
     }
-    return(0);
+    *osf = (_snapshot.regs[DS3231_STATUS_REG] & _BV(DS3231_STS_OSF)) != 0;
+    return 0;
 }
 
-int DS3231::setupRead(uint8_t reg, uint8_t size)
+/*
+ * the OSF flag stays set till cleared so only clear it once the time has been set.
+ */
+int DS3231::clearOSF()
 {
-    Wire.beginTransmission(DS3231_ADDRESS);
-    if (Wire.write(reg) != 1)
+    uint8_t status;
+    if (read(DS3231_STATUS_REG, &status))
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::setupRead: Wire.write(DS3231_CONTROL_REG) failed!"));
+        dlog.error(FPSTR(TAG), F("::clearOSF: failed to read status!"));
         return -1;
     }
-    int err = Wire.endTransmission();
 
-    if (err)
+    if (write(DS3231_STATUS_REG, status & ~_BV(DS3231_STS_OSF)))
+    {
+        dlog.error(FPSTR(TAG), F("::clearOSF: write(DS3231_STATUS_REG) failed!"));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The aging offset is only used by the oscillator after a temperature conversion so start one
+ * if there is not one in progress already.
+ */
+int DS3231::writeAging(int8_t value)
+{
+    dlog.info(FPSTR(TAG), F("::writeAging: %d"), value);
+    if (write(DS3231_AGING_REG, (uint8_t)value))
     {
-        dlog.error(FPSTR(TAG), F("::setupRead: Wire.endTransmission() returned: %d"), err);
+        dlog.error(FPSTR(TAG), F("::writeAging: write(DS3231_AGING_REG) failed!"));
         return -1;
     }
 
-    return Wire.requestFrom(DS3231_ADDRESS, (size_t)size);
+    uint8_t status;
+    if (read(DS3231_STATUS_REG, &status))
+    {
+        dlog.error(FPSTR(TAG), F("::writeAging: failed to read status!"));
+        return -1;
+    }
+    uint8_t ctrl = _snapshot.regs[DS3231_CONTROL_REG];
+
+    if (status & _BV(DS3231_STS_BSY))
+    {
+        dlog.info(FPSTR(TAG), F("::writeAging: conversion in progress"));
+        return 0;
+    }
+
+    if (write(DS3231_CONTROL_REG, ctrl | _BV(DS3231_CTL_CONV)))
+    {
+        dlog.error(FPSTR(TAG), F("::writeAging: write(DS3231_CONTROL_REG) failed!"));
+        return -1;
+    }
+    return 0;
+}
+
+int DS3231::setupRead(uint8_t reg, uint8_t size)
+{
+    if (transmit(&reg, 1))
+    {
+        return -1;
+    }
+
+    uint32_t start = micros();
+    int count = Wire.requestFrom(DS3231_ADDRESS, (size_t)size);
+    I2CStats.record(I2C_DEVICE_RTC, start, count == size);
+    return count;
 }
 
 int DS3231::read(uint8_t reg, uint8_t *value)
 {
-    size_t count = setupRead(reg, 1);
-    count = Wire.requestFrom(DS3231_ADDRESS, (size_t)1);
-    *value = Wire.read();
+    int count = setupRead(reg, 1);
     if (count != 1)
     {
-        dlog.error(FPSTR(TAG), F("::read: Wire.requestFrom() returns %u, expected 1"), count);
+        dlog.error(FPSTR(TAG), F("::read: Wire.requestFrom() returns %d, expected 1"), count);
+        slowDown();
         return -1;
     }
+    *value = Wire.read();
+    if (reg < DS3231_REG_COUNT)
+    {
+        _snapshot.regs[reg] = *value;
+    }
     return 0;
 }
 
 
 int DS3231::write(uint8_t reg, uint8_t value)
 {
-    Wire.beginTransmission(DS3231_ADDRESS);
-    if (Wire.write(reg) != 1)
+    uint8_t data[2] = { reg, value };
+    if (transmit(data, sizeof(data)))
     {
-        Wire.endTransmission();
-        dlog.error(FPSTR(TAG), F("::write: Wire.write(reg=%d, value=%d) failed!"), reg, value);
+        dlog.error(FPSTR(TAG), F("::write: failed! reg=%d value=%d"), reg, value);
         return -1;
     }
-    size_t count;
-    count = Wire.write(value);
-    if (count != 1)
+    if (reg < DS3231_REG_COUNT)
+    {
+        _snapshot.regs[reg] = value;
+    }
+    return(0);
+}
+
+int DS3231::transmit(const uint8_t* data, size_t size)
+{
+    uint32_t start = micros();
+    WireUtils.setSpeed(_speed);
+    Wire.beginTransmission(DS3231_ADDRESS);
+    size_t count = Wire.write(data, size);
+    if (count != size)
     {
-        dlog.error(FPSTR(TAG), F("::write: Wire.write(value=%u) returns %u"), value, count);
+        Wire.endTransmission();
+        I2CStats.record(I2C_DEVICE_RTC, start, false);
+        dlog.error(FPSTR(TAG), F("::transmit: Wire.write() returns %u, expected %u"), count, size);
         return -1;
     }
     int err = Wire.endTransmission();
+    I2CStats.record(I2C_DEVICE_RTC, start, err == 0);
     if (err)
     {
-        dlog.error(FPSTR(TAG), F("::write: Wire.endTransmission() returned: %d"), err);
+        dlog.error(FPSTR(TAG), F("::transmit: Wire.endTransmission() returned: %d"), err);
+        slowDown();
         return -1;
     }
-    return(0);
+    return 0;
 }
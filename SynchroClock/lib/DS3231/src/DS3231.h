@@ -51,7 +51,7 @@ const uint8_t DS3231_AL2W_REG      = 0x0D;
 
 const uint8_t DS3231_CONTROL_REG   = 0x0E;
 const uint8_t DS3231_STATUS_REG    = 0x0F;
-const uint8_t DS3231_AGING_REG     = 0x0F;
+const uint8_t DS3231_AGING_REG     = 0x10;
 const uint8_t DS3231_TEMP_UP_REG   = 0x11;
 const uint8_t DS3231_TEMP_LOW_REG  = 0x12;
 
@@ -82,19 +82,56 @@ const uint8_t DS3231_MONTH_MASK    = 0x1f;
 
 #define RTC_POSITION_ERROR 0xffff
 
+#define DS3231_REG_COUNT         0x13    // registers 0x00 - 0x12 are read in one transaction
+#ifndef DS3231_SNAPSHOT_MAX_AGE
+#define DS3231_SNAPSHOT_MAX_AGE  60000   // milliseconds a snapshot is used before it is read again
+#endif
+
+#ifndef DS3231_SPEED_MAX
+#define DS3231_SPEED_MAX         400000  // i2c fast mode, tried by negotiateSpeed()
+#endif
+#define DS3231_SPEED_MIN         100000  // i2c speed till one is negotiated and after an error
+#define DS3231_SPEED_PROBES      4       // snapshots that must match the slow read
+
+//
+// Copy of all of the registers from one read, writes made through this class are applied to it.
+//
+typedef struct ds3231_snapshot
+{
+    uint8_t  regs[DS3231_REG_COUNT];
+    uint32_t millis;                       // millis() of the read (or time write)
+    bool     valid;
+} DS3231Snapshot;
 
 class DS3231
 {
 public:
     DS3231();
     int	 begin();
-    int      readTime(DS3231DateTime& dt);  // return 0 if ok
+    int      readSnapshot();                // read all registers, return 0 if ok
+    int      readTime(DS3231DateTime& dt);  // return 0 if ok, reads a new snapshot
+    int      getTime(DS3231DateTime& dt);   // return 0 if ok, from the snapshot plus the seconds since it was read
     int      writeTime(DS3231DateTime& dt); // return 0 if ok
+    int      readTemperature(float* celsius); // return 0 if ok, 0.25C resolution, updated every 64 seconds
+    int      readAging(int8_t* value);      // return 0 if ok
+    int      writeAging(int8_t value);      // return 0 if ok, positive values slow the oscillator ~0.1ppm per LSB
+    int      getOSF(bool* osf);             // return 0 if ok, osf is true if the oscillator has stopped since it was cleared
+    int      clearOSF();                    // return 0 if ok
+    uint32_t negotiateSpeed();              // return the i2c speed now in use
+    void     setSpeed(uint32_t hz);         // use a previously negotiated speed
+    uint32_t getSpeed();
 
 private:
+    DS3231Snapshot _snapshot;
+    uint32_t       _speed;                  // i2c speed for our transactions
+
+    int     refreshSnapshot();
+    void    slowDown();
+    int     decodeTime(DS3231DateTime& dt);
     uint8_t fromBCD(uint8_t val);
     uint8_t toBCD(uint8_t   val);
     int     setupRead(uint8_t reg, uint8_t size);
+    int     transmit(const uint8_t* data, size_t size);
     int     write(uint8_t reg, uint8_t value);
     int     read(uint8_t  reg, uint8_t* value);
 };
@@ -0,0 +1,116 @@
+/*
+ * EnergyTrace.cpp
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "EnergyTrace.h"
+#include "Logger.h"
+
+static PROGMEM const char TAG[] = "EnergyTrace";
+
+#define RTC_USER_MEMORY_SIZE 512
+
+static const char* const phase_names[ENERGY_PHASE_COUNT] =
+{
+    "boot", "init", "drift", "wifi", "ota", "ntp", "clock", "sleep"
+};
+
+EnergyTrace::EnergyTrace()
+{
+    _offset = 0;
+    _valid  = false;
+    _phase  = ENERGY_BOOT;
+    _start  = 0;
+    memset(&_data, 0, sizeof(_data));
+    memset(_ms, 0, sizeof(_ms));
+}
+
+/**
+ * @brief load the saved state from RTC memory and start the init phase, everything before is boot.
+ *
+ * @param rtc_offset offset in 4 byte blocks of the RTC memory to use
+*/
+void EnergyTrace::begin(uint32_t rtc_offset)
+{
+    _offset = rtc_offset;
+    _start  = 0;
+    mark(ENERGY_INIT);
+
+    if (_offset * 4 + sizeof(_data) > RTC_USER_MEMORY_SIZE)
+    {
+        dlog.error(FPSTR(TAG), F("::begin: RTC memory offset %u too large!"), _offset);
+    }
+    else
+    {
+        _valid = ESP.rtcUserMemoryRead(_offset, (uint32_t*)&_data, sizeof(_data));
+    }
+
+    //
+    // anything other than a wake from deep sleep means a cold start with the radio on.
+    //
+    if (!_valid || _data.magic != ENERGY_TRACE_MAGIC || ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+    {
+        dlog.info(FPSTR(TAG), F("::begin: no saved state, assuming cold start"));
+        memset(&_data, 0, sizeof(_data));
+        _data.magic = ENERGY_TRACE_MAGIC;
+        _data.radio = true;
+    }
+    _data.wakes += 1;
+}
+
+/**
+ * @brief end the current phase and start a new one, time spent in a phase accumulates over multiple marks.
+*/
+void EnergyTrace::mark(EnergyPhase phase)
+{
+    uint32_t now = millis();
+    _ms[_phase] += now - _start;
+    _start = now;
+    _phase = phase;
+}
+
+/**
+ * @brief end the wake cycle: log the phase times and save the RF mode for the next wake.
+ *
+ * @param sleep_seconds how long we are going to deep sleep
+ * @param radio true if the deep sleep RF mode will leave the radio on at the next wake
+*/
+void EnergyTrace::end(uint32_t sleep_seconds, bool radio)
+{
+    mark(ENERGY_SLEEP);
+
+    char     buffer[128];
+    int      len   = 0;
+    uint32_t total = 0;
+    for (int i = 0; i < ENERGY_PHASE_COUNT; ++i)
+    {
+        len   += snprintf(buffer+len, sizeof(buffer)-len, " %s=%u", phase_names[i], _ms[i]);
+        total += _ms[i];
+    }
+
+    dlog.info(FPSTR(TAG), F("ENERGY wake=%u rf=%s%s total=%u next=%u next_rf=%s"),
+            _data.wakes, _data.radio ? "on" : "off", buffer, total, sleep_seconds, radio ? "on" : "off");
+
+    _data.radio = radio;
+    if (_valid && !ESP.rtcUserMemoryWrite(_offset, (uint32_t*)&_data, sizeof(_data)))
+    {
+        dlog.error(FPSTR(TAG), F("::end: failed to write RTC memory!"));
+    }
+}
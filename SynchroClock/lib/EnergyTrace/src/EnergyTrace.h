@@ -0,0 +1,70 @@
+/*
+ * EnergyTrace.h
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ * Times each phase of a wake cycle and logs one "ENERGY" line per wake that
+ * energy.py turns into mAh/day.  The RF mode given to the deep sleep is kept in
+ * RTC memory so the next wake knows if the radio was on.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef _ENERGY_TRACE_H_
+#define _ENERGY_TRACE_H_
+#include <Arduino.h>
+
+#define ENERGY_TRACE_MAGIC 0x454e5247 // "ENRG"
+
+typedef enum
+{
+    ENERGY_BOOT = 0,  // ROM/SDK boot till setup() starts
+    ENERGY_INIT,      // setup(): config, clock & RTC interfaces
+    ENERGY_DRIFT,     // drift correction of the RTC
+    ENERGY_WIFI,      // WiFi connect (and config portal)
+    ENERGY_OTA,       // OTA update check
+    ENERGY_NTP,       // NTP poll & RTC update
+    ENERGY_CLOCK,     // syncing the clock to the RTC
+    ENERGY_SLEEP,     // preparing for deep sleep
+    ENERGY_PHASE_COUNT
+} EnergyPhase;
+
+typedef struct energy_trace_data
+{
+    uint32_t magic;
+    uint32_t wakes;    // wakes since power on
+    uint8_t  radio;    // true if the RF mode of the last deep sleep left the radio on
+} EnergyTraceData;
+
+class EnergyTrace
+{
+public:
+    EnergyTrace();
+    void begin(uint32_t rtc_offset);
+    void mark(EnergyPhase phase);
+    void end(uint32_t sleep_seconds, bool radio);
+
+private:
+    uint32_t        _offset;    // RTC memory offset in 4 byte blocks
+    bool            _valid;     // false if the RTC memory was invalid or unusable
+    EnergyTraceData _data;
+    EnergyPhase     _phase;     // current phase
+    uint32_t        _start;     // millis() at the start of the current phase
+    uint32_t        _ms[ENERGY_PHASE_COUNT];
+};
+
+#endif /* _ENERGY_TRACE_H_ */
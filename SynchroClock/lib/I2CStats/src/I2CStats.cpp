@@ -0,0 +1,155 @@
+/*
+ * I2CStats.cpp
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#include "I2CStats.h"
+#include "Logger.h"
+
+static PROGMEM const char TAG[] = "I2CStats";
+
+#define RTC_USER_MEMORY_SIZE 512
+
+static const char* const device_names[I2C_DEVICE_COUNT] =
+{
+    "clock", "rtc"
+};
+
+I2CStatsC::I2CStatsC()
+{
+    _offset = 0;
+    _valid  = false;
+    memset(&_data, 0, sizeof(_data));
+    _data.magic = I2C_STATS_MAGIC;
+}
+
+/**
+ * @brief load the counters from RTC memory, they start over on anything but a wake from deep sleep.
+ *
+ * @param rtc_offset offset in 4 byte blocks of the RTC memory to use
+*/
+void I2CStatsC::begin(uint32_t rtc_offset)
+{
+    _offset = rtc_offset;
+
+    if (_offset * 4 + sizeof(_data) > RTC_USER_MEMORY_SIZE)
+    {
+        dlog.error(FPSTR(TAG), F("::begin: RTC memory offset %u too large!"), _offset);
+    }
+    else
+    {
+        _valid = ESP.rtcUserMemoryRead(_offset, (uint32_t*)&_data, sizeof(_data));
+    }
+
+    if (!_valid || _data.magic != I2C_STATS_MAGIC || ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+    {
+        dlog.info(FPSTR(TAG), F("::begin: no saved counters"));
+        reset();
+    }
+}
+
+/**
+ * @brief count a transaction.
+ *
+ * @param start_us micros() at the start of the transaction
+ * @param ok false if the transaction failed
+*/
+void I2CStatsC::record(I2CDevice device, uint32_t start_us, bool ok)
+{
+    uint32_t us     = micros() - start_us;
+    int      bucket = us < I2C_STATS_FAST_US ? 0 : us < I2C_STATS_SLOW_US ? 1 : 2;
+    count(device, &_data.device[device].histogram[bucket]);
+    if (!ok)
+    {
+        count(device, &_data.device[device].failures);
+    }
+}
+
+void I2CStatsC::retry(I2CDevice device)
+{
+    count(device, &_data.device[device].retries);
+}
+
+void I2CStatsC::clear()
+{
+    if (_data.clears < 0xffff)
+    {
+        _data.clears += 1;
+    }
+}
+
+void I2CStatsC::reset()
+{
+    memset(&_data, 0, sizeof(_data));
+    _data.magic = I2C_STATS_MAGIC;
+}
+
+void I2CStatsC::save()
+{
+    if (_valid && !ESP.rtcUserMemoryWrite(_offset, (uint32_t*)&_data, sizeof(_data)))
+    {
+        dlog.error(FPSTR(TAG), F("::save: failed to write RTC memory!"));
+    }
+}
+
+/**
+ * @brief format the counters as one line for the log and /stats, latency is the count in each
+ * bucket: under I2C_STATS_FAST_US, under I2C_STATS_SLOW_US and slower.
+ *
+ * @return the length of the text
+*/
+int I2CStatsC::format(char* buffer, size_t size)
+{
+    int len = snprintf_P(buffer, size, PSTR("clears=%u"), _data.clears);
+    for (int d = 0; d < I2C_DEVICE_COUNT && len < (int)size; ++d)
+    {
+        const I2CDeviceStats* stats = &_data.device[d];
+        uint32_t transactions = 0;
+        for (int i = 0; i < I2C_STATS_BUCKETS; ++i)
+        {
+            transactions += stats->histogram[i];
+        }
+        len += snprintf_P(buffer+len, size-len, PSTR(" %s: transactions=%u failures=%u retries=%u latency=%u/%u/%u"),
+                device_names[d], transactions, stats->failures, stats->retries,
+                stats->histogram[0], stats->histogram[1], stats->histogram[2]);
+    }
+    return len < (int)size ? len : size - 1;
+}
+
+//
+// add one to the counter, all of the device's counters are halved first if it would overflow so the ratios are kept.
+//
+void I2CStatsC::count(I2CDevice device, uint16_t* counter)
+{
+    if (*counter == 0xffff)
+    {
+        I2CDeviceStats* stats = &_data.device[device];
+        stats->failures /= 2;
+        stats->retries  /= 2;
+        for (int i = 0; i < I2C_STATS_BUCKETS; ++i)
+        {
+            stats->histogram[i] /= 2;
+        }
+    }
+    *counter += 1;
+}
+
+// act like wire library
+I2CStatsC I2CStats = I2CStatsC();
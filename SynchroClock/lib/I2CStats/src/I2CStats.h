@@ -0,0 +1,85 @@
+/*
+ * I2CStats.h
+ *
+ * Copyright 2026 Christopher B. Liebman
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ * Counts the I2C transactions (one start to stop on the bus) of each device
+ * by latency, their failures and retries and the bus clears.  The counters
+ * are kept in RTC memory so they cover every wake since power on.  There is
+ * very little RTC memory left so the counters are 16 bits and a device's
+ * counters are all halved when one of them would overflow.
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: liebman
+ */
+
+#ifndef _I2C_STATS_H_
+#define _I2C_STATS_H_
+#include <Arduino.h>
+
+#define I2C_STATS_MAGIC     0x4932   // "I2"
+#define I2C_STATS_BUCKETS   3        // latency buckets
+#ifndef I2C_STATS_FAST_US
+#define I2C_STATS_FAST_US   500      // transactions under this are in the first bucket
+#endif
+#ifndef I2C_STATS_SLOW_US
+#define I2C_STATS_SLOW_US   2000     // and at or over this in the last
+#endif
+
+typedef enum
+{
+    I2C_DEVICE_CLOCK = 0,
+    I2C_DEVICE_RTC,
+    I2C_DEVICE_COUNT
+} I2CDevice;
+
+typedef struct i2c_device_stats
+{
+    uint16_t failures;
+    uint16_t retries;                        // corrupted or unacknowledged frames sent again
+    uint16_t histogram[I2C_STATS_BUCKETS];   // transactions by latency
+} I2CDeviceStats;
+
+typedef struct i2c_stats_data
+{
+    uint16_t       magic;
+    uint16_t       clears;                   // bus clears
+    I2CDeviceStats device[I2C_DEVICE_COUNT];
+} I2CStatsData;
+
+class I2CStatsC
+{
+public:
+    I2CStatsC();
+    void begin(uint32_t rtc_offset);
+    void record(I2CDevice device, uint32_t start_us, bool ok);
+    void retry(I2CDevice device);
+    void clear();
+    void reset();
+    void save();
+    int  format(char* buffer, size_t size);
+
+private:
+    uint32_t     _offset;    // RTC memory offset in 4 byte blocks
+    bool         _valid;     // false if the RTC memory was unusable
+    I2CStatsData _data;
+
+    void count(I2CDevice device, uint16_t* counter);
+};
+
+extern I2CStatsC I2CStats;
+
+#endif /* _I2C_STATS_H_ */
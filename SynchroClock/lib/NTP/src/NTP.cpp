@@ -11,6 +11,7 @@
 #include "TimeUtils.h"
 #include <math.h>
 #include <stdlib.h>
+#include <ctype.h>
 #ifdef ESP8266
 #include <lwip/def.h> // htonl() & ntohl()
 #endif
@@ -36,6 +37,57 @@ static void dumpNTPPacket(NTPPacket* ntp, const char* label)
     dlog.trace(FPSTR(TAG), F("::%s: xmit_time:  %08x:%08x"), label, ntp->xmit_time.seconds, ntp->xmit_time.fraction);
 }
 
+//
+// convert a reply to host byte order and check that the server is synchronized.
+//
+static int decodeReply(NTPPacket* ntp, const char* label)
+{
+    ntp->delay = ntohl(ntp->delay);
+    ntp->dispersion = ntohl(ntp->dispersion);
+    ntp->ref_time.seconds = ntohl(ntp->ref_time.seconds);
+    ntp->ref_time.fraction = ntohl(ntp->ref_time.fraction);
+    ntp->recv_time.seconds = ntohl(ntp->recv_time.seconds);
+    ntp->recv_time.fraction = ntohl(ntp->recv_time.fraction);
+    ntp->xmit_time.seconds = ntohl(ntp->xmit_time.seconds);
+    ntp->xmit_time.fraction = ntohl(ntp->xmit_time.fraction);
+
+    dumpNTPPacket(ntp, label);
+
+    if (ntp->stratum == 0)
+    {
+        dlog.error(FPSTR(TAG), F("::%s: bad stratum!"), label);
+        return -1;
+    }
+
+    if (getLI(ntp->flags) == LI_NOSYNC)
+    {
+        dlog.warning(FPSTR(TAG), F("::%s: leap indicator indicates NOSYNC!"), label);
+        return -1; /* unsynchronized */
+    }
+    return 0;
+}
+
+//
+// NTP timestamp of us microseconds after the second edge of unix time start, us may be more than a second.
+//
+static uint64_t toLFP(uint32_t start, uint32_t us)
+{
+    return ((uint64_t)toNTP(start) << 32) + ((uint64_t)us << 32) / 1000000;
+}
+
+//
+// offset and delay from a decoded reply, T1 and T4 are our transmit and receive timestamps.
+//
+static void computeSample(const NTPPacket* ntp, uint64_t T1, uint64_t T4, double* offset, double* delay, uint32_t* timestamp)
+{
+    uint64_t T2 = toUINT64(ntp->recv_time);
+    uint64_t T3 = toUINT64(ntp->xmit_time);
+
+    *offset    = LFP2D(((int64_t)(T2 - T1) + (int64_t)(T3 - T4)) / 2);
+    *delay     = LFP2D( (int64_t)(T4 - T1) - (int64_t)(T3 - T2));
+    *timestamp = (uint32_t)(T4 >> 32) + (int32_t)*offset; // timestamp is based on the the "new" time
+}
+
 NTP::NTP(NTPRunTime *runtime, NTPPersist *persist, void (*savePersist)(), int factor)
 {
     _runtime     = runtime;
@@ -43,6 +95,7 @@ NTP::NTP(NTPRunTime *runtime, NTPPersist *persist, void (*savePersist)(), int fa
     _savePersist = savePersist;
     _port        = NTP_PORT;
     _factor      = factor;
+    getDefaultTuning(&_tuning);
     dlog.debug(FPSTR(TAG), F("****** sizeof(NTPRunTime): %d"), sizeof(NTPRunTime));
 }
 
@@ -53,10 +106,98 @@ void NTP::begin(int port)
     dlog.info(FPSTR(TAG), F("::begin: nsamples: %d nadjustments: %d, drift: %f"), _runtime->nsamples, _persist->nadjustments, _persist->drift);
     if (_runtime->nsamples == 0 && _runtime->drifted == 0.0)
     {
-        // if we have no samples and drifted is 0 then we probably had a power cycle so invalidate the
-        // most recent adjustment timestamp.
+        //
+        // if we have no samples and drifted is 0 then we probably had a power cycle.  The RTC kept
+        // time (rtcStopped() is called if it did not) so the last interval is still good as long as
+        // we know how much drift was applied during it.
+        //
+        if (_persist->drifted_stale)
+        {
+            _persist->adjustments[0].timestamp = 0;
+            dlog.info(FPSTR(TAG), F("::begin: power cycle detected! drift applied was lost, marking last adjustment as invalid for drift!"));
+        }
+        else
+        {
+            _runtime->drifted = _persist->drifted;
+            dlog.info(FPSTR(TAG), F("::begin: power cycle detected! restored drifted: %f"), _runtime->drifted);
+        }
+    }
+}
+
+/**
+ * @brief the RTC oscillator stopped (the DS3231 OSF flag), the time it had is wrong.
+ *
+ * Only the interval in progress is affected, the completed adjustments and the drift
+ * computed from them are still good.
+ */
+void NTP::rtcStopped()
+{
+    _runtime->nsamples        = 0;
+    _runtime->drifted         = 0.0;
+    _runtime->drift_timestamp = 0;
+    _runtime->temp_drift      = 0.0;
+    _runtime->temp_poll       = 0;
+
+    // called on every wake till the RTC is set, only save once.
+    if (_persist->adjustments[0].timestamp != 0 || _persist->drifted != 0.0 || _persist->drifted_stale)
+    {
+        dlog.warning(FPSTR(TAG), F("::rtcStopped: marking last adjustment as invalid for drift!"));
         _persist->adjustments[0].timestamp = 0;
-        dlog.info(FPSTR(TAG), F("::begin: power cycle detected! marking last adjustment as invalid for drift!"));
+        savePersist();
+    }
+}
+
+/**
+ * @brief save the persisted data along with the drift applied in the current interval.
+ */
+void NTP::savePersist()
+{
+    _persist->drifted       = _runtime->drifted;
+    _persist->drifted_stale = 0;
+    _savePersist();
+}
+
+void NTP::getDefaultTuning(NTPTuning* tuning)
+{
+    tuning->sample_count          = NTP_SAMPLE_COUNT;
+    tuning->adjustment_count      = NTP_ADJUSTMENT_COUNT;
+    tuning->offset_threshold      = NTP_OFFSET_THRESHOLD;
+    tuning->min_interval          = NTP_MIN_INTERVAL;
+    tuning->max_interval          = NTP_MAX_INTERVAL;
+    tuning->sample_interval       = NTP_SAMPLE_INTERVAL;
+    tuning->unreach_last_interval = NTP_UNREACH_LAST_INTERVAL;
+    tuning->unreach_interval      = NTP_UNREACH_INTERVAL;
+    tuning->request_count         = NTP_REQUEST_COUNT;
+    tuning->peer_count            = NTP_PEER_COUNT;
+    tuning->discipline            = NTP_DISCIPLINE;
+    tuning->kalman_noise          = NTP_KALMAN_FREQ_NOISE;
+}
+
+/**
+ * @brief replace the tuning values, counts are limited to the array sizes.
+*/
+void NTP::setTuning(const NTPTuning* tuning)
+{
+    _tuning = *tuning;
+    if (_tuning.sample_count < 1 || _tuning.sample_count > NTP_SAMPLE_COUNT)
+    {
+        dlog.warning(FPSTR(TAG), F("::setTuning: sample_count %d out of range, using %d"), _tuning.sample_count, NTP_SAMPLE_COUNT);
+        _tuning.sample_count = NTP_SAMPLE_COUNT;
+    }
+    if (_tuning.adjustment_count < 2 || _tuning.adjustment_count > NTP_ADJUSTMENT_COUNT)
+    {
+        dlog.warning(FPSTR(TAG), F("::setTuning: adjustment_count %d out of range, using %d"), _tuning.adjustment_count, NTP_ADJUSTMENT_COUNT);
+        _tuning.adjustment_count = NTP_ADJUSTMENT_COUNT;
+    }
+    if (_tuning.request_count < 1 || _tuning.request_count > NTP_BURST_MAX)
+    {
+        dlog.warning(FPSTR(TAG), F("::setTuning: request_count %u out of range, using %u"), _tuning.request_count, NTP_REQUEST_COUNT);
+        _tuning.request_count = NTP_REQUEST_COUNT;
+    }
+    if (_tuning.peer_count < 1 || _tuning.peer_count > NTP_ADDRESS_COUNT)
+    {
+        dlog.warning(FPSTR(TAG), F("::setTuning: peer_count %d out of range, using %d"), _tuning.peer_count, NTP_PEER_COUNT);
+        _tuning.peer_count = NTP_PEER_COUNT;
     }
 }
 
@@ -86,314 +227,1338 @@ uint32_t NTP::getPollInterval()
         //
         // estimate the time till we apply the next offset
         //
-        if (_runtime->samples[0].timestamp == _runtime->update_timestamp)
+        if (_tuning.discipline == NTP_DISCIPLINE_KALMAN || _runtime->samples[0].timestamp == _runtime->update_timestamp)
         {
             seconds = _runtime->poll_interval;
         }
         else
         {
-            seconds = (NTP_OFFSET_THRESHOLD - fabs(_runtime->samples[0].offset)) / NTP_OFFSET_THRESHOLD * _runtime->poll_interval;
+            seconds = (_tuning.offset_threshold - fabs(_runtime->samples[0].offset)) / _tuning.offset_threshold * _runtime->poll_interval;
         }
         dlog.info(FPSTR(TAG), F("::getPollInterval: seconds: %f"), seconds);
 
-        if (seconds > (NTP_MAX_INTERVAL/_factor))
+        if (seconds > (_tuning.max_interval/_factor))
         {
-            dlog.info(FPSTR(TAG), F("::getPollInterval: maxing interval out at %d seconds!"), NTP_MAX_INTERVAL);
-            seconds = NTP_MAX_INTERVAL/_factor;
+            dlog.info(FPSTR(TAG), F("::getPollInterval: maxing interval out at %u seconds!"), _tuning.max_interval);
+            seconds = _tuning.max_interval/_factor;
         }
-        else if (seconds < (NTP_MIN_INTERVAL/_factor))
+        else if (seconds < (_tuning.min_interval/_factor))
         {
-            dlog.info(FPSTR(TAG), F("::getPollInterval: min interval is %d seconds!!"), NTP_MIN_INTERVAL);
-            seconds = NTP_MIN_INTERVAL/_factor;
+            dlog.info(FPSTR(TAG), F("::getPollInterval: min interval is %u seconds!!"), _tuning.min_interval);
+            seconds = _tuning.min_interval/_factor;
         }
     }
 
-    if (_runtime->nsamples < NTP_SAMPLE_COUNT)
+    if (_tuning.discipline == NTP_DISCIPLINE_KALMAN
+            ? _runtime->kalman.timestamp == 0 || SQRT(_runtime->kalman.p[1][1]) * 1000000.0 > NTP_KALMAN_FREQ_SIGMA
+            : _runtime->nsamples < _tuning.sample_count)
     {
         //
-        // if we don't have all the samples yet, use a very short interval
+        // if we don't have all the samples (or the frequency) yet, use a very short interval
         //
-        dlog.info(FPSTR(TAG), F("::getPollInterval: samples not full, %d seconds!"), NTP_SAMPLE_INTERVAL);
-        seconds = NTP_SAMPLE_INTERVAL / _factor;
+        dlog.info(FPSTR(TAG), F("::getPollInterval: samples not full, %u seconds!"), _tuning.sample_interval);
+        seconds = _tuning.sample_interval / _factor;
     }
     else if ((_runtime->reach & 0x07) == 0)
     {
         //
         // if the last three polls failed use a very short interval
         //
-        dlog.warning(FPSTR(TAG), F("::getPollInterval: last three polls failed, using %d seconds!"), NTP_UNREACH_INTERVAL);
-        seconds =  NTP_UNREACH_INTERVAL / _factor;
+        dlog.warning(FPSTR(TAG), F("::getPollInterval: last three polls failed, using %u seconds!"), _tuning.unreach_interval);
+        seconds =  _tuning.unreach_interval / _factor;
     }
     else if ((_runtime->reach & 0x01) == 0)
     {
         //
         // if the last poll failed then use a shorter interval
         //
-        dlog.warning(FPSTR(TAG), F("::getPollInterval: last poll failed, using %d seconds!"), NTP_UNREACH_LAST_INTERVAL);
-        seconds =  NTP_UNREACH_LAST_INTERVAL / _factor;
+        dlog.warning(FPSTR(TAG), F("::getPollInterval: last poll failed, using %u seconds!"), _tuning.unreach_last_interval);
+        seconds =  _tuning.unreach_last_interval / _factor;
     }
 
     return (uint32_t)seconds;
 }
 
-int NTP::getOffsetUsingDrift(double *offset_result, int (*getTime)(uint32_t *result))
+/**
+ * @brief add the RTC temperature, called on each wake before getOffsetUsingDrift().
+ *
+ * The time since the last temperature is taken to be at the average of the two.  It is added
+ * to the history the model learns from and the drift the model predicts for it is added to the
+ * drift to apply.
+ *
+ * @param now RTC time in seconds
+ * @param celsius RTC temperature
+*/
+void NTP::addTemperature(uint32_t now, float celsius)
+{
+    if (_runtime->temp_timestamp != 0 && now > _runtime->temp_timestamp)
+    {
+        uint32_t seconds = now - _runtime->temp_timestamp;
+        float    mean    = (_runtime->temp_celsius + celsius) / 2;
+        int      bin     = getTemperatureBin(mean);
+        uint32_t minutes = _runtime->temp_minutes[bin] + (seconds + 30) / 60;
+        _runtime->temp_minutes[bin] = minutes > 0xffff ? 0xffff : minutes;
+        _runtime->temp_drift       += (double)seconds * getTemperatureDrift(mean) / 1000000.0;
+    }
+    dlog.debug(FPSTR(TAG), F("::addTemperature: %0.2f C predicted drift: %f"), celsius, _runtime->temp_drift);
+    _runtime->temp_timestamp = now;
+    _runtime->temp_celsius   = celsius;
+}
+
+int NTP::getTemperatureBin(float celsius)
+{
+    int bin = (int)floor((celsius - NTP_TEMP_LOW) / NTP_TEMP_BIN_WIDTH);
+    return max(0, min(bin, NTP_TEMP_BINS - 1));
+}
+
+/**
+ * @brief drift in ppm at a temperature.
+ *
+ * Bins that have not been learned yet are interpolated from the nearest learned bins, with no
+ * learned bins the computed drift is used.
+*/
+double NTP::getTemperatureDrift(float celsius)
+{
+    int bin = getTemperatureBin(celsius);
+    if (_persist->temp_count[bin] != 0)
+    {
+        return _persist->temp_ppm[bin];
+    }
+
+    int lo = bin - 1;
+    while (lo >= 0 && _persist->temp_count[lo] == 0)
+    {
+        --lo;
+    }
+    int hi = bin + 1;
+    while (hi < NTP_TEMP_BINS && _persist->temp_count[hi] == 0)
+    {
+        ++hi;
+    }
+
+    if (lo >= 0 && hi < NTP_TEMP_BINS)
+    {
+        return _persist->temp_ppm[lo] + (_persist->temp_ppm[hi] - _persist->temp_ppm[lo]) * (bin - lo) / (hi - lo);
+    }
+    if (lo >= 0)
+    {
+        return _persist->temp_ppm[lo];
+    }
+    if (hi < NTP_TEMP_BINS)
+    {
+        return _persist->temp_ppm[hi];
+    }
+    return _persist->drift;
+}
+
+/**
+ * @brief true if the temperature drift model should be used by getOffsetUsingDrift().
+*/
+bool NTP::hasTemperatureModel()
+{
+    if (_runtime->temp_timestamp == 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < NTP_TEMP_BINS; ++i)
+    {
+        if (_persist->temp_count[i] != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief learn the drift of the temperature bins from the history since it started.
+ *
+ * The RTC drifted by the offset measured now, less the offset left at the start of the history,
+ * plus all of the adjustments (drift or NTP) made in between.  The error of the drift the model
+ * predicts for the time spent in each bin is shared by the bins in proportion to their time
+ * (normalized LMS), a bin with a single interval just averages its recent drift.
+ *
+ * Samples that are not accepted (delay too big) are skipped and the history is only restarted
+ * when it is long enough to learn from, short polls just add their adjustment.  The model is
+ * reloaded from the EEPROM on every wake so a change too small to be worth saving (less than
+ * NTP_SAVE_PPM, unless the history is NTP_SAVE_INTERVAL long or something else is saved) is
+ * not made, the history keeps growing and is learned from later.
+ *
+ * @param timestamp NTP timestamp of the sample
+ * @param measured offset of the sample
+ * @param adjustment offset the RTC will be adjusted by, 0 if none
+ * @param changed true if NTPPersist will be saved, set to true when the model changed
+*/
+void NTP::updateTemperatureModel(uint32_t timestamp, double measured, double adjustment, bool* changed)
+{
+    if ((_runtime->reach & 0x01) == 0 || _runtime->temp_timestamp == 0)
+    {
+        return;
+    }
+
+    if (_runtime->nsamples > 1 && _runtime->temp_poll != 0 && timestamp > _runtime->temp_poll)
+    {
+        double interval = (double)(timestamp - _runtime->temp_poll);
+        double minutes  = 0.0;
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            minutes += _runtime->temp_minutes[i];
+        }
+
+        if (minutes * 60 < NTP_TEMP_LEARN_INTERVAL)
+        {
+            _runtime->temp_drifted += adjustment;
+            return;
+        }
+
+        //
+        // seconds spent in each bin (scaled to the interval) and the drift predicted for them
+        //
+        double seconds[NTP_TEMP_BINS];
+        double ppm[NTP_TEMP_BINS];
+        double predicted = 0.0;
+        double norm      = 0.0;
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            seconds[i] = _runtime->temp_minutes[i] * interval / minutes;
+            ppm[i]     = getTemperatureDrift(NTP_TEMP_LOW + (i + 0.5) * NTP_TEMP_BIN_WIDTH);
+            predicted += seconds[i] * ppm[i];
+            norm      += seconds[i] * seconds[i];
+        }
+
+        double drift = (measured - _runtime->temp_residual + _runtime->temp_drifted) * 1000000.0;
+        double error = drift - predicted;
+        dlog.info(FPSTR(TAG), F("::updateTemperatureModel: interval: %0.0f drift: %f ppm predicted: %f ppm"),
+                interval, drift / interval, predicted / interval);
+
+        uint8_t count[NTP_TEMP_BINS];
+        bool    save = *changed || interval >= NTP_SAVE_INTERVAL;
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            count[i] = _persist->temp_count[i];
+            if (seconds[i] == 0.0)
+            {
+                continue;
+            }
+            if (count[i] < NTP_TEMP_WEIGHT_MAX)
+            {
+                count[i] += 1;
+                save      = true;
+            }
+            if (fabs(seconds[i] * error / norm / count[i]) >= NTP_SAVE_PPM)
+            {
+                save = true;
+            }
+        }
+
+        if (!save)
+        {
+            dlog.info(FPSTR(TAG), F("::updateTemperatureModel: change too small to save, keeping the history"));
+            _runtime->temp_drifted += adjustment;
+            return;
+        }
+
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            if (seconds[i] == 0.0)
+            {
+                continue;
+            }
+            _persist->temp_count[i] = count[i];
+            _persist->temp_ppm[i]   = ppm[i] + seconds[i] * error / norm / count[i];
+            dlog.info(FPSTR(TAG), F("::updateTemperatureModel: bin: %d (%d C) seconds: %0.0f ppm: %f count: %u"),
+                    i, NTP_TEMP_LOW + i * NTP_TEMP_BIN_WIDTH, seconds[i], _persist->temp_ppm[i], _persist->temp_count[i]);
+        }
+        *changed = true;
+    }
+
+    //
+    // start a new history
+    //
+    _runtime->temp_poll     = timestamp;
+    _runtime->temp_residual = measured - adjustment;
+    _runtime->temp_drifted  = 0.0;
+    memset(_runtime->temp_minutes, 0, sizeof(_runtime->temp_minutes));
+}
+
+/**
+ * @brief trim the RTC oscillator with its aging offset to remove the computed drift.
+ *
+ * With the temperature model the average of the learned bins is trimmed, the rest is left to
+ * the model.  Each LSB of the aging offset changes the drift by about NTP_AGING_PPM so the drift,
+ * the adjustments it was computed from, the Kalman frequency and the temperature model are all
+ * shifted by the expected change.  Any error in the expected change is measured by the following
+ * polls and trimmed again.  Called just after a poll.
+ *
+ * @param aging current aging offset, updated when it is changed
+ * @param setAging callback to write the aging offset, returns 0 if ok
+ * @return 0 if the aging offset was changed, -1 if no change was needed or it failed.
+*/
+int NTP::applyFrequencyTrim(int8_t* aging, int (*setAging)(int8_t aging))
+{
+    double drift = _persist->drift;
+    if (hasTemperatureModel())
+    {
+        int n = 0;
+        drift = 0.0;
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            if (_persist->temp_count[i] != 0)
+            {
+                drift += _persist->temp_ppm[i];
+                n     += 1;
+            }
+        }
+        drift /= n;
+    }
+
+    if (fabs(drift) < NTP_AGING_PPM)
+    {
+        dlog.debug(FPSTR(TAG), F("::applyFrequencyTrim: drift %f ppm is too small to trim"), drift);
+        return -1;
+    }
+
+    int value = *aging - (int)round(drift / NTP_AGING_PPM);
+    value = max(-128, min(value, 127));
+    if (value == *aging)
+    {
+        dlog.warning(FPSTR(TAG), F("::applyFrequencyTrim: aging offset %d is at its limit!"), *aging);
+        return -1;
+    }
+
+    if (setAging((int8_t)value))
+    {
+        dlog.error(FPSTR(TAG), F("::applyFrequencyTrim: failed to set aging offset to %d"), value);
+        return -1;
+    }
+
+    double change = (value - *aging) * NTP_AGING_PPM;
+    dlog.info(FPSTR(TAG), F("::applyFrequencyTrim: drift: %f ppm aging: %d -> %d expected change: %f ppm"),
+            drift, *aging, value, change);
+    *aging = (int8_t)value;
+    shiftDrift(change);
+    savePersist();
+    return 0;
+}
+
+/**
+ * @brief shift everything the drift is computed from by a change in the RTC frequency.
+ *
+ * Past intervals are changed to what they would have been at the new frequency, for intervals
+ * still in progress that is added to what they count as already adjusted.  The drift correction
+ * applied shifts with the drift so the drift estimate (what is left over) is unchanged.
+*/
+void NTP::shiftDrift(double ppm)
+{
+    uint32_t now = _runtime->samples[0].timestamp;
+
+    _persist->drift += ppm;
+
+    for (int i = 0; i <= _persist->nadjustments-2; ++i)
+    {
+        if (_persist->adjustments[i].timestamp != 0 && _persist->adjustments[i+1].timestamp != 0)
+        {
+            uint32_t seconds = _persist->adjustments[i].timestamp - _persist->adjustments[i+1].timestamp;
+            _persist->adjustments[i].adjustment += ppm * seconds / 1000000.0;
+        }
+    }
+    if (_persist->nadjustments > 0 && _persist->adjustments[0].timestamp != 0 && now > _persist->adjustments[0].timestamp)
+    {
+        _runtime->drifted += ppm * (now - _persist->adjustments[0].timestamp) / 1000000.0;
+    }
+
+    if (_runtime->kalman.timestamp != 0)
+    {
+        _runtime->kalman.freq += ppm / 1000000.0;
+    }
+    if (_persist->kalman.timestamp != 0)
+    {
+        _persist->kalman.freq += ppm / 1000000.0;
+    }
+
+    for (int i = 0; i < NTP_TEMP_BINS; ++i)
+    {
+        if (_persist->temp_count[i] != 0)
+        {
+            _persist->temp_ppm[i] += ppm;
+        }
+    }
+    if (_runtime->temp_poll != 0 && now > _runtime->temp_poll)
+    {
+        _runtime->temp_drifted += ppm * (now - _runtime->temp_poll) / 1000000.0;
+    }
+}
+
+int NTP::getOffsetUsingDrift(double *offset_result, int (*getTime)(uint32_t *result, uint32_t *edge))
 {
-    if (_persist->drift == 0.0)
+    bool model = hasTemperatureModel();
+    if (_persist->drift == 0.0 && !model)
     {
         dlog.debug(FPSTR(TAG), F("::getOffsetUsingDrift: not enough data to compute/use drift!"));
         return -1;
     }
 
-    uint32_t now;
-    if (getTime(&now))
+    //
+    // when the last poll worked the next one is within max_interval, if the drift can't reach the
+    // threshold by then there is no need to wait for the edge.
+    //
+    double max_drift = fabs(_persist->drift);
+    if (model)
+    {
+        max_drift = 0.0;
+        for (int i = 0; i < NTP_TEMP_BINS; ++i)
+        {
+            if (_persist->temp_count[i] != 0)
+            {
+                max_drift = max(max_drift, (double)fabs(_persist->temp_ppm[i]));
+            }
+        }
+    }
+    if ((_runtime->reach & 0x01) && max_drift * _tuning.max_interval / 1000000.0 < _tuning.offset_threshold)
+    {
+        dlog.debug(FPSTR(TAG), F("::getOffsetUsingDrift: drift %f ppm too small to reach the threshold"), max_drift);
+        return -1;
+    }
+
+    uint32_t now;
+    if (getTime(&now, NULL))
+    {
+        dlog.error(FPSTR(TAG), F("::getOffsetUsingDrift: failed to getTime() failed!"));
+        return -1;
+    }
+
+    if (_runtime->drift_timestamp == 0)
+    {
+        dlog.debug(FPSTR(TAG), F("::getOffsetUsingDrift: first time, setting initial timestamp! (now=%lu)"), now);
+        _runtime->drift_timestamp = now;
+        _runtime->temp_drift      = 0.0;
+        return -1;
+    }
+
+    if (_runtime->drift_timestamp >= now)
+    {
+        dlog.warning(FPSTR(TAG), F("::getOffsetUsingDrift: timewarped! resetting timestamp! (%lu >= %lu)"), _runtime->drift_timestamp, now);
+        _runtime->drift_timestamp = now;
+        _runtime->temp_drift      = 0.0;
+        return -1;
+    }
+
+    uint32_t interval = now - _runtime->drift_timestamp;
+    double   offset   = (double)interval * _persist->drift / 1000000.0;
+    if (model)
+    {
+        // the drift predicted for the temperature history plus the few seconds since the last temperature
+        offset = _runtime->temp_drift;
+        if (now > _runtime->temp_timestamp)
+        {
+            offset += (double)(now - _runtime->temp_timestamp) * getTemperatureDrift(_runtime->temp_celsius) / 1000000.0;
+        }
+    }
+    dlog.info(FPSTR(TAG), F("::getOffsetUsingDrift: interval: %u drift: %f offset: %f (temperature model: %s)"),
+            interval, _persist->drift, offset, model ? "yes" : "no");
+
+    //
+    // don't use this offset if it does not meet the threshold
+    //
+    if (fabs(offset) < _tuning.offset_threshold)
+    {
+        dlog.info(FPSTR(TAG), F("::getOffsetUsingDrift: offset not big enough for adjust!"));
+        return -1;
+    }
+
+    *offset_result = offset;
+    _runtime->drift_timestamp = now;
+    _runtime->drifted += offset;
+    _runtime->temp_drift = 0.0;
+    _runtime->temp_drifted += offset;
+
+    //
+    // saving every drift step would wear out the flash, only note once per interval that
+    // the saved drifted is out of date.
+    //
+    if (!_persist->drifted_stale)
+    {
+        _persist->drifted_stale = 1;
+        _savePersist();
+    }
+    return 0;
+}
+
+int NTP::makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result, uint32_t *edge))
+{
+    return makeRequest(address, offset, delay, timestamp, getTime, 1);
+}
+
+/**
+ * @brief send a burst of bestof requests NTP_BURST_SPACING ms apart and use the reply with the least delay.
+ *
+ * Replies are collected while the burst is sent and matched to their request by the origin timestamp
+ * (our transmit timestamp echoed by the server) so the whole burst costs about one round trip plus
+ * the spacing.  Stale replies from an earlier request don't match and are dropped.
+ *
+ * @return 0 on success, -1 if there was no valid reply
+*/
+int NTP::makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), const unsigned int bestof)
+{
+    NTPPacket    ntp;
+    uint32_t     start;
+    uint32_t     edge;
+    uint32_t     sent[NTP_BURST_MAX];       // microseconds after the edge
+    bool         answered[NTP_BURST_MAX] = { false };
+    unsigned int count   = min(bestof, NTP_BURST_MAX);
+    unsigned int nsent   = 0;
+    unsigned int replies = 0;
+    bool         valid   = false; // true when we have saved to offset, delay, timestamp at least once
+
+    if (getTime(&start, &edge))
+    {
+        dlog.error(FPSTR(TAG), F("::makeRequest: failed to getTime() failed!"));
+        return -1;
+    }
+
+    dlog.info(FPSTR(TAG), F("::makeRequest: address: %s requests: %u"), address.toString().c_str(), count);
+
+    while (replies < count)
+    {
+        uint32_t now = Timer::getMicros() - edge;
+        if (nsent < count && now >= nsent * NTP_BURST_SPACING * 1000)
+        {
+            sent[nsent++] = now;
+            sendRequest(address, toLFP(start, now));
+            continue;
+        }
+
+        uint32_t deadline = nsent < count ? nsent * NTP_BURST_SPACING * 1000 : sent[nsent-1] + NTP_REPLY_TIMEOUT * 1000;
+        if (now >= deadline)
+        {
+            if (nsent < count)
+            {
+                continue;
+            }
+            break;
+        }
+
+        IPAddress from;
+        int size = _udp.recvFrom(&ntp, sizeof(ntp), &from, (deadline - now + 999) / 1000);
+        uint32_t received = Timer::getMicros() - edge;
+        if (size != sizeof(ntp) || (uint32_t)from != (uint32_t)address)
+        {
+            continue;
+        }
+
+        uint64_t     orig = ((uint64_t)ntohl(ntp.orig_time.seconds) << 32) + ntohl(ntp.orig_time.fraction);
+        unsigned int i    = 0;
+        while (i < nsent && (answered[i] || toLFP(start, sent[i]) != orig))
+        {
+            ++i;
+        }
+
+        if (i == nsent)
+        {
+            dlog.warning(FPSTR(TAG), F("::makeRequest: reply does not match a request, dropped!"));
+            continue;
+        }
+        answered[i] = true;
+        replies    += 1;
+
+        if (decodeReply(&ntp, "makeRequest"))
+        {
+            continue;
+        }
+
+        double   this_offset;
+        double   this_delay;
+        uint32_t this_timestamp;
+        computeSample(&ntp, toLFP(start, sent[i]), toLFP(start, received), &this_offset, &this_delay, &this_timestamp);
+        dlog.info(FPSTR(TAG), F("::makeRequest: request: %u sent: %uus received: %uus offset: %0.6lf delay: %0.6lf"),
+                i, sent[i], received, this_offset, this_delay);
+
+        if (this_delay < 0.0)
+        {
+            dlog.error(FPSTR(TAG), F("::makeRequest: delay (%0.6lf) less than 0!"), this_delay);
+            continue;
+        }
+
+        if (!valid || this_delay < *delay)
+        {
+            *offset    = this_offset;
+            *delay     = this_delay;
+            *timestamp = this_timestamp;
+            valid      = true;
+        }
+    }
+
+    dlog.info(FPSTR(TAG), F("::makeRequest: %u of %u replies in %uus"), replies, count, Timer::getMicros() - edge);
+
+    if (!valid)
+    {
+        return -1;
+    }
+
+    dlog.info(FPSTR(TAG), F("::makeRequest: offset: %0.6lf delay: %0.6lf timestamp: %u"), *offset, *delay, *timestamp);
+    return 0;
+}
+
+/**
+ * @brief send a client request with xmit as the transmit timestamp, the server echoes it as the origin timestamp.
+*/
+int NTP::sendRequest(IPAddress address, uint64_t xmit)
+{
+    NTPPacket ntp;
+    memset((void*) &ntp, 0, sizeof(ntp));
+    ntp.flags              = setLI(LI_NONE) | setVERS(NTP_VERSION) | setMODE(MODE_CLIENT);
+    ntp.poll               = MINPOLL;
+    ntp.xmit_time.seconds  = htonl((uint32_t)(xmit >> 32));
+    ntp.xmit_time.fraction = htonl((uint32_t)xmit);
+
+    dumpNTPPacket(&ntp, "sendRequest");
+
+    if (_udp.sendTo(address, _port, &ntp, sizeof(ntp)) != sizeof(ntp))
+    {
+        dlog.error(FPSTR(TAG), F("::sendRequest: send to %s failed!"), address.toString().c_str());
+        return -1;
+    }
+    return 0;
+}
+
+
+static uint32_t hashServer(const char* server)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    for (const char* p = server; *p; ++p)
+    {
+        hash = (hash ^ (uint8_t)*p) * 16777619U;
+    }
+    return hash;
+}
+
+// return 0 on success or -1 on error.
+int NTP::getOffset(const char* server, double *offsetp, int (*getTime)(uint32_t *result, uint32_t *edge))
+{
+    _runtime->reach <<= 1;
+
+    //
+    // we forget the existing data when we change NTP servers
+    //
+    uint32_t hash = hashServer(server);
+    if (_runtime->server_hash != hash)
+    {
+        _runtime->server_hash = hash;
+        _runtime->ip          = 0;
+        _runtime->nsamples    = 0;
+        dlog.info(FPSTR(TAG), F("::getOffset: NEW server: %s"), server);
+    }
+
+    //
+    // cached addresses belong to a server name.
+    //
+    if (_persist->server_hash != hash)
+    {
+        memset(_persist->addresses, 0, sizeof(_persist->addresses));
+        _persist->server_hash = hash;
+    }
+
+    double   offset;
+    double   delay;
+    uint32_t timestamp;
+    bool     dns     = false; // true once we have done a DNS lookup
+    bool     changed = false; // true if the address cache needs to be saved
+    int      err;
+
+    if (_tuning.peer_count > 1)
+    {
+        err = pollPeers(server, &offset, &delay, &timestamp, getTime, &dns, &changed);
+    }
+    else
+    {
+        err = pollServer(server, &offset, &delay, &timestamp, getTime, &dns, &changed);
+    }
+
+    if (err)
+    {
+        if (changed)
+        {
+            savePersist();
+        }
+        return err;
+    }
+
+    //
+    // the address answered, refresh it with DNS if it has expired.
+    //
+    uint32_t now = toEPOCH(timestamp);
+    NTPAddress* entry = findAddress(_runtime->ip);
+    if (entry == NULL)
+    {
+        changed |= cacheAddress(_runtime->ip, now);
+    }
+    else
+    {
+        entry->fails = 0;
+        if (entry->expires == 0)
+        {
+            entry->expires = now + NTP_ADDRESS_TTL;
+            changed = true;
+        }
+        else if (entry->expires < now && !dns)
+        {
+            dlog.info(FPSTR(TAG), F("::getOffset: address expired, refreshing"));
+            entry->expires = 0; // refreshed by the lookup if still valid, otherwise first to be replaced
+            uint32_t ip;
+            lookupAddress(server, now, &ip);
+            changed = true;
+        }
+    }
+
+    dlog.info(FPSTR(TAG), F("::getOffset: nsamples: %d nadjustments: %d"), _runtime->nsamples, _persist->nadjustments);
+
+    double measured = offset;
+    if (_tuning.discipline == NTP_DISCIPLINE_KALMAN)
+    {
+        err = processKalman(timestamp, &offset, delay, &changed);
+    }
+    else
+    {
+        err = process(timestamp, offset, delay);
+    }
+    updateTemperatureModel(timestamp, measured, err ? 0.0 : offset, &changed);
+
+    //
+    // at most one EEPROM commit per poll for the address cache, Kalman state and temperature model.
+    //
+    if (changed)
+    {
+        savePersist();
+    }
+
+    if (err)
+    {
+        dlog.error(FPSTR(TAG), F("::getOffset: process returns: %d"), err);
+        return err;
+    }
+
+    *offsetp = offset;
+
+    //
+    // set the update and drift timestamps.
+    //
+    _runtime->update_timestamp = timestamp;
+    _runtime->drift_timestamp  = toEPOCH(timestamp);
+    _runtime->temp_drift       = 0.0;
+    return 0;
+}
+
+/**
+ * @brief poll a single server.
+ *
+ * Try the current address, then the other cached addresses and finally DNS, each failure is
+ * counted against the address so the next poll starts with one that is still answering.
+ *
+ * @return 0 on success, -1 if no address answered
+*/
+int NTP::pollServer(const char* server, double* offset, double* delay, uint32_t* timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), bool* dns, bool* changed)
+{
+    int      err     = -1;
+    uint32_t tried[NTP_ADDRESS_COUNT+1] = { 0 };  // addresses tried during this poll
+    int      ntried  = 0;
+
+    for (int tries = 0; tries <= NTP_ADDRESS_COUNT && err; ++tries)
+    {
+        if (_runtime->ip == 0 && getCachedAddress(&_runtime->ip, tried, ntried))
+        {
+            if (*dns)
+            {
+                break;
+            }
+            *dns = true;
+            uint32_t ip;
+            if (lookupAddress(server, 0, &ip))
+            {
+                break;
+            }
+            *changed = true;
+
+            // DNS gave us one we already tried
+            if (getCachedAddress(&_runtime->ip, tried, ntried))
+            {
+                break;
+            }
+        }
+        tried[ntried++] = _runtime->ip;
+
+        IPAddress address = _runtime->ip;
+        dlog.info(FPSTR(TAG), F("::pollServer: using server: %s address: %s"), server, address.toString().c_str());
+
+        //
+        // Ping the server first, we don't care about the result.  This updates any
+        // ARP cache etc.  Without this we see a varying 20ms -> 80ms delay on the
+        // NTP packet.
+        //
+        SimplePing ping;
+        ping.ping(address);
+
+        err = makeRequest(address, offset, delay, timestamp, getTime, _tuning.request_count);
+        if (err)
+        {
+            dlog.error(FPSTR(TAG), F("::pollServer: makeRequest to %s returns: %d"), address.toString().c_str(), err);
+            NTPAddress* entry = findAddress(_runtime->ip);
+            if (entry != NULL && entry->fails < 255)
+            {
+                entry->fails += 1;
+            }
+            _runtime->ip = 0;
+        }
+    }
+
+    return err;
+}
+
+//
+// pool servers are numbered (0.pool.ntp.org, 1.pool.ntp.org, ...) and each name gives different
+// addresses, other names are used as is.
+//
+static void peerName(const char* server, int index, char* name, size_t size)
+{
+    if (isdigit(server[0]) && server[1] == '.')
+    {
+        snprintf(name, size, "%d%s", index, server+1);
+    }
+    else
+    {
+        strncpy(name, server, size-1);
+        name[size-1] = '\0';
+    }
+}
+
+/**
+ * @brief poll up to peer_count servers at once and combine the ones that agree.
+ *
+ * The cached addresses are used first and DNS fills in any that are missing.  Falsetickers
+ * and peers that don't answer are counted as failures so they are replaced over time.
+ *
+ * @return 0 on success, -1 if no peers answered or there was no majority
+*/
+int NTP::pollPeers(const char* server, double* offset, double* delay, uint32_t* timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), bool* dns, bool* changed)
+{
+    NTPPeer  peers[NTP_ADDRESS_COUNT];
+    uint32_t ips[NTP_ADDRESS_COUNT];
+    int      npeers = 0;
+
+    while (npeers < _tuning.peer_count && getCachedAddress(&ips[npeers], ips, npeers) == 0)
+    {
+        ++npeers;
+    }
+
+    for (int i = 0; npeers < _tuning.peer_count && i < _tuning.peer_count; ++i)
+    {
+        char     name[NTP_SERVER_LENGTH];
+        uint32_t ip;
+        peerName(server, i, name, sizeof(name));
+        *dns = true;
+        if (lookupAddress(name, 0, &ip))
+        {
+            continue;
+        }
+        *changed = true;
+
+        int j = 0;
+        while (j < npeers && ips[j] != ip)
+        {
+            ++j;
+        }
+        if (j == npeers)
+        {
+            ips[npeers++] = ip;
+        }
+    }
+
+    if (npeers == 0)
+    {
+        dlog.error(FPSTR(TAG), F("::pollPeers: no addresses for %s!"), server);
+        return -1;
+    }
+
+    for (int i = 0; i < npeers; ++i)
+    {
+        memset(&peers[i], 0, sizeof(NTPPeer));
+        peers[i].ip = ips[i];
+
+        // see pollServer()
+        SimplePing ping;
+        ping.ping(IPAddress(peers[i].ip));
+    }
+
+    int survivors = 0;
+    if (makeRequests(peers, npeers, getTime) > 0)
+    {
+        survivors = selectPeers(peers, npeers);
+        if (survivors > 0)
+        {
+            survivors = clusterPeers(peers, npeers, survivors);
+            combinePeers(peers, npeers, offset, delay, timestamp);
+        }
+        else
+        {
+            dlog.warning(FPSTR(TAG), F("::pollPeers: no majority of peers agree!"));
+        }
+    }
+
+    for (int i = 0; i < npeers; ++i)
+    {
+        NTPAddress* entry = findAddress(peers[i].ip);
+        if (entry == NULL)
+        {
+            continue;
+        }
+
+        if (peers[i].truechimer)
+        {
+            entry->fails = 0;
+            if (entry->expires == 0)
+            {
+                entry->expires = toEPOCH(*timestamp) + NTP_ADDRESS_TTL;
+                *changed = true;
+            }
+        }
+        else if (entry->fails < 255)
+        {
+            entry->fails += 1;
+            *changed |= peers[i].valid; // falsetickers are rare, remember them
+        }
+    }
+
+    if (survivors == 0)
+    {
+        _runtime->ip = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief send a request to every peer then collect the replies as they arrive.
+ *
+ * @return number of valid replies
+*/
+int NTP::makeRequests(NTPPeer* peers, int npeers, int (*getTime)(uint32_t *result, uint32_t *edge))
+{
+    NTPPacket ntp;
+    uint32_t  start;
+    uint32_t  edge;
+
+    if (getTime(&start, &edge))
+    {
+        dlog.error(FPSTR(TAG), F("::makeRequests: failed to getTime() failed!"));
+        return 0;
+    }
+
+    for (int i = 0; i < npeers; ++i)
+    {
+        peers[i].sent = Timer::getMicros() - edge;
+        sendRequest(peers[i].ip, toLFP(start, peers[i].sent));
+    }
+
+    int      replies = 0;
+    uint32_t elapsed;
+    while (replies < npeers && (elapsed = Timer::getMicros() - edge) < NTP_REPLY_TIMEOUT * 1000)
+    {
+        IPAddress from;
+        int size = _udp.recvFrom(&ntp, sizeof(ntp), &from, (NTP_REPLY_TIMEOUT * 1000 - elapsed + 999) / 1000);
+        uint32_t received = Timer::getMicros() - edge;
+        if (size != sizeof(ntp))
+        {
+            continue;
+        }
+
+        uint64_t orig = ((uint64_t)ntohl(ntp.orig_time.seconds) << 32) + ntohl(ntp.orig_time.fraction);
+        NTPPeer* peer = NULL;
+        for (int i = 0; i < npeers; ++i)
+        {
+            if (peers[i].ip == (uint32_t)from && !peers[i].valid && toLFP(start, peers[i].sent) == orig)
+            {
+                peer = &peers[i];
+                break;
+            }
+        }
+
+        if (peer == NULL)
+        {
+            dlog.warning(FPSTR(TAG), F("::makeRequests: unexpected reply from %s"), from.toString().c_str());
+            continue;
+        }
+
+        if (decodeReply(&ntp, "makeRequests"))
+        {
+            continue;
+        }
+
+        uint32_t timestamp;
+        computeSample(&ntp, toLFP(start, peer->sent), toLFP(start, received), &peer->offset, &peer->delay, &timestamp);
+        peer->distance = peer->delay / 2 + FP2D(ntp.delay) / 2 + FP2D(ntp.dispersion);
+        peer->seconds  = (uint32_t)(toLFP(start, received) >> 32);
+
+        IPAddress address = peer->ip;
+        dlog.info(FPSTR(TAG), F("::makeRequests: address: %s offset: %0.6lf delay: %0.6lf distance: %0.6lf"),
+                address.toString().c_str(), peer->offset, peer->delay, peer->distance);
+
+        if (peer->delay < 0.0)
+        {
+            dlog.error(FPSTR(TAG), F("::makeRequests: delay (%0.6lf) less than 0!"), peer->delay);
+            continue;
+        }
+
+        peer->valid = true;
+        replies    += 1;
+    }
+
+    dlog.info(FPSTR(TAG), F("::makeRequests: %d of %d peers replied"), replies, npeers);
+    return replies;
+}
+
+typedef struct ntp_edge
+{
+    double edge;
+    int    type;    // -1 lower, 0 midpoint, +1 upper
+} NTPEdge;
+
+/**
+ * @brief mark the truechimers (RFC 5905 selection algorithm).
+ *
+ * Find the smallest interval containing points from the correctness intervals of a majority
+ * of the peers, allowing for fewer than half of them to be falsetickers.
+ *
+ * @return number of truechimers, 0 if there is no majority
+*/
+int NTP::selectPeers(NTPPeer* peers, int npeers)
+{
+    NTPEdge edges[NTP_ADDRESS_COUNT*3];
+    int     nedges = 0;
+    int     n      = 0;
+
+    for (int i = 0; i < npeers; ++i)
+    {
+        if (!peers[i].valid)
+        {
+            continue;
+        }
+        edges[nedges].edge   = peers[i].offset - peers[i].distance;
+        edges[nedges++].type = -1;
+        edges[nedges].edge   = peers[i].offset;
+        edges[nedges++].type = 0;
+        edges[nedges].edge   = peers[i].offset + peers[i].distance;
+        edges[nedges++].type = 1;
+        n += 1;
+    }
+
+    // insertion sort, there are only a few
+    for (int i = 1; i < nedges; ++i)
     {
-        dlog.error(FPSTR(TAG), F("::getOffsetUsingDrift: failed to getTime() failed!"));
-        return -1;
+        NTPEdge e = edges[i];
+        int     j = i;
+        while (j > 0 && (edges[j-1].edge > e.edge || (edges[j-1].edge == e.edge && edges[j-1].type > e.type)))
+        {
+            edges[j] = edges[j-1];
+            --j;
+        }
+        edges[j] = e;
     }
 
-    if (_runtime->drift_timestamp == 0)
+    double low   = 0.0;
+    double high  = 0.0;
+    bool   found = false;
+    for (int allow = 0; 2 * allow < n && !found; ++allow)
     {
-        dlog.debug(FPSTR(TAG), F("::getOffsetUsingDrift: first time, setting initial timestamp! (now=%lu)"), now);
-        _runtime->drift_timestamp = now;
-        return -1;
+        int  outside  = 0;  // midpoints outside of the interval
+        int  chime    = 0;
+        bool has_low  = false;
+        bool has_high = false;
+
+        for (int i = 0; i < nedges; ++i)
+        {
+            chime -= edges[i].type;
+            if (chime >= n - allow)
+            {
+                low     = edges[i].edge;
+                has_low = true;
+                break;
+            }
+            if (edges[i].type == 0)
+            {
+                outside += 1;
+            }
+        }
+
+        chime = 0;
+        for (int i = nedges - 1; i >= 0; --i)
+        {
+            chime += edges[i].type;
+            if (chime >= n - allow)
+            {
+                high     = edges[i].edge;
+                has_high = true;
+                break;
+            }
+            if (edges[i].type == 0)
+            {
+                outside += 1;
+            }
+        }
+
+        found = has_low && has_high && outside <= allow && low <= high;
     }
 
-    if (_runtime->drift_timestamp >= now)
+    if (!found)
     {
-        dlog.warning(FPSTR(TAG), F("::getOffsetUsingDrift: timewarped! resetting timestamp! (%lu >= %lu)"), _runtime->drift_timestamp, now);
-        _runtime->drift_timestamp = now;
-        return -1;
+        return 0;
     }
 
-    uint32_t interval = now - _runtime->drift_timestamp;
-    double   offset   = (double)interval * _persist->drift / 1000000.0;
-    dlog.info(FPSTR(TAG), F("::getOffsetUsingDrift: interval: %u drift: %f offset: %f"), interval, _persist->drift, offset);
-
-    //
-    // don't use this offset if it does not meet the threshold
-    //
-    if (fabs(offset) < NTP_OFFSET_THRESHOLD)
+    int truechimers = 0;
+    for (int i = 0; i < npeers; ++i)
     {
-        dlog.info(FPSTR(TAG), F("::getOffsetUsingDrift: offset not big enough for adjust!"));
-        return -1;
+        if (!peers[i].valid)
+        {
+            continue;
+        }
+
+        IPAddress address = peers[i].ip;
+        if (peers[i].offset - peers[i].distance <= high && peers[i].offset + peers[i].distance >= low)
+        {
+            peers[i].truechimer = true;
+            truechimers += 1;
+        }
+        else
+        {
+            dlog.warning(FPSTR(TAG), F("::selectPeers: falseticker: %s offset: %0.6lf"), address.toString().c_str(), peers[i].offset);
+        }
     }
 
-    *offset_result = offset;
-    _runtime->drift_timestamp = now;
-    _runtime->drifted += offset;
-    return 0;
+    dlog.info(FPSTR(TAG), F("::selectPeers: interval: [%0.6lf, %0.6lf] truechimers: %d of %d"), low, high, truechimers, n);
+    return truechimers;
 }
 
-int NTP::makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result))
+/**
+ * @brief prune outliers from the truechimers (RFC 5905 cluster algorithm).
+ *
+ * Drop the survivor with the largest selection jitter (rms offset difference to the others)
+ * until that is no more than the smallest peer jitter.  With one sample per peer half the
+ * delay stands in for the peer jitter.
+ *
+ * @return number of survivors
+*/
+int NTP::clusterPeers(NTPPeer* peers, int npeers, int survivors)
 {
-    Timer timer;
-    NTPTime now;
-    NTPPacket ntp;
-
-    memset((void*) &ntp, 0, sizeof(ntp));
-    ntp.flags = setLI(LI_NONE) | setVERS(NTP_VERSION) | setMODE(MODE_CLIENT);
-    ntp.poll  = MINPOLL;
-
-    uint32_t start;
-    if (getTime(&start))
+    for (int i = 0; i < npeers; ++i)
     {
-        dlog.error(FPSTR(TAG), F("::makeRequest: failed to getTime() failed!"));
-        return -1;
+        peers[i].survivor = peers[i].truechimer;
     }
 
-    timer.start();
-
-    now.seconds = toNTP(start);
-    now.fraction = 0;
-
-    ntp.orig_time = now;
-
-    // put non-zero timestamps in network byte order
-    ntp.orig_time.seconds = htonl(ntp.orig_time.seconds);
-    ntp.orig_time.fraction = htonl(ntp.orig_time.fraction);
-
-    dumpNTPPacket(&ntp, "makeRequest");
+    while (survivors > NTP_CLUSTER_MIN)
+    {
+        int    worst      = -1;
+        double max_jitter = 0.0;
+        double min_jitter = 0.0;
+        bool   first      = true;
+        for (int i = 0; i < npeers; ++i)
+        {
+            if (!peers[i].survivor)
+            {
+                continue;
+            }
 
-    _udp.open(address, _port);
-    _udp.send(&ntp, sizeof(ntp));
+            double sum = 0.0;
+            for (int j = 0; j < npeers; ++j)
+            {
+                if (j != i && peers[j].survivor)
+                {
+                    sum += SQUARE(peers[j].offset - peers[i].offset);
+                }
+            }
 
-    memset(&ntp, 0, sizeof(ntp));
+            double jitter = SQRT(sum / (survivors - 1));
+            if (worst < 0 || jitter > max_jitter)
+            {
+                max_jitter = jitter;
+                worst      = i;
+            }
 
-    int size = _udp.recv(&ntp, sizeof(ntp), 1000);
-    uint32_t duration = timer.stop();
+            if (first || peers[i].delay / 2 < min_jitter)
+            {
+                min_jitter = peers[i].delay / 2;
+            }
+            first = false;
+        }
 
-    dlog.info(FPSTR(TAG), F("::makeRequest: used server: %s address: %s"), _runtime->server, address.toString().c_str());
-    dlog.info(FPSTR(TAG), F("::makeRequest: packet size: %d"), size);
-    dlog.info(FPSTR(TAG), F("::makeRequest: duration %ums"), duration);
+        if (max_jitter <= min_jitter)
+        {
+            break;
+        }
 
-    if (size != 48)
-    {
-        dlog.error(FPSTR(TAG), F("::makeRequest: bad packet!"));
-        return -1;
+        IPAddress address = peers[worst].ip;
+        dlog.info(FPSTR(TAG), F("::clusterPeers: pruned: %s offset: %0.6lf jitter: %0.6lf"), address.toString().c_str(), peers[worst].offset, max_jitter);
+        peers[worst].survivor = false;
+        survivors -= 1;
     }
 
-    ntp.delay = ntohl(ntp.delay);
-    ntp.dispersion = ntohl(ntp.dispersion);
-    ntp.ref_time.seconds = ntohl(ntp.ref_time.seconds);
-    ntp.ref_time.fraction = ntohl(ntp.ref_time.fraction);
-    ntp.recv_time.seconds = ntohl(ntp.recv_time.seconds);
-    ntp.recv_time.fraction = ntohl(ntp.recv_time.fraction);
-    ntp.xmit_time.seconds = ntohl(ntp.xmit_time.seconds);
-    ntp.xmit_time.fraction = ntohl(ntp.xmit_time.fraction);
-    ntp.orig_time = now; // many servers don't seem to copy this value to the reply packet :-(
-
-    dumpNTPPacket(&ntp, "makeRequest");
+    return survivors;
+}
 
-    //
-    // assumes start at second start and less than 1 second duration
-    //
-    now.fraction = ms2fraction(duration);
+/**
+ * @brief combine the survivors weighted by root distance, the closest one becomes the system peer.
+*/
+void NTP::combinePeers(NTPPeer* peers, int npeers, double* offset, double* delay, uint32_t* timestamp)
+{
+    NTPPeer* system = NULL;
+    double   sum    = 0.0;
+    double   weight = 0.0;
 
-    if (ntp.stratum == 0)
+    for (int i = 0; i < npeers; ++i)
     {
-        dlog.error(FPSTR(TAG), F("::makeRequest: bad stratum!"));
-        return -1;
-    }
+        if (!peers[i].survivor)
+        {
+            continue;
+        }
 
-    if (getLI(ntp.flags) == LI_NOSYNC)
-    {
-        dlog.warning(FPSTR(TAG), F("::makeRequest: leap indicator indicates NOSYNC!"));
-        return -1; /* unsynchronized */
+        double w = 1.0 / max(peers[i].distance, 0.001); // don't let a zero distance take over
+        sum     += w * peers[i].offset;
+        weight  += w;
+        if (system == NULL || peers[i].distance < system->distance)
+        {
+            system = &peers[i];
+        }
     }
 
-    uint64_t T1 = toUINT64(ntp.orig_time);
-    uint64_t T2 = toUINT64(ntp.recv_time);
-    uint64_t T3 = toUINT64(ntp.xmit_time);
-    uint64_t T4 = toUINT64(now);
+    *offset      = sum / weight;
+    *delay       = system->delay;
+    *timestamp   = system->seconds + (int32_t)*offset; // timestamp is based on the the "new" time
+    _runtime->ip = system->ip;
 
-    *offset     = LFP2D(((int64_t)(T2 - T1) + (int64_t)(T3 - T4)) / 2);
-    *delay      = LFP2D( (int64_t)(T4 - T1) - (int64_t)(T3 - T2));
-    *timestamp  = now.seconds + (int32_t)*offset; // timestamp is based on the the "new" time
-    dlog.info(FPSTR(TAG), F("::makeRequest: offset: %0.6lf delay: %0.6lf timestamp: %u (now: %u)"), *offset, *delay, *timestamp, now.seconds);
+    IPAddress address = system->ip;
+    dlog.info(FPSTR(TAG), F("::combinePeers: system peer: %s offset: %0.6lf delay: %0.6lf"), address.toString().c_str(), *offset, *delay);
+}
 
-    //
-    // this can happen if we timeout on a previous request and the delayed response 
-    // arrives after we have sent another request!
-    if (*delay < 0.0)
+/**
+ * @brief resolve the server name and add the address to the cache.
+ *
+ * @param now unix time or 0 if not known
+ * @param ip set to the resolved address
+ * @return 0 on success, -1 on DNS failure
+*/
+int NTP::lookupAddress(const char* server, uint32_t now, uint32_t* ip)
+{
+    IPAddress address;
+    if (!WiFi.hostByName(server, address))
     {
-        dlog.error(FPSTR(TAG), F("::makeRequest: delay (%0.6lf) less than 0!"), *delay);
+        dlog.error(FPSTR(TAG), F("::lookupAddress: DNS lookup on %s failed!"), server);
         return -1;
     }
+
+    dlog.info(FPSTR(TAG), F("::lookupAddress: server: %s address: %s"), server, address.toString().c_str());
+    cacheAddress(address, now);
+    *ip = address;
     return 0;
 }
 
-int NTP::makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result), const unsigned int bestof)
+/**
+ * @brief pick the cached address with the fewest failures that has not failed too often
+ * and has not already been tried.
+ *
+ * @return 0 on success, -1 if there is no usable address
+*/
+int NTP::getCachedAddress(uint32_t* ip, const uint32_t* tried, int ntried)
 {
-    double this_offset;
-    double this_delay;
-    uint32_t this_timestamp;
-    bool valid = false; // true when we have saved to offset, delay, timestamp at least once
-    for (unsigned int i = 0; i < bestof; ++i)
+    NTPAddress* best = NULL;
+    for (int i = 0; i < NTP_ADDRESS_COUNT; ++i)
     {
-        int err = makeRequest(address, &this_offset, &this_delay, &this_timestamp, getTime);
-        if (err)
+        NTPAddress* entry = &_persist->addresses[i];
+        if (entry->ip == 0 || entry->fails >= NTP_ADDRESS_MAX_FAILS || (best != NULL && entry->fails >= best->fails))
         {
             continue;
         }
 
-        if (!valid || this_delay < *delay)
+        int j = 0;
+        while (j < ntried && tried[j] != entry->ip)
         {
-            *offset = this_offset;
-            *delay = this_delay;
-            *timestamp = this_timestamp;
-            valid = true;
+            ++j;
+        }
+        if (j == ntried)
+        {
+            best = entry;
         }
     }
-    return valid ? 0 : -1;
-}
 
+    if (best == NULL)
+    {
+        return -1;
+    }
+    *ip = best->ip;
+    return 0;
+}
 
-// return 0 on success or -1 on error.
-int NTP::getOffset(const char* server, double *offsetp, int (*getTime)(uint32_t *result))
+NTPAddress* NTP::findAddress(uint32_t ip)
 {
-    _runtime->reach <<= 1;
-
-    IPAddress address = _runtime->ip;
-
-    //
-    // if we don't have an ip address or the server name does not match the the one we have one or
-    // its not reachable then lookup a new one.
-    //
-    if (_runtime->ip == 0 || strncmp(server, _runtime->server, NTP_SERVER_LENGTH) != 0 || _runtime->reach == 0)
+    for (int i = 0; i < NTP_ADDRESS_COUNT; ++i)
     {
-        dlog.trace(FPSTR(TAG), F("::getOffset: updating server and address!"));
-        if (!WiFi.hostByName(server, address))
+        if (ip != 0 && _persist->addresses[i].ip == ip)
         {
-            dlog.error(FPSTR(TAG), F("::getOffset: DNS lookup on %s failed!"), server);
-            return -1;
+            return &_persist->addresses[i];
         }
-
-        memset((void*)_runtime->server, 0, sizeof(_runtime->server ));
-        strncpy(_runtime->server, server, NTP_SERVER_LENGTH-1);
-        _runtime->ip = address;
-
-        dlog.info(FPSTR(TAG), F("::getOffset: NEW server: %s address: %s"), server, address.toString().c_str());
-
-        // we forget the existing data when we change NTP servers
-        _runtime->nsamples = 0;
     }
+    return NULL;
+}
 
-    //
-    // Ping the server first, we don't care about the result.  This updates any
-    // ARP cache etc.  Without this we see a varying 20ms -> 80ms delay on the
-    // NTP packet.
-    //
-    SimplePing ping;
-    ping.ping(address);
-
-    double offset;
-    double delay;
-    uint32_t timestamp;
-
-    int err = makeRequest(address, &offset, &delay, &timestamp, getTime, NTP_REQUEST_COUNT);
-    if (err)
+/**
+ * @brief add or refresh an address, replacing the entry with the most failures (or the oldest).
+ *
+ * @return true if the cache changed
+*/
+bool NTP::cacheAddress(uint32_t ip, uint32_t now)
+{
+    uint32_t    expires = now ? now + NTP_ADDRESS_TTL : 0;
+    NTPAddress* entry   = findAddress(ip);
+    if (entry == NULL)
     {
-        dlog.error(FPSTR(TAG), F("::getOffset: makeRequest returns: %d"), err);
-        return err;
+        entry = &_persist->addresses[0];
+        for (int i = 1; i < NTP_ADDRESS_COUNT; ++i)
+        {
+            NTPAddress* e = &_persist->addresses[i];
+            if (entry->ip == 0)
+            {
+                break;
+            }
+            if (e->ip == 0 || e->fails > entry->fails || (e->fails == entry->fails && e->expires < entry->expires))
+            {
+                entry = e;
+            }
+        }
+        entry->ip = ip;
     }
-
-    dlog.info(FPSTR(TAG), F("::getOffset: nsamples: %d nadjustments: %d"), _runtime->nsamples, _persist->nadjustments);
-
-    err = process(timestamp, offset, delay);
-    if (err)
+    else if (entry->fails == 0 && entry->expires == expires)
     {
-        dlog.error(FPSTR(TAG), F("::getOffset: process returns: %d"), err);
-        return err;
+        return false;
     }
 
-    *offsetp = offset;
-
-    //
-    // set the update and drift timestamps.
-    //
-    _runtime->update_timestamp = timestamp;
-    _runtime->drift_timestamp  = toEPOCH(timestamp);
-    return 0;
+    entry->fails   = 0;
+    entry->expires = expires;
+    return true;
 }
 
 /**
- * @brief process the result of NTP request
- * 
- * Add offiset/delay/timestamp to samples. Update sample mean, standard deviation,
- * reacability, and drift estimate.  Save as adjustent if the dealay was not more
- * than one standard deviation from mean.
+ * @brief add offset/delay/timestamp to samples. Update sample mean, standard deviation
+ * and reachability.
  *
- * @param timestamp NTP timestamp of sample
- * @param offset time offset
- * @param delay network delay of retrieving sample
- * @return 0 if sample should be used to adjust clock, -1 otherwise.
+ * @return 0 if the delay was not more than one standard deviation from mean, -1 otherwise.
 */
-int NTP::process(uint32_t timestamp, double offset, double delay)
+int NTP::addSample(uint32_t timestamp, double offset, double delay)
 {
     int i;
+    if (_runtime->nsamples > _tuning.sample_count)
+    {
+        _runtime->nsamples = _tuning.sample_count;
+    }
     for (i = _runtime->nsamples - 1; i >= 0; --i)
     {
-        if (i == NTP_SAMPLE_COUNT - 1)
+        if (i == _tuning.sample_count - 1)
         {
             continue;
         }
@@ -410,7 +1575,7 @@ int NTP::process(uint32_t timestamp, double offset, double delay)
             0, _runtime->samples[0].offset, _runtime->samples[0].delay, _runtime->samples[0].timestamp,
             TimeUtils::time2str(toEPOCH(_runtime->samples[0].timestamp)));
 
-    if (_runtime->nsamples < NTP_SAMPLE_COUNT)
+    if (_runtime->nsamples < _tuning.sample_count)
     {
         _runtime->nsamples += 1;
     }
@@ -454,6 +1619,26 @@ int NTP::process(uint32_t timestamp, double offset, double delay)
     // good delay - we can mark this as reachable
     //
     _runtime->reach |= 1;
+    return 0;
+}
+
+/**
+ * @brief process the result of NTP request
+ * 
+ * Add the sample and update the drift estimate.  Save as adjustent if the dealay was not more
+ * than one standard deviation from mean.
+ *
+ * @param timestamp NTP timestamp of sample
+ * @param offset time offset
+ * @param delay network delay of retrieving sample
+ * @return 0 if sample should be used to adjust clock, -1 otherwise.
+*/
+int NTP::process(uint32_t timestamp, double offset, double delay)
+{
+    if (addSample(timestamp, offset, delay))
+    {
+        return -1;
+    }
 
     //
     // update drift estimate
@@ -463,7 +1648,7 @@ int NTP::process(uint32_t timestamp, double offset, double delay)
     //
     // don't use this offset if it does not meet the threshold
     //
-    if (fabs(offset) < NTP_OFFSET_THRESHOLD)
+    if (fabs(offset) < _tuning.offset_threshold)
     {
         dlog.info(FPSTR(TAG), F("::process: offset not big enough for adjust!"));
         return -1;
@@ -472,7 +1657,7 @@ int NTP::process(uint32_t timestamp, double offset, double delay)
     //
     // save adjustment samples & compute drift
     //
-    clock();
+    clock(offset);
 
     //
     // sample ok to use.
@@ -480,21 +1665,173 @@ int NTP::process(uint32_t timestamp, double offset, double delay)
     return 0;
 }
 
+/**
+ * @brief process the result of NTP request with the Kalman filter.
+ *
+ * The state is the RTC offset and frequency error.  Between updates the offset grows by
+ * the frequency less the drift corrections that were applied.  Samples are weighted by how
+ * much their delay exceeds the minimum delay seen, the offset error of a sample is bounded
+ * by half of its extra delay.  Once the frequency is known well enough it becomes the drift
+ * used by getOffsetUsingDrift().
+ *
+ * The live state is in the runtime, the copy in NTPPersist is only updated when the frequency,
+ * its uncertainty or the drift changed by NTP_SAVE_PPM or at least every NTP_SAVE_INTERVAL.
+ *
+ * @param offset measured offset, replaced by the estimated offset to adjust by
+ * @param changed set to true if the persisted state changed and should be saved
+ * @return 0 if the clock should be adjusted by offset, -1 otherwise.
+*/
+int NTP::processKalman(uint32_t timestamp, double* offset, double delay, bool* changed)
+{
+    NTPKalman* k     = &_runtime->kalman;
+    NTPKalman* saved = &_persist->kalman;
+    double     z     = *offset;
+    double     drift = _persist->drift;
+
+    if (k->timestamp == 0)
+    {
+        *k = *saved; // power loss
+    }
+
+    //
+    // the delay is used to weight the sample so a long delay does not make it unreachable.
+    //
+    addSample(timestamp, z, delay);
+    _runtime->reach |= 1;
+
+    double min_delay = delay;
+    for (int i = 0; i < _runtime->nsamples; ++i)
+    {
+        min_delay = min(min_delay, _runtime->samples[i].delay);
+    }
+    double r = SQUARE(NTP_KALMAN_SIGMA) + SQUARE((delay - min_delay) / 2);
+
+    if (k->timestamp == 0 || _runtime->nsamples == 1 || timestamp <= k->timestamp)
+    {
+        //
+        // first sample after power loss (or ever), only the frequency is still valid.
+        //
+        if (k->timestamp == 0)
+        {
+            k->freq    = _persist->drift / 1000000.0;
+            k->p[1][1] = SQUARE(NTP_KALMAN_FREQ_INIT / 1000000.0);
+        }
+        k->offset  = z;
+        k->p[0][0] = r;
+        k->p[0][1] = 0.0;
+        k->p[1][0] = 0.0;
+        dlog.info(FPSTR(TAG), F("::processKalman: init offset: %0.6lf freq: %0.3f ppm"), k->offset, k->freq * 1000000.0);
+    }
+    else
+    {
+        //
+        // predict, the frequency is a random walk
+        //
+        double dt = (double)(timestamp - k->timestamp);
+        double q  = SQUARE(_tuning.kalman_noise / 1000000.0) / 86400.0;
+        k->offset += k->freq * dt - _runtime->drifted;
+        double p00 = k->p[0][0] + dt * (k->p[0][1] + k->p[1][0]) + dt * dt * k->p[1][1] + q * dt * dt * dt / 3;
+        double p01 = k->p[0][1] + dt * k->p[1][1] + q * dt * dt / 2;
+        double p11 = k->p[1][1] + q * dt;
+
+        //
+        // update
+        //
+        double s   = p00 + r;
+        double k0  = p00 / s;
+        double k1  = p01 / s;
+        double y   = z - k->offset;
+        k->offset += k0 * y;
+        k->freq   += k1 * y;
+        k->p[0][0] = (1 - k0) * p00;
+        k->p[0][1] = (1 - k0) * p01;
+        k->p[1][0] = k->p[0][1];
+        k->p[1][1] = p11 - k1 * p01;
+        dlog.info(FPSTR(TAG), F("::processKalman: dt: %0.0f innovation: %0.6lf offset: %0.6lf freq: %0.3f ppm"),
+                dt, y, k->offset, k->freq * 1000000.0);
+    }
+    k->timestamp      = timestamp;
+    _runtime->drifted = 0.0;
+
+    double sigma_offset = SQRT(k->p[0][0]);
+    double sigma_freq   = SQRT(k->p[1][1]);
+    dlog.info(FPSTR(TAG), F("::processKalman: sigma offset: %0.6lf freq: %0.3f ppm"), sigma_offset, sigma_freq * 1000000.0);
+
+    if (sigma_freq * 1000000.0 <= NTP_KALMAN_FREQ_SIGMA)
+    {
+        _persist->drift = k->freq * 1000000.0;
+    }
+
+    int err = -1;
+    if (fabs(k->offset) < _tuning.offset_threshold)
+    {
+        dlog.info(FPSTR(TAG), F("::processKalman: offset not big enough for adjust!"));
+    }
+    else
+    {
+        // the caller adjusts the clock by the estimate
+        *offset   = k->offset;
+        k->offset = 0.0;
+        err       = 0;
+    }
+
+    //
+    // poll again when the predicted offset plus the uncertainty it gains from the frequency
+    // reaches the threshold
+    //
+    double q   = SQUARE(_tuning.kalman_noise / 1000000.0) / 86400.0;
+    double res = k->freq - _persist->drift / 1000000.0; // not corrected by drift
+    double lo  = 0.0;
+    double hi  = _tuning.max_interval;
+    for (int i = 0; i < 20; ++i)
+    {
+        double t = (lo + hi) / 2;
+        double v = t * t * k->p[1][1] + q * t * t * t / 3;
+        if (fabs(k->offset + res * t) + SQRT(v) < _tuning.offset_threshold)
+        {
+            lo = t;
+        }
+        else
+        {
+            hi = t;
+        }
+    }
+    _runtime->drift_estimate = res * 1000000.0;
+    _runtime->poll_interval  = lo;
+    dlog.info(FPSTR(TAG), F("::processKalman: poll interval: %f"), _runtime->poll_interval);
+
+    if (saved->timestamp == 0
+            || fabs(k->freq - saved->freq) * 1000000.0 >= NTP_SAVE_PPM
+            || fabs(SQRT(k->p[1][1]) - SQRT(saved->p[1][1])) * 1000000.0 >= NTP_SAVE_PPM
+            || fabs(_persist->drift - drift) >= NTP_SAVE_PPM
+            || timestamp - saved->timestamp >= NTP_SAVE_INTERVAL)
+    {
+        *saved   = *k;
+        *changed = true;
+    }
+    return err;
+}
+
 /**
  * @brief save adjustment value and com[ute drift
- * 
+ *
+ * @param offset the offset the RTC will be adjusted by
 */
-void NTP::clock()
+void NTP::clock(double offset)
 {
     //
     // We only keep adjustments made after we have a full set of samples.  That way we
     // have have, hopefully, a reasonable expectation of filtering out crazy values that
     // are generated from wild swinging offsets sometimes caused by one long delay.
-    if (_runtime->nsamples >= NTP_SAMPLE_COUNT )
+    if (_runtime->nsamples >= _tuning.sample_count)
     {
+        if (_persist->nadjustments > _tuning.adjustment_count)
+        {
+            _persist->nadjustments = _tuning.adjustment_count;
+        }
         for (int i = _persist->nadjustments - 1; i >= 0; --i)
         {
-            if (i == NTP_ADJUSTMENT_COUNT - 1)
+            if (i == _tuning.adjustment_count - 1)
             {
                 continue;
             }
@@ -512,7 +1849,7 @@ void NTP::clock()
                 0, _persist->adjustments[0].adjustment, _persist->adjustments[0].timestamp,
                 TimeUtils::time2str(toEPOCH(_persist->adjustments[0].timestamp)));
 
-        if (_persist->nadjustments < NTP_ADJUSTMENT_COUNT)
+        if (_persist->nadjustments < _tuning.adjustment_count)
         {
             _persist->nadjustments += 1;
         }
@@ -523,7 +1860,21 @@ void NTP::clock()
         computeDrift(&_persist->drift);
 
         dlog.debug(FPSTR(TAG), F("::clock: saving 'persist' data!"));
-        _savePersist();
+        savePersist();
+    }
+    else
+    {
+        //
+        // not kept but the RTC is still adjusted, count it with the drift so that the
+        // next adjustment covers the whole interval.  Like a drift step only note once
+        // per interval that the saved drifted is out of date.
+        //
+        _runtime->drifted += offset;
+        if (!_persist->drifted_stale)
+        {
+            _persist->drifted_stale = 1;
+            _savePersist();
+        }
     }
 }
 
@@ -626,7 +1977,7 @@ void NTP::updateDriftEstimate()
 
         _runtime->drift_estimate = slope * 1000000;
 
-        _runtime->poll_interval = NTP_OFFSET_THRESHOLD / (fabs(_runtime->drift_estimate) / 1000000.0);
+        _runtime->poll_interval = _tuning.offset_threshold / (fabs(_runtime->drift_estimate) / 1000000.0);
         dlog.info(FPSTR(TAG), F("::updateDriftEstimate: poll interval: %f"), _runtime->poll_interval);
     }
 
@@ -19,6 +19,10 @@
 #ifndef NTP_REQUEST_COUNT
 #define NTP_REQUEST_COUNT 1
 #endif
+#define NTP_BURST_MAX     8u        // max requests in a burst
+#ifndef NTP_BURST_SPACING
+#define NTP_BURST_SPACING 100       // milliseconds between requests in a burst
+#endif
 
 typedef struct ntp_sample
 {
@@ -36,7 +40,9 @@ typedef struct ntp_adjustment
 #define NTP_SERVER_LENGTH         64      // max length+1 of ntp server name
 #define NTP_SAMPLE_COUNT          10      // number of NTP samples to keep for std devation filtering
 #define NTP_ADJUSTMENT_COUNT      8       // number of NTP adjustments to keep for least squares drift
+#ifndef NTP_OFFSET_THRESHOLD
 #define NTP_OFFSET_THRESHOLD      0.02    // 20ms offset minimum for adjust!
+#endif
 #ifndef NTP_MAX_INTERVAL
 #define NTP_MAX_INTERVAL          129600  // 36 hours
 #endif
@@ -52,6 +58,82 @@ typedef struct ntp_adjustment
 #ifndef NTP_UNREACH_INTERVAL
 #define NTP_UNREACH_INTERVAL      900     // last few NTP unreachable
 #endif
+#define NTP_ADDRESS_COUNT         4       // number of resolved server addresses to cache
+#ifndef NTP_ADDRESS_TTL
+#define NTP_ADDRESS_TTL           259200  // seconds before a cached address is refreshed with DNS (3 days)
+#endif
+#define NTP_ADDRESS_MAX_FAILS     3       // failed polls before a cached address is not used
+#ifndef NTP_PEER_COUNT
+#define NTP_PEER_COUNT            1       // servers queried per poll, more than 1 enables clock selection
+#endif
+#define NTP_CLUSTER_MIN           2       // clustering never leaves fewer survivors than this
+#define NTP_REPLY_TIMEOUT         1000    // milliseconds to wait for replies
+
+#define NTP_DISCIPLINE_LSQ        0       // least squares drift estimate and averaged adjustments
+#define NTP_DISCIPLINE_KALMAN     1       // two state (offset, frequency) Kalman filter
+#ifndef NTP_DISCIPLINE
+#define NTP_DISCIPLINE            NTP_DISCIPLINE_LSQ
+#endif
+#ifndef NTP_KALMAN_FREQ_NOISE
+#define NTP_KALMAN_FREQ_NOISE     0.05    // frequency random walk in ppm per sqrt(day)
+#endif
+#define NTP_KALMAN_FREQ_INIT      10.0    // initial frequency uncertainty in ppm
+#define NTP_KALMAN_FREQ_SIGMA     0.5     // frequency uncertainty (ppm) below which the estimate is used as drift
+#define NTP_KALMAN_SIGMA          0.002   // offset noise (seconds) of a sample with the minimum delay
+#define NTP_SAVE_PPM              0.02    // smallest drift change (ppm) worth saving NTPPersist (an EEPROM commit) for
+#define NTP_SAVE_INTERVAL         86400   // max seconds the Kalman state goes without being saved
+
+#define NTP_TEMP_BINS             16      // temperature bins in the drift model
+#define NTP_TEMP_LOW              -10     // celsius at the bottom of the first bin
+#define NTP_TEMP_BIN_WIDTH        4       // celsius per bin, the bins cover -10 to 54
+#define NTP_TEMP_WEIGHT_MAX       2       // a bin averages about this many of its most recent intervals
+#define NTP_AGING_PPM             0.1     // RTC aging offset LSB in ppm, positive values slow the oscillator
+#ifndef NTP_TEMP_LEARN_INTERVAL
+#define NTP_TEMP_LEARN_INTERVAL   10800   // minimum seconds of temperature history to learn from
+#endif
+
+//
+// Tuning values used at runtime, the defaults come from the macros above.  NTP_SAMPLE_COUNT and
+// NTP_ADJUSTMENT_COUNT size the arrays below so they are also the max for sample_count/adjustment_count.
+//
+typedef struct ntp_tuning
+{
+    int             sample_count;              // number of samples used for std deviation filtering
+    int             adjustment_count;          // number of adjustments used to compute drift
+    double          offset_threshold;          // minimum offset (seconds) to adjust
+    uint32_t        min_interval;              // minimum computed poll interval
+    uint32_t        max_interval;              // maximum computed poll interval
+    uint32_t        sample_interval;           // poll interval till we have all samples
+    uint32_t        unreach_last_interval;     // poll interval when the last poll failed
+    uint32_t        unreach_interval;          // poll interval when the last few polls failed
+    unsigned int    request_count;             // requests per poll (max NTP_BURST_MAX), the one with the least delay is used
+    int             peer_count;                // servers queried per poll (max NTP_ADDRESS_COUNT)
+    int             discipline;                // NTP_DISCIPLINE_LSQ or NTP_DISCIPLINE_KALMAN
+    double          kalman_noise;              // frequency random walk in ppm per sqrt(day)
+} NTPTuning;
+
+//
+// A resolved server address, the cache survives power loss so that we only need DNS when the
+// addresses expire or all stop answering.
+//
+typedef struct ntp_address
+{
+    uint32_t        ip;                                 // 0 if unused
+    uint32_t        expires;                            // unix time the address should be refreshed, 0 till first used
+    uint8_t         fails;                              // consecutive failed requests
+} NTPAddress;
+
+//
+// Kalman filter state, the runtime has the live copy and NTPPersist the one that is kept over power
+// loss so that the frequency estimate does not have to be learned again.
+//
+typedef struct ntp_kalman
+{
+    uint32_t        timestamp;                          // NTP time of the last update, 0 if not initialized
+    double          offset;                             // estimated offset (seconds) after any adjustment
+    double          freq;                               // estimated frequency error, drift / 1000000
+    double          p[2][2];                            // covariance of (offset, freq)
+} NTPKalman;
 
 //
 //  Long term persisted data includes drift an last adjustment information
@@ -63,6 +145,13 @@ typedef struct ntp_persist
     NTPAdjustment   adjustments[NTP_ADJUSTMENT_COUNT];
     int             nadjustments;
     double          drift;                              // computed drift in parts per million
+    uint32_t        server_hash;                        // hash of the server name the addresses belong to
+    NTPAddress      addresses[NTP_ADDRESS_COUNT];       // resolved server addresses
+    NTPKalman       kalman;                             // used with NTP_DISCIPLINE_KALMAN
+    float           temp_ppm[NTP_TEMP_BINS];            // learned drift (ppm) for each temperature bin
+    uint8_t         temp_count[NTP_TEMP_BINS];          // intervals learned for each bin, max NTP_TEMP_WEIGHT_MAX
+    double          drifted;                            // copy of the runtime drifted when last saved
+    uint8_t         drifted_stale;                      // non zero if drift was applied after drifted was saved
 } NTPPersist;
 
 //
@@ -80,11 +169,37 @@ typedef struct ntp_runtime
     double          delay_mean;                // mean value of sample delay
     double          delay_stddev;              // standard deviation of sample delay
     // cache these to know when we need to lookup the host again and if its been unreachable.
-    char            server[NTP_SERVER_LENGTH]; // cached server name
+    uint32_t        server_hash;               // hash of the server name the samples belong to
     uint32_t        ip;                        // cached server ip address (only works for tcp v4)
     uint8_t         reach;
+    // temperature history for the temperature drift model
+    uint32_t        temp_timestamp;            // unix time of the last temperature, 0 if none
+    float           temp_celsius;              // last temperature
+    uint16_t        temp_minutes[NTP_TEMP_BINS]; // minutes spent in each temperature bin since temp_poll
+    float           temp_drift;                // drift predicted by the model since drift_timestamp
+    float           temp_drifted;              // adjustments made since temp_poll
+    float           temp_residual;             // offset left on the RTC at temp_poll
+    uint32_t        temp_poll;                 // NTP timestamp the history starts, 0 if not valid
+    NTPKalman       kalman;                    // used with NTP_DISCIPLINE_KALMAN, restored from NTPPersist after power loss
 } NTPRunTime;
 
+//
+// Reply from one server when polling multiple peers.  The correctness interval of a peer
+// is offset +/- distance.
+//
+typedef struct ntp_peer
+{
+    uint32_t        ip;
+    uint32_t        sent;                      // microseconds after the second edge that the request was sent
+    bool            valid;                     // got a usable reply
+    bool            truechimer;                // survived selection
+    bool            survivor;                  // survived clustering
+    double          offset;
+    double          delay;
+    double          distance;                  // root distance in seconds
+    uint32_t        seconds;                   // NTP seconds (our time) the reply arrived
+} NTPPeer;
+
 typedef struct ntp_time
 {
     uint32_t seconds;
@@ -111,20 +226,44 @@ class NTP
 public:
     NTP(NTPRunTime *runtime, NTPPersist *persist, void (*savePersist)(), int factor=1);
     void begin(int port = NTP_PORT);
+    void setTuning(const NTPTuning* tuning);
+    static void getDefaultTuning(NTPTuning* tuning);
 
     uint32_t getPollInterval();
-    int getOffsetUsingDrift(double *offset, int (*getTime)(uint32_t *result));
+    int getOffsetUsingDrift(double *offset, int (*getTime)(uint32_t *result, uint32_t *edge));
     // return next poll delay or -1 on error.
-    int getOffset(const char* server, double* offset, int (*getTime)(uint32_t *result));
+    int getOffset(const char* server, double* offset, int (*getTime)(uint32_t *result, uint32_t *edge));
     int getLastOffset(double* offset);
+    void addTemperature(uint32_t now, float celsius);
+    double getTemperatureDrift(float celsius);
+    int applyFrequencyTrim(int8_t* aging, int (*setAging)(int8_t aging));
+    void rtcStopped();
     IPAddress getAddress();
 protected:
-    int  makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result));
-    int  makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result), const unsigned int bestof);
+    int  makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result, uint32_t *edge));
+    int  makeRequest(IPAddress address, double *offset, double *delay, uint32_t *timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), const unsigned int bestof);
+    int  addSample(uint32_t timestamp, double offset, double delay);
     int  process(uint32_t timestamp, double offset, double delay);
-    void clock();
+    int  processKalman(uint32_t timestamp, double* offset, double delay, bool* changed);
+    void clock(double offset);
     void computeDrift(double* drift_result);
     void updateDriftEstimate();
+    void updateTemperatureModel(uint32_t timestamp, double measured, double adjustment, bool* changed);
+    void shiftDrift(double ppm);
+    bool hasTemperatureModel();
+    static int getTemperatureBin(float celsius);
+    int  pollServer(const char* server, double* offset, double* delay, uint32_t* timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), bool* dns, bool* changed);
+    int  pollPeers(const char* server, double* offset, double* delay, uint32_t* timestamp, int (*getTime)(uint32_t *result, uint32_t *edge), bool* dns, bool* changed);
+    int  sendRequest(IPAddress address, uint64_t xmit);
+    int  makeRequests(NTPPeer* peers, int npeers, int (*getTime)(uint32_t *result, uint32_t *edge));
+    int  selectPeers(NTPPeer* peers, int npeers);
+    int  clusterPeers(NTPPeer* peers, int npeers, int survivors);
+    void combinePeers(NTPPeer* peers, int npeers, double* offset, double* delay, uint32_t* timestamp);
+    int  lookupAddress(const char* server, uint32_t now, uint32_t* ip);
+    int  getCachedAddress(uint32_t* ip, const uint32_t* tried, int ntried);
+    NTPAddress* findAddress(uint32_t ip);
+    bool cacheAddress(uint32_t ip, uint32_t now);
+    void savePersist();
 private:
     NTPRunTime *_runtime;
     NTPPersist *_persist;
@@ -132,6 +271,7 @@ private:
     UDPWrapper _udp;
     int        _port;
     int        _factor; // only used when testing to reduce fixed poll interval values by factor
+    NTPTuning  _tuning;
 };
 
 
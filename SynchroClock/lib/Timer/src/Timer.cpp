@@ -22,6 +22,11 @@ uint32_t Timer::getMillis()
     return ms;
 }
 
+uint32_t Timer::getMicros()
+{
+    return micros();
+}
+
 void Timer::start() {
     _start = getMillis();
 }
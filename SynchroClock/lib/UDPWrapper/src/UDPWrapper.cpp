@@ -57,17 +57,35 @@ int UDPWrapper::send(void* buffer, size_t size)
 }
 
 int UDPWrapper::recv(void* buffer, size_t wanted, unsigned int timeout_ms)
+{
+    return recvFrom(buffer, wanted, NULL, timeout_ms);
+}
+
+int UDPWrapper::sendTo(IPAddress address, uint16_t port, void* buffer, size_t size)
+{
+    if (open(address, port))
+    {
+        return -1;
+    }
+    return send(buffer, size);
+}
+
+/**
+ * @brief receive a packet from any address, a timeout of 0 only checks for one already received.
+ *
+ * @param address set to the sender if not NULL
+*/
+int UDPWrapper::recvFrom(void* buffer, size_t wanted, IPAddress* address, unsigned int timeout_ms)
 {
     unsigned int start = millis();
-    // wait for a packet for at most 1 second
     size_t size = 0;
     while ((size = _udp.parsePacket()) == 0)
     {
-        yield();
-        if (millis() - start > timeout_ms)
+        if (millis() - start >= timeout_ms)
         {
             break;
         }
+        yield();
     }
 
     if (size != wanted)
@@ -77,6 +95,10 @@ int UDPWrapper::recv(void* buffer, size_t wanted, unsigned int timeout_ms)
     }
 
     _udp.read((char *)buffer, size);
+    if (address != NULL)
+    {
+        *address = _udp.remoteIP();
+    }
 
     return size;
 }
@@ -21,6 +21,8 @@ public:
     int open(IPAddress address, uint16_t port);
     int send(void* buffer, size_t size);
     int recv(void* buffer, size_t size, unsigned int timeout_ms);
+    int sendTo(IPAddress address, uint16_t port, void* buffer, size_t size);
+    int recvFrom(void* buffer, size_t size, IPAddress* address, unsigned int timeout_ms);
     int close();
 private:
     int     _local_port;
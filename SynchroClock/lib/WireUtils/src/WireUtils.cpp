@@ -21,11 +21,13 @@
  */
 
 #include "WireUtils.h"
+#include "I2CStats.h"
 
 static PROGMEM const char TAG[] = "WireUtils";
 
 WireUtilsC::WireUtilsC()
 {
+	_speed = 0;
 }
 
 /**
@@ -42,6 +44,7 @@ WireUtilsC::WireUtilsC()
 int WireUtilsC::clearBus()
 {
 	dlog.info(FPSTR(TAG), F("::ClearBus: attempting to clean i2c bus"));
+	I2CStats.clear();
 #if defined(TWCR) && defined(TWEN)
 	TWCR &= ~(_BV(TWEN)); //Disable the Atmel 2-Wire interface so we can control the SDA and SCL pins directly
 #endif
@@ -106,6 +109,26 @@ int WireUtilsC::clearBus()
 	return 0; // all ok
 }
 
+/**
+ * Set the bus speed for the next transaction, the devices on the bus don't all
+ * run at the same speed so this is called before every transaction.  The Wire
+ * library is only called if the speed changes.
+ */
+void WireUtilsC::setSpeed(uint32_t hz)
+{
+	if (hz != _speed)
+	{
+		dlog.trace(FPSTR(TAG), F("::setSpeed: %lu"), hz);
+		Wire.setClock(hz);
+		_speed = hz;
+	}
+}
+
+uint32_t WireUtilsC::getSpeed()
+{
+	return _speed;
+}
+
 // act like wire library (even though I don't like it)
 WireUtilsC WireUtils = WireUtilsC();
 
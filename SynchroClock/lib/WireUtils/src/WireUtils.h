@@ -23,12 +23,17 @@
 #ifndef WIREUTILS_H_
 #define WIREUTILS_H_
 #include <Arduino.h>
+#include <Wire.h>
 #include "Logger.h"
 
 class WireUtilsC {
 public:
 	WireUtilsC();
 	int clearBus();
+	void setSpeed(uint32_t hz);
+	uint32_t getSpeed();
+private:
+	uint32_t _speed; // current bus speed, 0 if not set yet
 };
 
 extern WireUtilsC WireUtils;
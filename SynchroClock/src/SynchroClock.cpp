@@ -45,12 +45,18 @@ ESP8266WebServer HTTP(80);                  // used when debugging/stay awake mo
 NTP              ntp(&(dsd.ntp_runtime), &(config.ntp_persist), &saveConfig);   // handles NTP communication & filtering
 Clock            clk(SYNC_PIN);             // clock ticker, manages position of clock
 DS3231           rtc;                       // real time clock on i2c interface
+#if defined(USE_ENERGY_TRACE)
+EnergyTrace      energy;                    // times the phases of each wake cycle
+#endif
 
 boolean save_config  = false; // used by wifi manager when settings were updated.
 boolean force_config = false; // reset handler sets this to force into config mode if button held
 boolean stay_awake   = false; // don't use deep sleep (from config mode option)
 boolean url_update   = false; // set true of we got an update url
 
+ClockConfig clock_config;                 // clock pulse settings for the config portal
+boolean clock_config_valid = false;       // clock_config was read from the clock
+
 char devicename[32];
 
 char message[128]; // buffer for http return values
@@ -380,6 +386,148 @@ void handlePWMTop()
     HTTP.send(200, "text/plain", message);
 }
 
+void handleAPFastDuration()
+{
+    static PROGMEM const char TAG[] = "handleAPFastDuration";
+    uint8_t value;
+    if (HTTP.hasArg("set"))
+    {
+        value = getValidDuration("set");
+        dlog.info(FPSTR(TAG), F("setting ap_fast_duration:%u"), value);
+        if (clk.writeFastPulse(value))
+        {
+            dlog.error(FPSTR(TAG), F("failed to set AP fast duration"));
+        }
+    }
+
+    if (clk.readFastPulse(&value))
+    {
+        sprintf_P(message, PSTR("failed to read AP fast duration\n"));
+    }
+    else
+    {
+        sprintf_P(message, PSTR("AP fast duration: %u\n"), value);
+    }
+
+    HTTP.send(200, "text/plain", message);
+}
+
+void handleAPFastDelay()
+{
+    static PROGMEM const char TAG[] = "handleAPFastDelay";
+    uint8_t value;
+    if (HTTP.hasArg("set"))
+    {
+        value = getValidDuration("set");
+        dlog.info(FPSTR(TAG), F("setting ap_fast_delay:%u"), value);
+        if (clk.writeFastDelay(value))
+        {
+            dlog.error(FPSTR(TAG), F("failed to set AP fast delay"));
+        }
+    }
+
+    if (clk.readFastDelay(&value))
+    {
+        sprintf_P(message, PSTR("failed to read AP fast delay\n"));
+    }
+    else
+    {
+        sprintf_P(message, PSTR("AP fast delay: %u\n"), value);
+    }
+
+    HTTP.send(200, "text/plain", message);
+}
+
+void handleAPRamp()
+{
+    static PROGMEM const char TAG[] = "handleAPRamp";
+    uint8_t value;
+    if (HTTP.hasArg("set"))
+    {
+        value = getValidByte("set");
+        dlog.info(FPSTR(TAG), F("setting ap_ramp:%u"), value);
+        if (clk.writeAPRamp(value))
+        {
+            dlog.error(FPSTR(TAG), F("failed to set AP ramp"));
+        }
+    }
+
+    if (clk.readAPRamp(&value))
+    {
+        sprintf_P(message, PSTR("failed to read AP ramp\n"));
+    }
+    else
+    {
+        sprintf_P(message, PSTR("AP ramp: %u\n"), value);
+    }
+
+    HTTP.send(200, "text/plain", message);
+}
+
+void handleSense()
+{
+    static PROGMEM const char TAG[] = "handleSense";
+    uint8_t  value;
+    uint16_t missed;
+    if (HTTP.hasArg("set"))
+    {
+        value = getValidByte("set");
+        dlog.info(FPSTR(TAG), F("setting sense:%u"), value);
+        if (clk.writeSense(value))
+        {
+            dlog.error(FPSTR(TAG), F("failed to set sense"));
+        }
+    }
+
+    if (HTTP.hasArg("enable"))
+    {
+        clk.setSensing(getValidBoolean("enable"));
+    }
+
+    if (HTTP.hasArg("clear") && getValidBoolean("clear"))
+    {
+        clk.clearMissed();
+    }
+
+    if (clk.readSense(&value) || clk.readMissed(&missed))
+    {
+        sprintf_P(message, PSTR("failed to read sense\n"));
+    }
+    else
+    {
+        sprintf_P(message, PSTR("sense: %u enabled: %u missed: %u\n"), value, clk.getSensing(), missed);
+    }
+
+    HTTP.send(200, "text/plain", message);
+}
+
+void handleTune()
+{
+    static PROGMEM const char TAG[] = "handleTune";
+    uint8_t tp_duty, ap_duty;
+    if (HTTP.hasArg("set"))
+    {
+        boolean tune = getValidBoolean("set");
+        dlog.info(FPSTR(TAG), F("setting tune:%u"), tune);
+        if (tune)
+        {
+            clk.setSensing(true); // tuning needs to know if a step was missed
+        }
+        clk.setTuning(tune);
+    }
+
+    if (clk.readTPDuty(&tp_duty) || clk.readAPDuty(&ap_duty))
+    {
+        sprintf_P(message, PSTR("failed to read duty\n"));
+    }
+    else
+    {
+        sprintf_P(message, PSTR("tune: %u TP duty: %u AP duty: %u\n"), clk.getTuning(), tp_duty, ap_duty);
+    }
+
+    HTTP.send(200, "text/plain", message);
+}
+
 void handleEnable()
 {
     boolean enable;
@@ -398,7 +546,7 @@ void handleRTC()
     char message[64];
 
     DS3231DateTime dt;
-    int err = rtc.readTime(dt);
+    int err = rtc.getTime(dt);
 
     if (!err)
     {
@@ -424,7 +572,7 @@ void handleRTC()
     }
     else
     {
-        sprintf_P(message, PSTR("rtc.readTime() failed!\n"));
+        sprintf_P(message, PSTR("rtc.getTime() failed!\n"));
     }
 
     HTTP.send(200, "text/plain", message);
@@ -505,6 +653,20 @@ void handleWire()
     HTTP.send(200, "text/Plain", message);
 }
 
+void handleStats()
+{
+    char message[256];
+    if (HTTP.hasArg("reset") && getValidBoolean("reset"))
+    {
+        I2CStats.reset();
+    }
+    int len = snprintf_P(message, sizeof(message), PSTR("clock_speed=%u rtc_speed=%u "), clk.getSpeed(), rtc.getSpeed());
+    len += I2CStats.format(message+len, sizeof(message)-len-1);
+    message[len++] = '\n';
+    message[len]   = 0;
+    HTTP.send(200, "text/plain", message);
+}
+
 void handleSave()
 {
     clk.saveConfig();
@@ -528,7 +690,7 @@ bool updateTZOffset()
     static PROGMEM const char TAG[] = "updateTZOffset";
 
     DS3231DateTime dt;
-    if (rtc.readTime(dt))
+    if (rtc.getTime(dt))
     {
         dlog.error(FPSTR(TAG), F("updateTZOffset: FAILED to read RTC"));
         return false;
@@ -551,18 +713,18 @@ bool updateTZOffset()
 void createWiFiParams(WiFiManager& wifi, std::vector<ConfigParamPtr> &params)
 {
     static PROGMEM const char TAG[] = "wifiParams";
-    uint16_t pos = 0;
+    ClockState state;
+    memset(&state, 0, sizeof(state));
+    clk.readState(&state, CLOCK_RETRIES);
+    uint16_t pos = state.position;
     char pos_str[16];
-    clk.readPosition(&pos, 3);
     int hours = pos / 3600;
     int minutes = (pos - (hours * 3600)) / 60;
     int seconds = pos - (hours * 3600) - (minutes * 60);
     memset(pos_str, 0, sizeof(pos_str));
     snprintf_P(pos_str, 15, PSTR("%02d:%02d:%02d"), hours, minutes, seconds);
 
-    uint8_t version = 0;
-    clk.readVersion(&version, 3);
-    snprintf_P(message, sizeof(message), PSTR("<p>ESP: %s ATTiny: %u</p>"), SYNCHRO_CLOCK_VERSION, version);
+    snprintf_P(message, sizeof(message), PSTR("<p>ESP: %s ATTiny: %u</p>"), SYNCHRO_CLOCK_VERSION, state.version);
     params.push_back(std::make_shared<ConfigParam>(wifi, message));
 
     params.push_back(std::make_shared<ConfigParam>(wifi, "position", "Clock Position", pos_str, 10, [](const char* result)
@@ -663,42 +825,49 @@ void createWiFiParams(WiFiManager& wifi, std::vector<ConfigParamPtr> &params)
     {
         config.sleep_duration = atoi(result);
     }));
-    uint8_t value;
-    clk.readTPDuration(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "tp_duration", "Tick Pulse", value, 8, [](const char* result)
+    //
+    // the pulse settings are read and written as one block, changes are written after all params are applied
+    //
+    clock_config_valid = clk.readConfigBlock(&clock_config) == 0;
+    params.push_back(std::make_shared<ConfigParam>(wifi, "tp_duration", "Tick Pulse", clock_config.tp_duration, 8, [](const char* result)
+    {
+        clock_config.tp_duration = TimeUtils::parseSmallDuration(result);
+    }));
+    params.push_back(std::make_shared<ConfigParam>(wifi, "tp_duty", "Tick Pulse Duty", clock_config.tp_duty, 8, [](const char* result)
+    {
+        clock_config.tp_duty = parseDuty(result);
+    }));
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_start", "Adjust Start Pulse", clock_config.ap_start_duration, 4, [](const char* result)
+    {
+        clock_config.ap_start_duration = TimeUtils::parseSmallDuration(result);
+    }));
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_duration", "Adjust Pulse", clock_config.ap_duration, 4, [](const char* result)
     {
-        uint8_t tp_duration = TimeUtils::parseSmallDuration(result);
-        clk.writeTPDuration(tp_duration);
+        clock_config.ap_duration = TimeUtils::parseSmallDuration(result);
     }));
-    clk.readTPDuty(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "tp_duty", "Tick Pulse Duty", value, 8, [](const char* result)
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_duty", "Adjust Pulse Duty", clock_config.ap_duty, 8, [](const char* result)
     {
-        uint8_t tp_duty = parseDuty(result);
-        clk.writeTPDuty(tp_duty);
+        clock_config.ap_duty = parseDuty(result);
     }));
-    clk.readAPStartDuration(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_start", "Adjust Start Pulse", value, 4, [](const char* result)
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_delay", "Adjust Delay", clock_config.ap_delay, 4, [](const char* result)
     {
-        uint8_t ap_start = TimeUtils::parseSmallDuration(result);
-        clk.writeAPStartDuration(ap_start);
+        clock_config.ap_delay = TimeUtils::parseSmallDuration(result);
     }));
-    clk.readAPDuration(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_duration", "Adjust Pulse", value, 4, [](const char* result)
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_fast_duration", "Adjust Fast Pulse", clock_config.ap_fast_duration, 4, [](const char* result)
     {
-        uint8_t ap_duration = TimeUtils::parseSmallDuration(result);
-        clk.writeAPDuration(ap_duration);
+        clock_config.ap_fast_duration = TimeUtils::parseSmallDuration(result);
     }));
-    clk.readAPDuty(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_duty", "Adjust Pulse Duty", value, 8, [](const char* result)
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_fast_delay", "Adjust Fast Delay", clock_config.ap_fast_delay, 4, [](const char* result)
     {
-        uint8_t ap_duty = parseDuty(result);
-        clk.writeAPDuty(ap_duty);
+        clock_config.ap_fast_delay = TimeUtils::parseSmallDuration(result);
     }));
-    clk.readAPDelay(&value);
-    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_delay", "Adjust Delay", value, 4, [](const char* result)
+    params.push_back(std::make_shared<ConfigParam>(wifi, "ap_ramp", "Adjust Ramp Pulses", clock_config.ap_ramp, 4, [](const char* result)
     {
-        uint8_t ap_delay = TimeUtils::parseSmallDuration(result);
-        clk.writeAPDelay(ap_delay);
+        clock_config.ap_ramp = atoi(result);
+    }));
+    params.push_back(std::make_shared<ConfigParam>(wifi, "sense", "Step Sense Threshold", clock_config.sense, 4, [](const char* result)
+    {
+        clock_config.sense = atoi(result);
     }));
     params.push_back(std::make_shared<ConfigParam>(wifi, "syslog_host", "Syslog Host", config.syslog_host, 32, [](const char* result)
     {
@@ -750,14 +919,16 @@ bool initWiFi()
 
     snprintf(devicename, sizeof(devicename), "SynchroClock:%08x", ESP.getChipId());
 
+    bool fast = false;
     if (force_config)
     {
+        dsd.wifi.valid = false;
         createWiFiParams(wm, params);
         dlog.info(FPSTR(TAG), F("params has %d items"), params.size());
         wm.startConfigPortal(devicename, NULL);
         delay(2000); // delay 2 seconds after portal for connect
     }
-    else
+    else if (!(fast = fastConnectWiFi()))
     {
         wm.autoConnect(devicename, NULL);
     }
@@ -777,6 +948,11 @@ bool initWiFi()
     String    mac = WiFi.macAddress();
     dlog.info(FPSTR(TAG), F("Connected! IP address is: %u.%u.%u.%u MAC:'%s'"), ip[0], ip[1], ip[2], ip[3], mac.c_str());
 
+    if (!fast)
+    {
+        saveWiFiCache();
+    }
+
     //
     //  Config was set from captive portal!
     //
@@ -788,6 +964,10 @@ bool initWiFi()
             p->applyIfChanged();
         }
 
+        if (!clock_config_valid || clk.writeConfigBlock(&clock_config))
+        {
+            dlog.error(FPSTR(TAG), F("failed to update clock config!"));
+        }
         clk.saveConfig();
         saveConfig();
         updateTZOffset();
@@ -806,6 +986,83 @@ bool initWiFi()
     return true;
 }
 
+/*
+ * Reconnect using the BSSID, channel and address saved from the last DHCP connection, this skips
+ * the scan and DHCP.  Returns false (with DHCP enabled again) if there is no usable cache or the
+ * connect fails.
+ */
+bool fastConnectWiFi()
+{
+    static PROGMEM const char TAG[] = "fastConnectWiFi";
+
+    if (!dsd.wifi.valid)
+    {
+        dlog.info(FPSTR(TAG), F("no cached connection"));
+        return false;
+    }
+
+    uint32_t now;
+    if (getRTCTime(&now) || now < dsd.wifi.lease_time || now - dsd.wifi.lease_time > FAST_CONNECT_MAX_AGE)
+    {
+        dlog.info(FPSTR(TAG), F("cached address too old, using DHCP"));
+        dsd.wifi.valid = false;
+        return false;
+    }
+
+    dlog.info(FPSTR(TAG), F("channel: %u bssid: %02x:%02x:%02x:%02x:%02x:%02x lease age: %lu"), dsd.wifi.channel,
+            dsd.wifi.bssid[0], dsd.wifi.bssid[1], dsd.wifi.bssid[2], dsd.wifi.bssid[3], dsd.wifi.bssid[4], dsd.wifi.bssid[5],
+            now - dsd.wifi.lease_time);
+
+    String ssid = WiFi.SSID();
+    String psk  = WiFi.psk();
+    WiFi.persistent(false); // don't write the bssid/channel to flash on every connect
+    WiFi.mode(WIFI_STA);
+    WiFi.config(IPAddress(dsd.wifi.ip), IPAddress(dsd.wifi.gateway), IPAddress(dsd.wifi.netmask), IPAddress(dsd.wifi.dns));
+    WiFi.begin(ssid.c_str(), psk.c_str(), dsd.wifi.channel, dsd.wifi.bssid);
+
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < FAST_CONNECT_TIMEOUT)
+    {
+        delay(10);
+    }
+
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        dlog.warning(FPSTR(TAG), F("failed after %lums, falling back to scan & DHCP"), millis() - start);
+        dsd.wifi.valid = false;
+        WiFi.disconnect(); // not persistent so this does not erase the saved credentials
+        WiFi.persistent(true);
+        WiFi.config(0U, 0U, 0U); // enable DHCP again
+        return false;
+    }
+
+    WiFi.persistent(true);
+    dlog.info(FPSTR(TAG), F("connected in %lums"), millis() - start);
+    return true;
+}
+
+/*
+ * save the details of a connection made with a scan and DHCP for fastConnectWiFi()
+ */
+void saveWiFiCache()
+{
+    uint32_t now;
+    if (getRTCTime(&now))
+    {
+        dsd.wifi.valid = false;
+        return;
+    }
+
+    memcpy(dsd.wifi.bssid, WiFi.BSSID(), sizeof(dsd.wifi.bssid));
+    dsd.wifi.channel    = WiFi.channel();
+    dsd.wifi.ip         = WiFi.localIP();
+    dsd.wifi.gateway    = WiFi.gatewayIP();
+    dsd.wifi.netmask    = WiFi.subnetMask();
+    dsd.wifi.dns        = WiFi.dnsIP();
+    dsd.wifi.lease_time = now;
+    dsd.wifi.valid      = true;
+}
+
 bool setSystemTime()
 {
     static PROGMEM const char TAG[] = "setSystemTime";
@@ -814,7 +1071,7 @@ bool setSystemTime()
 
     dlog.info(FPSTR(TAG), F("getting current date/time from RTC"));
 
-    while(rtc.readTime(dt))
+    while(rtc.getTime(dt))
     {
         --tries;
         if (tries == 0)
@@ -852,9 +1109,13 @@ void processOTA(bool enable_clock)
         dlog.info(FPSTR(TAG), F("setting clock enable: %s"), enable_clock ? "true" : "false");
         clk.setEnable(enable_clock);
         dlog.info(FPSTR(TAG), F("got a url update, use deep sleep to reset for a clean heap!"));
-        dlog.end();
         dsd.sleep_delay_left = 0;
+        dsd.next_poll = 0;
         writeDeepSleepData();
+#if defined(USE_ENERGY_TRACE)
+        energy.end(0, true);
+#endif
+        dlog.end();
         ESP.deepSleep(300000, RF_DEFAULT); // short sleep
         while(true); // should never get here
     }
@@ -1005,6 +1266,10 @@ void setup()
     Serial.begin(76800); // use the default baud rate that the ESPs SDK uses
     dlog.begin(new DLogPrintWriter(Serial));
     dlog.setPreFunc(&dlogPrefix);
+#if defined(USE_ENERGY_TRACE)
+    energy.begin(ENERGY_TRACE_RTC_OFFSET);
+#endif
+    I2CStats.begin(I2C_STATS_RTC_OFFSET);
 #ifdef NTP_LOG_LEVEL
     dlog.setLevel(F("NTP"), NTP_LOG_LEVEL);
 #endif
@@ -1023,10 +1288,13 @@ void setup()
     // lets read deep sleep data and see if we need to immed go back to sleep.
     //
     memset(&dsd, 0, sizeof(dsd));
-    readDeepSleepData();
+    bool dsd_valid = readDeepSleepData();
+    bool radio_off = dsd.sleep_delay_left != 0; // sleepFor() only disables the radio if there is more sleep left
 
     Wire.begin();
     Wire.setClockStretchLimit(CLOCK_STRETCH_LIMIT);
+    clk.setSpeed(dsd.clock_speed * I2C_SPEED_UNIT); // the slowest speed till they are negotiated
+    rtc.setSpeed(dsd.rtc_speed * I2C_SPEED_UNIT);
 
     //
     // initialize config to defaults then load.
@@ -1040,45 +1308,62 @@ void setup()
     //
 
     dlog.info(FPSTR(TAG), F("starting clock interface"));
+#if defined(USE_CLOCK_FRAMES)
+    clk.setFramed(true);
+#endif
     while (clk.begin(3) != 0)
     {
         dlog.error(FPSTR(TAG), F("can't talk with Clock Controller!"));
+#if defined(USE_CLOCK_FRAMES)
+        recoverySleep();
+#else
         delay(10000);
+#endif
     }
 
-    uint8_t version = 0;
-    while (clk.readVersion(&version, 3) != 0)
+    if (dsd.clock_speed == 0)
     {
-        dlog.error(FPSTR(TAG), F("can't read clock version!"));
+        dsd.clock_speed = clk.negotiateSpeed() / I2C_SPEED_UNIT;
+    }
+
+    ClockState clk_state;
+    while (clk.readState(&clk_state, CLOCK_RETRIES) != 0)
+    {
+        dlog.error(FPSTR(TAG), F("can't read clock state!"));
+#if defined(USE_CLOCK_FRAMES)
+        recoverySleep();
+#else
         delay(10000);
+#endif
     }
+    uint8_t version = clk_state.version;
     dlog.info(FPSTR(TAG), F("I2CAnalogClock VERSION: %u"), version);
 
     struct rst_info * reset_info = ESP.getResetInfoPtr();
     dlog.info(FPSTR(TAG), F("Reset reason: %lu '%s'"), reset_info->reason, ESP.getResetReason().c_str());
+    dlog.info(FPSTR(TAG), F("I2CAnalogClock restart reason: 0x%02x"), clk_state.reset_reason);
 
-    uint8_t clk_reason; // restart reason of clk
-    while (clk.readResetReason(&clk_reason, 3) != 0)
-    {
-        dlog.error(FPSTR(TAG), F("can't read clock reset reason!"));
-        delay(10000);
-    }
-    dlog.info(FPSTR(TAG), F("I2CAnalogClock restart reason: 0x%02x"), clk_reason);
-
-    uint16_t pos;
-    while (clk.readPosition(&pos, 3))
-    {
-        dlog.error(FPSTR(TAG), F("can't read clock position!"));
-        delay(10000);
-    }
+    uint16_t pos = clk_state.position;
     int hours = pos / 3600;
     int minutes = (pos - (hours * 3600)) / 60;
     int seconds = pos - (hours * 3600) - (minutes * 60);
     dlog.info(FPSTR(TAG), F("clock position: %d (%02d:%02d:%02d)"), pos, hours, minutes, seconds);
 
-    bool clock_was_enabled = clk.getEnable();
+    bool clock_was_enabled = (clk_state.control & BIT_ENABLE) != 0;
     dlog.info(FPSTR(TAG), F("clock interface started, enabled:%s"), clock_was_enabled ? "true" : "false");
 
+    //
+    // the clock put its position back for any step it could not make, sync it even if the RTC did not change.
+    //
+    bool clock_missed_steps = (clk_state.status & STATUS_BIT_MISSED) != 0;
+    if (clock_missed_steps)
+    {
+        uint16_t missed = 0;
+        clk.readMissed(&missed);
+        dlog.warning(FPSTR(TAG), F("clock missed steps: %u"), missed);
+        clk.clearMissed();
+    }
+
     // if the reset/config button is pressed then force config
     if (digitalRead(CONFIG_PIN) == 0)
     {
@@ -1089,9 +1374,13 @@ void setup()
         if (dsd.sleep_delay_left != 0)
         {
             dlog.info(FPSTR(TAG), F("reset button pressed with radio off, short sleep to enable!"));
-            dlog.end();
             dsd.sleep_delay_left = 0;
+            dsd.next_poll = 0;
             writeDeepSleepData();
+#if defined(USE_ENERGY_TRACE)
+            energy.end(0, true);
+#endif
+            dlog.end();
             ESP.deepSleep(300000, RF_DEFAULT); // short sleep to enable the radio!
         }
 
@@ -1131,7 +1420,7 @@ void setup()
 
     }
 
-    bool enabled = clk.getEnable();
+    bool enabled = clock_was_enabled && !force_config; // holding the button for config disables the clock
     dlog.info(FPSTR(TAG), F("clock enable is:%u"), enabled);
 
     strncpy_P(config.ntp_server, PSTR(DEFAULT_NTP_SERVER), sizeof(config.ntp_server) - 1);
@@ -1178,6 +1467,20 @@ void setup()
             config.ntp_server, config.syslog_host, config.syslog_port);
 
     dlog.info(FPSTR(TAG), F("starting RTC"));
+#if defined(USE_CLOCK_FRAMES)
+    if (rtc.begin())
+    {
+        dlog.error(FPSTR(TAG), F("RTC begin failed! Attempting recovery..."));
+
+        //
+        // the clock just answered framed transfers so the bus works, one more try and then sleep.
+        //
+        if (WireUtils.clearBus() || rtc.begin())
+        {
+            recoverySleep();
+        }
+    }
+#else
     while (rtc.begin())
     {
         dlog.error(FPSTR(TAG), F("RTC begin failed! Attempting recovery..."));
@@ -1189,29 +1492,77 @@ void setup()
         }
         delay(1000);
     }
+#endif
+
+    if (dsd.rtc_speed == 0)
+    {
+        dsd.rtc_speed = rtc.negotiateSpeed() / I2C_SPEED_UNIT;
+    }
+
+    //
+    // if the RTC oscillator stopped its time is wrong and so is the drift history since the last poll.
+    // The poll schedule is in RTC time so it is wrong too, poll now to set the RTC (the ESP may not
+    // have lost power so the deep sleep data can still be valid).
+    //
+    bool osf;
+    if (rtc.getOSF(&osf) == 0 && osf)
+    {
+        dlog.warning(FPSTR(TAG), F("RTC oscillator was stopped!"));
+        ntp.rtcStopped();
+        dsd.next_poll        = 0;
+        dsd.sleep_delay_left = 0;
+    }
 
-    bool clock_needs_sync = updateTZOffset();
+    bool clock_needs_sync = updateTZOffset() || clock_missed_steps;
 
 #if defined(USE_DRIFT)
     //
-    // apply drift to RTC
+    // apply drift to RTC, the drift model learns the drift at each temperature
     //
+    ENERGY_MARK(ENERGY_DRIFT);
+    float celsius;
+    DS3231DateTime now;
+    if (rtc.readTemperature(&celsius) == 0 && rtc.getTime(now) == 0)
+    {
+        ntp.addTemperature(now.getUnixTime(), celsius);
+    }
     if (setRTCfromDrift() == 0)
     {
         clock_needs_sync = true;
     }
 #endif
 
-    dlog.info(FPSTR(TAG), F("sleep_delay_left: %lu"), dsd.sleep_delay_left);
+    dlog.info(FPSTR(TAG), F("sleep_delay_left: %lu next_poll: %lu"), dsd.sleep_delay_left, dsd.next_poll);
 
-    if (dsd.sleep_delay_left != 0)
+    if (!wakeNeedsNetwork(dsd_valid, radio_off))
     {
+        if (!radio_off)
+        {
+            WiFi.forceSleepBegin(); // radio is on but we don't need it, don't let the SDK auto connect
+        }
+
         if (clock_needs_sync)
         {
+            ENERGY_MARK(ENERGY_CLOCK);
             setCLKfromRTC();
         }
 
-        sleepFor(dsd.sleep_delay_left);
+        sleepUntilPoll();
+    }
+
+    if (radio_off)
+    {
+        //
+        // the poll is due early (drift moved the RTC forward) but the radio is off, short sleep to enable it.
+        //
+        dlog.info(FPSTR(TAG), F("network needed with radio off, short sleep to enable!"));
+        dsd.sleep_delay_left = 0;
+        writeDeepSleepData();
+#if defined(USE_ENERGY_TRACE)
+        energy.end(0, true);
+#endif
+        dlog.end();
+        ESP.deepSleep(300000, RF_DEFAULT);
     }
 
 #if !defined(DISABLE_DEEP_SLEEP)
@@ -1221,6 +1572,7 @@ void setup()
     }
 #endif
 
+    ENERGY_MARK(ENERGY_WIFI);
     if (!initWiFi())
     {
         //
@@ -1229,6 +1581,7 @@ void setup()
         //
         if (enabled)
         {
+            ENERGY_MARK(ENERGY_CLOCK);
             setCLKfromRTC();
         }
 
@@ -1243,10 +1596,12 @@ void setup()
     dlog.info(FPSTR(TAG), F("I2CAnalogClock VERSION: %u"), version);
     dlog.info(FPSTR(TAG), F("ESP ChipId: 0x%08x (%u)"), ESP.getChipId(), ESP.getChipId());
 
+    ENERGY_MARK(ENERGY_OTA);
     processOTA(clock_was_enabled);
 
     dlog.debug(FPSTR(TAG), F("###### rtc data size: %d"), sizeof(RTCDeepSleepData));
 
+    ENERGY_MARK(ENERGY_NTP);
     ntp.begin(NTP_PORT);
 
     if (!enabled)
@@ -1266,6 +1621,7 @@ void setup()
 
 #if !defined(DISABLE_INITIAL_SYNC)
     dlog.info(FPSTR(TAG), F("syncing clock to RTC!"));
+    ENERGY_MARK(ENERGY_CLOCK);
     setCLKfromRTC();
 #endif
 
@@ -1295,18 +1651,115 @@ void setup()
     HTTP.on("/rtc",         HTTP_GET, handleRTC);
     HTTP.on("/ntp",         HTTP_GET, handleNTP);
     HTTP.on("/wire",        HTTP_GET, handleWire);
+    HTTP.on("/stats",       HTTP_GET, handleStats);
     HTTP.on("/save",        HTTP_GET, handleSave);
     HTTP.on("/erase",       HTTP_GET, handleErase);
     HTTP.on("/ap_start",    HTTP_GET, handleAPStartDuration);
     HTTP.on("/pwm_top",     HTTP_GET, handlePWMTop);
+    HTTP.on("/ap_fast_duration", HTTP_GET, handleAPFastDuration);
+    HTTP.on("/ap_fast_delay",    HTTP_GET, handleAPFastDelay);
+    HTTP.on("/ap_ramp",          HTTP_GET, handleAPRamp);
+    HTTP.on("/sense",            HTTP_GET, handleSense);
+    HTTP.on("/tune",             HTTP_GET, handleTune);
     HTTP.begin();
 }
 
+/*
+ * Decide if this wake needs the network.  The next NTP poll is scheduled in RTC time by sleepFor() using
+ * the interval from ntp.getPollInterval() (based on the drift estimate and reachability), every wake before
+ * that only applies drift and syncs the clock with the radio disabled.
+ */
+bool wakeNeedsNetwork(bool dsd_valid, bool radio_off)
+{
+    static PROGMEM const char TAG[] = "wakeNeedsNetwork";
+
+    if (!dsd_valid)
+    {
+        dlog.info(FPSTR(TAG), F("no deep sleep data, network needed"));
+        return true;
+    }
+
+    uint32_t now;
+    if (dsd.next_poll == 0 || getRTCTime(&now))
+    {
+        // no schedule, fall back to counting down the sleep
+        dlog.info(FPSTR(TAG), F("no poll scheduled, sleep_delay_left: %lu"), dsd.sleep_delay_left);
+        return dsd.sleep_delay_left == 0;
+    }
+
+    //
+    // with the radio already on poll a little early rather than spend another wake.
+    //
+    uint32_t slack = radio_off ? 0 : WAKE_POLL_SLACK;
+    if (now + slack >= dsd.next_poll)
+    {
+        dlog.info(FPSTR(TAG), F("poll due: now: %lu next_poll: %lu reach: 0x%02x"), now, dsd.next_poll, dsd.ntp_runtime.reach);
+        return true;
+    }
+
+    dlog.info(FPSTR(TAG), F("drift only: %lu seconds till poll (drift: %f)"), dsd.next_poll - now, config.ntp_persist.drift);
+    return false;
+}
+
+/*
+ * sleep till the next NTP poll is due, the radio stays disabled until the last MAX_SLEEP_DURATION.
+ */
+void sleepUntilPoll()
+{
+    uint32_t now;
+    if (dsd.next_poll != 0 && getRTCTime(&now) == 0 && dsd.next_poll > now)
+    {
+        sleepFor(dsd.next_poll - now);
+    }
+
+    sleepFor(dsd.sleep_delay_left);
+}
+
+#if defined(USE_CLOCK_FRAMES)
+/*
+ * the clock or the RTC did not answer even with the retries of the framed transfers, that is not noise
+ * on the bus so sleep (the deep sleep data is kept) and start over instead of waiting awake.
+ */
+void recoverySleep()
+{
+    static PROGMEM const char TAG[] = "recoverySleep";
+
+    dlog.info(FPSTR(TAG), F("seconds: %u"), RECOVERY_SLEEP_DURATION);
+    writeDeepSleepData();
+    logI2CStats();
+#if defined(USE_ENERGY_TRACE)
+    energy.end(RECOVERY_SLEEP_DURATION, true);
+#endif
+    dlog.end();
+    ESP.deepSleep((uint64_t)RECOVERY_SLEEP_DURATION * 1000000L, RF_DEFAULT);
+    while(true); // should never get here
+}
+#endif
+
+/*
+ * the RTC time from the register snapshot, without waiting for the second to start
+ */
+int getRTCTime(uint32_t* now)
+{
+    DS3231DateTime dt;
+    if (rtc.getTime(dt))
+    {
+        dlog.error(F("getRTCTime"), F("failed to read from RTC!"));
+        return -1;
+    }
+    *now = dt.getUnixTime();
+    return 0;
+}
+
 void sleepFor(uint32_t sleep_duration)
 {
     static PROGMEM const char TAG[] = "sleepFor";
 
+    ENERGY_MARK(ENERGY_SLEEP);
     dlog.info(FPSTR(TAG), F("seconds: %u"), sleep_duration);
+
+    uint32_t now;
+    dsd.next_poll = getRTCTime(&now) == 0 ? now + sleep_duration : 0;
     dsd.sleep_delay_left = sleep_duration;
     sleep_duration = MAX_SLEEP_DURATION;
     RFMode mode = RF_NO_CAL;
@@ -1328,10 +1781,24 @@ void sleepFor(uint32_t sleep_duration)
     writeDeepSleepData();
 
     dlog.info(FPSTR(TAG), F("Deep Sleep Time: %u"), sleep_duration);
+    logI2CStats();
+#if defined(USE_ENERGY_TRACE)
+    energy.end(sleep_duration, mode != RF_DISABLED);
+#endif
     dlog.end();
     ESP.deepSleep(sleep_us, mode);
 }
 
+//
+// one line per wake with the i2c counters since power on, to compare bus speeds and firmware versions
+//
+void logI2CStats()
+{
+    char buffer[256];
+    I2CStats.format(buffer, sizeof(buffer));
+    dlog.info(F("I2CStats"), F("I2CSTATS clock_speed=%u rtc_speed=%u %s"), clk.getSpeed(), rtc.getSpeed(), buffer);
+}
+
 void loop()
 {
     if (stay_awake)
@@ -1408,7 +1875,6 @@ int setRTCfromOffset(double offset, bool sync)
     //
     // Update the TZ offset in case the timezone offset has changed based on new time.
     //
-    delay(1); // DS3231 seems to need a short delay after write before we read the time back
     updateTZOffset();
 
     dlog.info(FPSTR(TAG), F("old_time: %d new_time: %d"), old_time, new_time);
@@ -1417,11 +1883,16 @@ int setRTCfromOffset(double offset, bool sync)
 }
 
 /*
- * sync to a second boundary and return the current time in seconds
+ * sync to a second boundary and return the current time in seconds, edge (if not NULL)
+ * is set to the Timer::getMicros() value at the boundary.
  */
-int getTime(uint32_t *result)
+int getTime(uint32_t *result, uint32_t *edge)
 {
-    clk.waitForEdge(CLOCK_EDGE_FALLING);
+    uint32_t us;
+    if (clk.waitForEdge(CLOCK_EDGE_FALLING, &us))
+    {
+        return -1;
+    }
     delay(2); // ATtiny85 at 1mhz has interrupts disabled for a bit after the falling edge
     DS3231DateTime dt;
     if (rtc.readTime(dt))
@@ -1430,6 +1901,10 @@ int getTime(uint32_t *result)
         return -1;
     }
     *result = dt.getUnixTime();
+    if (edge != NULL)
+    {
+        *edge = us;
+    }
     return 0;
 }
 
@@ -1486,10 +1961,47 @@ int setRTCfromNTP(const char* server, bool sync, double* result_offset, IPAddres
         return error;
     }
 
+    bool osf;
+    if (rtc.getOSF(&osf) == 0 && osf && rtc.clearOSF())
+    {
+        dlog.error(FPSTR(TAG), F("failed to clear the RTC oscillator stop flag!"));
+    }
+
+#if defined(USE_AGING_TRIM)
+    trimRTCfromDrift();
+#endif
+
     dlog.debug(FPSTR(TAG), F("returning OK"));
     return 0;
 }
 
+int setRTCAging(int8_t aging)
+{
+    return rtc.writeAging(aging);
+}
+
+/*
+ * trim the RTC oscillator so that it stops drifting, must be called just after an NTP poll.
+ */
+int trimRTCfromDrift()
+{
+    static PROGMEM const char TAG[] = "trimRTCfromDrift";
+    int8_t aging;
+    if (rtc.readAging(&aging))
+    {
+        dlog.error(FPSTR(TAG), F("failed to read the aging offset!"));
+        return -1;
+    }
+
+    if (ntp.applyFrequencyTrim(&aging, &setRTCAging))
+    {
+        return -1;
+    }
+
+    dlog.info(FPSTR(TAG), F("********* AGING OFFSET: %d"), aging);
+    return 0;
+}
+
 int setCLKfromRTC()
 {
     static PROGMEM const char TAG[] = "setCLKfromRTC";
@@ -1583,7 +2095,14 @@ int setCLKfromRTC()
 
 uint32_t calculateCRC32(const uint8_t *data, size_t length)
 {
-    uint32_t crc = 0xffffffff;
+    return updateCRC32(0xffffffff, data, length);
+}
+
+//
+// continue a CRC32 over more data, calculateCRC32(data, n+m) == updateCRC32(calculateCRC32(data, n), data+n, m)
+//
+uint32_t updateCRC32(uint32_t crc, const uint8_t *data, size_t length)
+{
     while (length--)
     {
         uint8_t c = *data++;
@@ -1630,14 +2149,30 @@ boolean loadConfig()
     uint32_t crcOfData = calculateCRC32(((uint8_t*) &cfg.data), sizeof(cfg.data));
     dlog.trace(FPSTR(TAG), F("CRC32 of data: %08x"), crcOfData);
     dlog.trace(FPSTR(TAG), F("CRC32 read from EEPROM: %08x"), cfg.crc);
-    if (crcOfData != cfg.crc)
+    if (crcOfData == cfg.crc)
     {
-        dlog.warning(FPSTR(TAG), F("CRC32 in EEPROM memory doesn't match CRC32 of data. Data is probably invalid!"));
-        return false;
+        dlog.debug(FPSTR(TAG), F("CRC32 check ok, data is probably valid."));
+        memcpy(&config, &cfg.data, sizeof(config));
+        return true;
     }
-    dlog.debug(FPSTR(TAG), F("CRC32 check ok, data is probably valid."));
-    memcpy(&config, &cfg.data, sizeof(config));
-    return true;
+
+    //
+    // a config saved by firmware with a smaller NTPPersist is shorter, keep the fields it has and
+    // leave the rest of ntp_persist at its defaults.
+    //
+    uint32_t crc = calculateCRC32(((uint8_t*) &cfg.data), CONFIG_MIN_SIZE);
+    for (size_t size = CONFIG_MIN_SIZE; size < sizeof(cfg.data); crc = updateCRC32(crc, &cfg.data[size], 1), ++size)
+    {
+        if (crc == cfg.crc)
+        {
+            dlog.warning(FPSTR(TAG), F("config from older firmware, size: %u of %u"), size, sizeof(cfg.data));
+            memcpy(&config, &cfg.data, size);
+            return true;
+        }
+    }
+
+    dlog.warning(FPSTR(TAG), F("CRC32 in EEPROM memory doesn't match CRC32 of data. Data is probably invalid!"));
+    return false;
 }
 
 void saveConfig()
@@ -1697,6 +2232,21 @@ boolean readDeepSleepData()
 
 boolean writeDeepSleepData()
 {
+    //
+    // an i2c error this wake dropped to the slowest speed for the rest of the wake, don't keep that
+    // for good after one glitch, negotiate again on the next wake.
+    //
+    if (clk.getSpeed() != dsd.clock_speed * I2C_SPEED_UNIT)
+    {
+        dsd.clock_speed = 0;
+    }
+    if (rtc.getSpeed() != dsd.rtc_speed * I2C_SPEED_UNIT)
+    {
+        dsd.rtc_speed = 0;
+    }
+
+    I2CStats.save();
+
     RTCDeepSleepData rtcdsd;
     memcpy(&rtcdsd.data, &dsd, sizeof(rtcdsd.data));
     rtcdsd.crc = calculateCRC32(((uint8_t*) &rtcdsd.data), sizeof(rtcdsd.data));